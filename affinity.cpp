@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <algorithm>
+
+#include "affinity.h"
+
+// Threads per role whose placement is kept for the report
+#define AFF_MAX_RECORD 64
+
+enum { SCHED_DEFAULT, SCHED_FIFO_CLASS, SCHED_NICE };
+
+struct cpu_info {
+  int cpu, package, core;
+  int sibling;   // 0 for the first CPU of its core, 1 for the next, ...
+};
+
+int affinity_on;
+
+static const char *roleNames[AFF_ROLES] = { "compute", "capture", "output" };
+static int roleCpus[AFF_ROLES][CPU_SETSIZE];
+static int roleCount[AFF_ROLES];
+static const char *roleLayout[AFF_ROLES];
+
+static int schedClass = SCHED_DEFAULT, schedValue;
+// Per thread: 0 not started, 1 left to the OS, else its CPU + 2
+static std::atomic<int> placed[AFF_ROLES][AFF_MAX_RECORD];
+static std::atomic<int> schedFailed, pinFailed;
+
+static cpu_info cpus[CPU_SETSIZE];
+static int ncpus = -1, ncores, npackages;
+
+static int readId(int cpu, const char *name, int fallback)
+{
+  char path[128];
+  int v;
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    return fallback;
+  }
+  if (fscanf(fp, "%d", &v) != 1) {
+    v = fallback;
+  }
+  fclose(fp);
+  return v;
+}
+
+static bool byCore(const cpu_info& a, const cpu_info& b)
+{
+  if (a.package != b.package) {
+    return a.package < b.package;
+  }
+  if (a.core != b.core) {
+    return a.core < b.core;
+  }
+  return a.cpu < b.cpu;
+}
+
+/*******************************************
+ * Model: readTopology
+ * Input: None
+ * Output: None (fills cpus[] once)
+ * Desc: The CPUs this process may run on, from its affinity mask, with
+ *  their package and core from sysfs, sorted so that SMT siblings sit
+ *  next to each other. Without sysfs every CPU counts as its own core.
+ ********************************************/
+static void readTopology()
+{
+  cpu_set_t allowed;
+  if (ncpus >= 0) {
+    return;
+  }
+  ncpus = 0;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+    CPU_ZERO(&allowed);
+    CPU_SET(0, &allowed);
+  }
+  for (int c = 0; c < CPU_SETSIZE; c++) {
+    if (CPU_ISSET(c, &allowed)) {
+      cpu_info& ci = cpus[ncpus++];
+      ci.cpu = c;
+      ci.package = readId(c, "physical_package_id", 0);
+      ci.core = readId(c, "core_id", c);
+    }
+  }
+  std::sort(cpus, cpus + ncpus, byCore);
+  ncores = npackages = 0;
+  for (int k = 0; k < ncpus; k++) {
+    int newCore = k == 0 || cpus[k].core != cpus[k-1].core || cpus[k].package != cpus[k-1].package;
+    cpus[k].sibling = newCore ? 0 : cpus[k-1].sibling + 1;
+    ncores += newCore;
+    npackages += k == 0 || cpus[k].package != cpus[k-1].package;
+  }
+}
+
+static int allowedCpu(int c)
+{
+  for (int k = 0; k < ncpus; k++) {
+    if (cpus[k].cpu == c) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int affinity_set(const char *spec)
+{
+  const char *colon = strchr(spec, ':');
+  int role = -1, n = 0;
+
+  readTopology();
+  for (int r = 0; r < AFF_ROLES; r++) {
+    if (colon && (size_t)(colon - spec) == strlen(roleNames[r]) &&
+        strncmp(spec, roleNames[r], colon - spec) == 0) {
+      role = r;
+    }
+  }
+  if (role < 0) {
+    return -1;
+  }
+  const char *list = colon + 1;
+  if (strcmp(list, "core") == 0 || strcmp(list, "smt") == 0) {
+    int smt = list[0] == 's';
+    for (int k = 0; k < ncpus; k++) {
+      if (smt || cpus[k].sibling == 0) {
+        roleCpus[role][n++] = cpus[k].cpu;
+      }
+    }
+    roleLayout[role] = smt ? "smt" : "core";
+  } else {
+    const char *p = list;
+    while (*p) {
+      char *end;
+      long lo = strtol(p, &end, 10), hi = lo;
+      if (end == p) {
+        return -1;
+      }
+      if (*end == '-') {
+        p = end + 1;
+        hi = strtol(p, &end, 10);
+        if (end == p || hi < lo) {
+          return -1;
+        }
+      }
+      for (long c = lo; c <= hi; c++) {
+        if (c < 0 || c >= CPU_SETSIZE || !allowedCpu(c) || n == CPU_SETSIZE) {
+          return -1;
+        }
+        roleCpus[role][n++] = c;
+      }
+      p = end;
+      if (*p == ',') {
+        p++;
+      } else if (*p) {
+        return -1;
+      }
+    }
+    roleLayout[role] = "list";
+  }
+  if (n == 0) {
+    return -1;
+  }
+  roleCount[role] = n;
+  affinity_on = 1;
+  return 0;
+}
+
+int affinity_sched(const char *spec)
+{
+  char *end;
+  // Before any thread is pinned, so the report sees the whole mask
+  readTopology();
+  if (strncmp(spec, "fifo", 4) == 0 && (spec[4] == '\0' || spec[4] == ':')) {
+    schedClass = SCHED_FIFO_CLASS;
+    schedValue = 10;
+    if (spec[4] == ':') {
+      schedValue = strtol(spec + 5, &end, 10);
+      if (*end || schedValue < sched_get_priority_min(SCHED_FIFO) ||
+          schedValue > sched_get_priority_max(SCHED_FIFO)) {
+        return -1;
+      }
+    }
+  } else if (strncmp(spec, "nice:", 5) == 0) {
+    schedClass = SCHED_NICE;
+    schedValue = strtol(spec + 5, &end, 10);
+    if (*end || end == spec + 5 || schedValue < -20 || schedValue > 19) {
+      return -1;
+    }
+  } else {
+    return -1;
+  }
+  affinity_on = 1;
+  return 0;
+}
+
+int affinity_count(int role)
+{
+  return roleCount[role];
+}
+
+/*******************************************
+ * Model: affinity_thread
+ * Input: role and index of the calling thread
+ * Output: None
+ * Desc: Pins the thread to its CPU and applies -S. A thread whose role
+ *  has no CPUs gets back every usable CPU, since it may have inherited a
+ *  pinned creator's mask. Pinning and -S can fail without
+ *  privileges (SCHED_FIFO needs CAP_SYS_NICE or an rtprio limit, a
+ *  negative nice needs CAP_SYS_NICE); the run then goes on as it is, with
+ *  one warning, and the report says so.
+ ********************************************/
+void affinity_thread(int role, int index)
+{
+  int cpu = -1;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (roleCount[role]) {
+    cpu = roleCpus[role][index % roleCount[role]];
+    CPU_SET(cpu, &set);
+  } else {
+    for (int k = 0; k < ncpus; k++) {
+      CPU_SET(cpus[k].cpu, &set);
+    }
+  }
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (ret) {
+    if (pinFailed.exchange(1) == 0) {
+      fprintf(stderr, "Cannot set the CPUs of %s threads: %s\n", roleNames[role], strerror(ret));
+    }
+    cpu = -1;
+  }
+  if (index < AFF_MAX_RECORD) {
+    placed[role][index].store(cpu + 2, std::memory_order_relaxed);
+  }
+
+  ret = 0;
+  if (schedClass == SCHED_FIFO_CLASS) {
+    struct sched_param param;
+    param.sched_priority = schedValue;
+    ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  } else if (schedClass == SCHED_NICE) {
+    ret = setpriority(PRIO_PROCESS, syscall(SYS_gettid), schedValue) ? errno : 0;
+  }
+  if (ret && schedFailed.exchange(ret) == 0) {
+    fprintf(stderr, "Cannot change the scheduling of %s threads: %s\n", roleNames[role], strerror(ret));
+  }
+}
+
+/*******************************************
+ * Model: affinity_report
+ * Input: stream to write to
+ * Output: None
+ * Desc: Nothing unless -A or -S was given. Otherwise the usable CPUs
+ *  grouped by core (siblings joined by '+'), then for each role the CPU
+ *  each of its threads ran on, then the scheduling class and whether it
+ *  took effect.
+ ********************************************/
+void affinity_report(std::ostream& out)
+{
+  if (!affinity_on) {
+    return;
+  }
+  readTopology();
+  out << "CPU topology, " << ncpus << " CPUs, " << ncores << " cores, "
+      << npackages << (npackages == 1 ? " package" : " packages") << std::endl;
+  out << "CPUs by core,";
+  for (int k = 0; k < ncpus; k++) {
+    out << (cpus[k].sibling ? "+" : " ") << cpus[k].cpu;
+  }
+  out << std::endl;
+
+  for (int r = 0; r < AFF_ROLES; r++) {
+    int any = 0;
+    for (int k = 0; k < AFF_MAX_RECORD; k++) {
+      any |= placed[r][k].load() != 0;
+    }
+    if (!any && roleCount[r] == 0) {
+      continue;
+    }
+    out << "Placement " << roleNames[r] << ", "
+        << (roleCount[r] ? roleLayout[r] : "left to the OS");
+    for (int k = 0; k < AFF_MAX_RECORD; k++) {
+      int p = placed[r][k].load();
+      if (p == 1) {
+        out << " " << k << ":os";
+      } else if (p > 1) {
+        out << " " << k << ":cpu" << p - 2;
+      }
+    }
+    out << std::endl;
+  }
+
+  out << "Scheduling, ";
+  if (schedClass == SCHED_FIFO_CLASS) {
+    out << "SCHED_FIFO priority " << schedValue;
+  } else if (schedClass == SCHED_NICE) {
+    out << "nice " << schedValue;
+  } else {
+    out << "default";
+  }
+  int failed = schedFailed.load();
+  if (failed) {
+    out << " (not applied: " << strerror(failed) << ")";
+  }
+  out << std::endl;
+}
@@ -0,0 +1,35 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <ostream>
+
+// Thread placement (-A) and scheduling class (-S). Threads place
+// themselves as they start, by role and index within the role; thread k
+// of a role goes to the role's k-th CPU, wrapping around. A role with no
+// CPUs is left to the OS. The -S class applies to every placed thread.
+//
+// Roles: compute is every pool worker and whichever thread calls
+// pool_run (index 0), or the offline workers. capture is the capture or
+// reader thread (0), -d decoders (1..N) and multi-stream capture threads
+// (one per stream). output is the -o thread.
+enum { AFF_COMPUTE, AFF_CAPTURE, AFF_OUTPUT, AFF_ROLES };
+
+extern int affinity_on;
+
+// "<role>:<cpus>", where <cpus> is "core" (first SMT sibling of each
+// physical core), "smt" (every CPU, siblings next to each other) or a
+// list such as "0,2,4-7". Returns 0, or -1 if the spec is invalid.
+int affinity_set(const char *spec);
+// "fifo[:<priority>]" or "nice:<n>". Returns 0, or -1 if invalid.
+int affinity_sched(const char *spec);
+// CPUs given to `role`, 0 if it is left to the OS
+int affinity_count(int role);
+// Pins the calling thread and sets its scheduling class
+void affinity_thread(int role, int index);
+// Appends the topology and where each thread went to a perf report
+void affinity_report(std::ostream& out);
+
+#define AFFINITY_THREAD(role, index) \
+  do { if (__builtin_expect(affinity_on, 0)) affinity_thread(role, index); } while (0)
+
+#endif
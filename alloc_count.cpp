@@ -0,0 +1,70 @@
+#include "alloc_count.h"
+#include <stddef.h>
+#include <errno.h>
+#include <atomic>
+
+// glibc's real allocator entry points. Defining malloc and friends in the
+// executable interposes them for every library in the process, so the
+// count includes OpenCV's own allocations.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t align, size_t size);
+}
+
+static std::atomic<uint64_t> heap_allocs;
+
+uint64_t alloc_count(void)
+{
+  return heap_allocs.load(std::memory_order_relaxed);
+}
+
+static inline void counted(void)
+{
+  heap_allocs.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C" void *malloc(size_t size)
+{
+  counted();
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size)
+{
+  counted();
+  return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+  counted();
+  return __libc_realloc(ptr, size);
+}
+
+extern "C" void *memalign(size_t align, size_t size)
+{
+  counted();
+  return __libc_memalign(align, size);
+}
+
+extern "C" void *aligned_alloc(size_t align, size_t size)
+{
+  counted();
+  return __libc_memalign(align, size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t align, size_t size)
+{
+  if (align % sizeof(void *) != 0 || (align & (align - 1)) != 0) {
+    return EINVAL;
+  }
+  counted();
+  void *p = __libc_memalign(align, size);
+  if (p == NULL) {
+    return ENOMEM;
+  }
+  *ptr = p;
+  return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef ALLOC_COUNT_H
+#define ALLOC_COUNT_H
+
+#include <stdint.h>
+
+// Number of heap allocations (malloc/calloc/realloc/memalign family, which
+// also covers operator new and OpenCV's fastMalloc) made by the process so
+// far. Sample it before and after a stretch of frames to prove the steady
+// state does not allocate.
+uint64_t alloc_count(void);
+
+#endif
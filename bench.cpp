@@ -0,0 +1,568 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <new>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "sobel_alg.h"
+#include "sobel_kernels.h"
+#include "incremental.h"
+#include "frame_pool.h"
+#include "pool.h"
+#include "pc.h"
+
+#define EPRINTF(...) fprintf(stderr, __VA_ARGS__)
+
+// Timed samples per case; the median is reported
+#define BENCH_SAMPLES 5
+#define BENCH_MAX_LIST 16
+
+// What each variant runs for one frame, and the bytes it has to move per
+// pixel at the very least (frame reads plus frame writes)
+enum { V_GRAY, V_SOBEL, V_FUSED, V_TWOPASS, V_TILED, V_EDGE, V_EDGENMS, NUM_VARIANTS };
+
+struct variant {
+  const char *name;
+  double bytesPerPixel;
+};
+
+static const variant variants[NUM_VARIANTS] = {
+  { "gray",    3 + 1 },          // BGR in, gray out
+  { "sobel",   1 + 1 },          // gray in, Sobel out
+  { "fused",   3 + 1 },          // BGR in, Sobel out
+  { "twopass", 3 + 1 + 1 + 1 },  // gray written and read back in between
+  { "tiled",   1 + 1 },          // sobel through sobelCalcRect, tile by tile
+  { "edge",    1 + 1.0/8 },      // gray in, 1-bit edge map out
+  { "edgenms", 1 + 1.0/8 },      // the same, thinned by non-maximum suppression
+};
+
+// Edge map threshold for the edge variants
+#define BENCH_EDGE_THRESHOLD 64
+
+struct bench_opts {
+  int widths[BENCH_MAX_LIST], heights[BENCH_MAX_LIST], nres;
+  int threads[BENCH_MAX_LIST], nthreads;
+  const char *isas[BENCH_MAX_LIST];
+  int nisas;
+  int variantOn[NUM_VARIANTS];
+  double minMs;
+  const char *baselineFile;
+  double threshold;
+  const char *outFile;
+};
+
+static bench_opts bopts;
+
+// Frames for one resolution, plus the scalar reference outputs
+struct bench_frames {
+  frame_pool_t pool;
+  Mat bgr;
+  frame_buf_t *gray, *scratch, *out;
+  frame_buf_t *refGray, *refSobel;
+  // Edge maps: output, and the reference without and with suppression
+  frame_pool_t edgePool;
+  frame_buf_t *edges, *refEdges[2];
+};
+
+struct bench_result {
+  std::string name;
+  double nsPerPx, cyclesPerPx, gbs, mpxs;
+  int golden;      // output matches the scalar reference
+  double base;     // baseline Mpx/s, 0 if the case is not in the baseline
+};
+
+struct baseline_entry {
+  std::string name;
+  double mpxs;
+};
+
+void printHelp(char **argv)
+{
+  EPRINTF("Kernel microbenchmarks with a golden-output check\n");
+  EPRINTF("Usage: %s OPTS\n", argv[0]);
+  EPRINTF("-r <list> :  Resolutions, comma separated WxH (default 640x480,1280x720,1920x1080,3840x2160)\n");
+  EPRINTF("-t <list> :  Thread counts, comma separated (default 1,2,4)\n");
+  EPRINTF("-i <list> :  Backends, comma separated (default: every one the CPU supports)\n");
+  EPRINTF("-v <list> :  Variants: gray, sobel, fused, twopass, tiled, edge, edgenms (default: all)\n");
+  EPRINTF("-k <op>[:l2] : Edge operator, as for the driver (default sobel)\n");
+  EPRINTF("-m <ms>   :  Minimum time per case (default 200)\n");
+  EPRINTF("-b <file> :  Compare against a baseline written by -o; fail on regressions\n");
+  EPRINTF("-x <pct>  :  Regression threshold in percent of the baseline's pixels/s (default 10)\n");
+  EPRINTF("-o <file> :  Write the results as JSON (the baseline format)\n");
+}
+
+// Splits a comma-separated list in place
+static int splitList(char *arg, char **items)
+{
+  int n = 0;
+  for (char *tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+    if (n == BENCH_MAX_LIST) {
+      errx(1, "At most %d entries per list", BENCH_MAX_LIST);
+    }
+    items[n++] = tok;
+  }
+  return n;
+}
+
+void parseOpts(int argc, char **argv)
+{
+  char *items[BENCH_MAX_LIST];
+  char defaultRes[] = "640x480,1280x720,1920x1080,3840x2160";
+  char defaultThreads[] = "1,2,4";
+  char *res = defaultRes, *threads = defaultThreads;
+  int c, n;
+
+  memset(&bopts, 0, sizeof(bopts));
+  for (int v = 0; v < NUM_VARIANTS; v++) {
+    bopts.variantOn[v] = 1;
+  }
+  bopts.minMs = 200;
+  bopts.threshold = 10;
+
+  while ((c = getopt(argc, argv, "hr:t:i:v:k:m:b:x:o:")) != -1) {
+    switch (c) {
+      case 'r':
+        res = optarg;
+        break;
+      case 't':
+        threads = optarg;
+        break;
+      case 'i':
+        bopts.nisas = splitList(optarg, (char **)bopts.isas);
+        break;
+      case 'v':
+        memset(bopts.variantOn, 0, sizeof(bopts.variantOn));
+        n = splitList(optarg, items);
+        for (int k = 0; k < n; k++) {
+          int found = 0;
+          for (int v = 0; v < NUM_VARIANTS; v++) {
+            if (strcmp(items[k], variants[v].name) == 0) {
+              bopts.variantOn[v] = found = 1;
+            }
+          }
+          if (!found) {
+            EPRINTF("Invalid variant: %s (gray, sobel, fused, twopass, tiled, edge or edgenms)\n", items[k]);
+            exit(-1);
+          }
+        }
+        break;
+      case 'k': {
+        char *mag = strchr(optarg, ':');
+        if (mag) {
+          *mag++ = '\0';
+        }
+        convOp = -1;
+        for (int k = 0; k < CONV_NUM_OPS; k++) {
+          if (strcmp(optarg, conv_ops[k].name) == 0) {
+            convOp = k;
+          }
+        }
+        if (convOp < 0 || (mag && strcmp(mag, "l1") != 0 && strcmp(mag, "l2") != 0)) {
+          EPRINTF("Invalid operator: %s (sobel, scharr, prewitt or sobel5, optionally :l1 or :l2)\n", optarg);
+          exit(-1);
+        }
+        convMag = mag && strcmp(mag, "l2") == 0 ? CONV_L2 : CONV_L1;
+        break;
+      }
+      case 'm':
+        bopts.minMs = atof(optarg);
+        break;
+      case 'b':
+        bopts.baselineFile = optarg;
+        break;
+      case 'x':
+        bopts.threshold = atof(optarg);
+        break;
+      case 'o':
+        bopts.outFile = optarg;
+        break;
+      case 'h':
+      default:
+        printHelp(argv);
+        exit(c == 'h' ? 0 : -1);
+    }
+  }
+
+  n = splitList(res, items);
+  for (int k = 0; k < n; k++) {
+    if (sscanf(items[k], "%dx%d", &bopts.widths[k], &bopts.heights[k]) != 2 ||
+        bopts.widths[k] < 3 || bopts.heights[k] < 3) {
+      EPRINTF("Invalid resolution: %s (WxH, at least 3x3)\n", items[k]);
+      exit(-1);
+    }
+  }
+  bopts.nres = n;
+  n = splitList(threads, items);
+  for (int k = 0; k < n; k++) {
+    bopts.threads[k] = atoi(items[k]);
+    if (bopts.threads[k] < 1 || bopts.threads[k] > MAX_THREADS) {
+      EPRINTF("Invalid thread count: %s (1 to %d)\n", items[k], MAX_THREADS);
+      exit(-1);
+    }
+  }
+  bopts.nthreads = n;
+  if (bopts.nisas == 0) {
+    static const char *all[] = { "scalar", "neon", "sse2", "avx2", "avx512" };
+    for (unsigned k = 0; k < sizeof(all)/sizeof(all[0]); k++) {
+      if (selectKernels(all[k])) {
+        bopts.isas[bopts.nisas++] = all[k];
+      }
+    }
+  }
+  if (bopts.minMs <= 0 || bopts.threshold < 0) {
+    EPRINTF("-m must be positive and -x not negative\n");
+    exit(-1);
+  }
+}
+
+// Reproducible input with both texture and long edges, so neither the
+// kernels nor the golden check see a degenerate frame
+static void fillInput(Mat& bgr)
+{
+  uint32_t seed = 12345;
+  for (int i = 0; i < bgr.rows; i++) {
+    uint8_t *p = bgr.ptr(i);
+    for (int j = 0; j < bgr.cols * 3; j++) {
+      seed = seed * 1664525 + 1013904223;
+      p[j] = (uint8_t)(((i / 37 + j / 111) & 1) * 128 + (seed >> 26));
+    }
+  }
+}
+
+static void initFrames(bench_frames *f, int rows, int cols)
+{
+  fpool_init(&f->pool, 6, rows, cols, CV_8UC1, 0);
+  f->gray = fpool_get(&f->pool);
+  f->scratch = fpool_get(&f->pool);
+  f->out = fpool_get(&f->pool);
+  f->refGray = fpool_get(&f->pool);
+  f->refSobel = fpool_get(&f->pool);
+  fpool_init(&f->edgePool, 3, rows, EDGE_BYTES(cols), CV_8UC1, 0);
+  f->edges = fpool_get(&f->edgePool);
+  f->refEdges[0] = fpool_get(&f->edgePool);
+  f->refEdges[1] = fpool_get(&f->edgePool);
+  f->bgr.create(rows, cols, CV_8UC3);
+  fillInput(f->bgr);
+
+  // The reference: the scalar backend, one thread, two passes
+  const struct sobel_kernels *active = kernels;
+  kernels = &sobel_kernels_scalar;
+  grayScale(f->bgr, f->refGray->mat);
+  sobelCalc(f->refGray->mat, f->refSobel->mat);
+  sobelEdge(f->refGray->mat, f->refEdges[0]->mat, BENCH_EDGE_THRESHOLD, 0);
+  sobelEdge(f->refGray->mat, f->refEdges[1]->mat, BENCH_EDGE_THRESHOLD, 1);
+  kernels = active;
+  f->refGray->mat.copyTo(f->gray->mat);
+}
+
+static void destroyFrames(bench_frames *f)
+{
+  fbuf_unref(f->gray);
+  fbuf_unref(f->scratch);
+  fbuf_unref(f->out);
+  fbuf_unref(f->refGray);
+  fbuf_unref(f->refSobel);
+  fpool_destroy(&f->pool);
+  fbuf_unref(f->edges);
+  fbuf_unref(f->refEdges[0]);
+  fbuf_unref(f->refEdges[1]);
+  fpool_destroy(&f->edgePool);
+  f->bgr.release();
+}
+
+// sobelCalc through sobelCalcRect over the -I tile grid: what incremental
+// mode costs when every tile has changed
+static void sobelTiled(Mat& gray, Mat& out)
+{
+  for (int y = 0; y < gray.rows; y += INCR_TILE_H) {
+    int y1 = y + INCR_TILE_H < gray.rows ? y + INCR_TILE_H : gray.rows;
+    for (int x = 0; x < gray.cols; x += INCR_TILE_W) {
+      int x1 = x + INCR_TILE_W < gray.cols ? x + INCR_TILE_W : gray.cols;
+      sobelCalcRect(gray, out, x, x1, y, y1);
+    }
+  }
+}
+
+// One frame of variant v; pool is NULL for one thread
+static void runVariant(int v, pool_t *pool, bench_frames *f)
+{
+  Mat& bgr = f->bgr;
+  Mat& gray = f->gray->mat;
+  Mat& scratch = f->scratch->mat;
+  Mat& out = f->out->mat;
+
+  switch (v) {
+    case V_GRAY:
+      if (pool) {
+        grayScaleMT(pool, bgr, scratch);
+      } else {
+        grayScale(bgr, scratch);
+      }
+      break;
+    case V_SOBEL:
+      if (pool) {
+        sobelMT(pool, gray, out);
+      } else {
+        sobelCalc(gray, out);
+      }
+      break;
+    case V_FUSED:
+      if (pool) {
+        sobelFusedMT(pool, bgr, out);
+      } else {
+        sobelFused(bgr, out);
+      }
+      break;
+    case V_TWOPASS:
+      if (pool) {
+        grayScaleMT(pool, bgr, scratch);
+        sobelMT(pool, scratch, out);
+      } else {
+        grayScale(bgr, scratch);
+        sobelCalc(scratch, out);
+      }
+      break;
+    case V_TILED:
+      sobelTiled(gray, out);
+      break;
+    case V_EDGE:
+    case V_EDGENMS:
+      if (pool) {
+        sobelEdgeMT(pool, gray, f->edges->mat, BENCH_EDGE_THRESHOLD, v == V_EDGENMS);
+      } else {
+        sobelEdge(gray, f->edges->mat, BENCH_EDGE_THRESHOLD, v == V_EDGENMS);
+      }
+      break;
+  }
+}
+
+static int sameFrame(Mat& a, Mat& b)
+{
+  for (int i = 0; i < a.rows; i++) {
+    if (memcmp(a.ptr(i), b.ptr(i), a.cols) != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static double median(double *v, int n)
+{
+  std::sort(v, v + n);
+  return n % 2 ? v[n/2] : (v[n/2 - 1] + v[n/2]) / 2;
+}
+
+/*******************************************
+ * Model: runCase
+ * Input: variant, pool (NULL for one thread), frames, perf counters
+ * Output: the case's result
+ * Desc: Poisons the output, runs one frame and checks it against the
+ *  scalar reference, so a stale correct frame can never pass for a wrong
+ *  kernel. That frame also warms the caches and the pool. Then takes
+ *  BENCH_SAMPLES samples, each as many frames as fit in its share of -m,
+ *  and reports the medians.
+ ********************************************/
+static bench_result runCase(int v, pool_t *pool, bench_frames *f, counters_t *pc)
+{
+  bench_result r;
+  int edge = v == V_EDGE || v == V_EDGENMS;
+  Mat& result = v == V_GRAY ? f->scratch->mat : edge ? f->edges->mat : f->out->mat;
+  Mat& ref = v == V_GRAY ? f->refGray->mat : edge ? f->refEdges[v == V_EDGENMS]->mat : f->refSobel->mat;
+  double px = (double)f->gray->mat.rows * f->gray->mat.cols;
+  double ns[BENCH_SAMPLES], cycles[BENCH_SAMPLES];
+  uint64_t budget = (uint64_t)(bopts.minMs * 1e6 / BENCH_SAMPLES);
+
+  for (int i = 0; i < result.rows; i++) {
+    memset(result.ptr(i), 0x5a, result.cols);
+  }
+  runVariant(v, pool, f);
+  r.golden = sameFrame(result, ref);
+
+  for (int s = 0; s < BENCH_SAMPLES; s++) {
+    uint64_t frames = 0, t0 = pc_now_ns(), t;
+    pc_start(pc);
+    do {
+      runVariant(v, pool, f);
+      frames++;
+      t = pc_now_ns();
+    } while (t - t0 < budget);
+    pc_stop(pc);
+    ns[s] = (t - t0) / (frames * px);
+    cycles[s] = pc->cycles.count / (frames * px);
+  }
+  r.nsPerPx = median(ns, BENCH_SAMPLES);
+  // The counters only see the calling thread, so cycles/px is per core
+  // only when that thread does all the work
+  r.cyclesPerPx = pool ? 0 : median(cycles, BENCH_SAMPLES);
+  r.mpxs = 1e3 / r.nsPerPx;
+  r.gbs = variants[v].bytesPerPixel / r.nsPerPx;
+  r.base = 0;
+  return r;
+}
+
+// Reads a file written by -o. Not a general JSON parser: it relies on
+// writeResults putting each case on its own line.
+static std::vector<baseline_entry> readBaseline(const char *path)
+{
+  std::vector<baseline_entry> base;
+  char line[512], name[256];
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    err(1, "Cannot open baseline %s", path);
+  }
+  while (fgets(line, sizeof(line), fp)) {
+    const char *c = strstr(line, "\"case\": \"");
+    const char *m = strstr(line, "\"mpx_s\": ");
+    if (c && m && sscanf(c + 9, "%255[^\"]", name) == 1) {
+      baseline_entry e;
+      e.name = name;
+      e.mpxs = strtod(m + 9, NULL);
+      base.push_back(e);
+    }
+  }
+  fclose(fp);
+  if (base.empty()) {
+    errx(1, "No cases in baseline %s", path);
+  }
+  return base;
+}
+
+static void writeResults(const char *path, const std::vector<bench_result>& results,
+                         const counters_t *pc)
+{
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    err(1, "Cannot create %s", path);
+  }
+  fprintf(fp, "{\n  \"op\": \"%s%s\",\n  \"cycles_estimated\": %s,\n  \"results\": [\n",
+          conv_ops[convOp].name, convMag == CONV_L2 ? ":l2" : "",
+          pc->estimated ? "true" : "false");
+  for (size_t k = 0; k < results.size(); k++) {
+    const bench_result& r = results[k];
+    fprintf(fp, "    { \"case\": \"%s\", \"ns_per_px\": %.5f, ", r.name.c_str(), r.nsPerPx);
+    if (r.cyclesPerPx > 0) {
+      fprintf(fp, "\"cycles_per_px\": %.4f, ", r.cyclesPerPx);
+    } else {
+      fprintf(fp, "\"cycles_per_px\": null, ");
+    }
+    fprintf(fp, "\"gb_s\": %.4f, \"mpx_s\": %.3f, \"golden\": %s }%s\n",
+            r.gbs, r.mpxs, r.golden ? "true" : "false", k + 1 < results.size() ? "," : "");
+  }
+  fprintf(fp, "  ]\n}\n");
+  if (fclose(fp)) {
+    err(1, "Cannot write %s", path);
+  }
+}
+
+/*******************************************
+ * Model: main
+ * Input: see printHelp
+ * Output: 0, or 1 if any case failed its golden check or fell more than
+ *  -x percent below its baseline
+ * Desc: Runs every variant x backend x resolution x thread count. The
+ *  tiled variant is single-threaded, as sobelCalcRect is only ever called
+ *  from one thread per tile row. Cases missing from the baseline are
+ *  reported but never fail.
+ ********************************************/
+int main(int argc, char **argv)
+{
+  std::vector<bench_result> results;
+  std::vector<baseline_entry> base;
+  pool_t *pools[BENCH_MAX_LIST];
+  counters_t pc;
+  int failed = 0, regressed = 0, compared = 0;
+  char name[256];
+
+  setlocale(LC_NUMERIC, "C");
+  parseOpts(argc, argv);
+  if (bopts.baselineFile) {
+    base = readBaseline(bopts.baselineFile);
+  }
+  pc_init(&pc, 0, NULL);
+
+  for (int t = 0; t < bopts.nthreads; t++) {
+    pools[t] = NULL;
+    if (bopts.threads[t] > 1) {
+      void *mem;
+      if (posix_memalign(&mem, POOL_CACHE_LINE, sizeof(pool_t))) {
+        errx(1, "out of memory");
+      }
+      pools[t] = new (mem) pool_t;
+      pool_init(pools[t], bopts.threads[t]);
+    }
+  }
+
+  printf("Operator %s%s; cycles/px %s; golden reference: scalar backend, one thread\n",
+         conv_ops[convOp].name, convMag == CONV_L2 ? ":l2" : "",
+         pc.estimated ? "estimated at PROC_FREQ" : "from the cycle counter");
+  printf("%-34s %9s %9s %8s %9s %8s %s\n",
+         "case", "ns/px", "cycles/px", "GB/s", "Mpx/s", "vs base", "golden");
+
+  for (int res = 0; res < bopts.nres; res++) {
+    bench_frames frames;
+    initFrames(&frames, bopts.heights[res], bopts.widths[res]);
+    for (int i = 0; i < bopts.nisas; i++) {
+      kernels = selectKernels(bopts.isas[i]);
+      if (kernels == NULL) {
+        errx(1, "Backend %s is unknown or not supported here", bopts.isas[i]);
+      }
+      for (int v = 0; v < NUM_VARIANTS; v++) {
+        if (!bopts.variantOn[v]) {
+          continue;
+        }
+        for (int t = 0; t < bopts.nthreads; t++) {
+          if (v == V_TILED && bopts.threads[t] > 1) {
+            continue;
+          }
+          snprintf(name, sizeof(name), "%s/%s/%dx%d/t%d", variants[v].name, kernels->name,
+                   bopts.widths[res], bopts.heights[res], bopts.threads[t]);
+          bench_result r = runCase(v, pools[t], &frames, &pc);
+          r.name = name;
+          for (size_t b = 0; b < base.size(); b++) {
+            if (base[b].name == r.name) {
+              r.base = base[b].mpxs;
+            }
+          }
+
+          char cyc[16], vs[16];
+          snprintf(cyc, sizeof(cyc), r.cyclesPerPx > 0 ? "%.3f" : "-", r.cyclesPerPx);
+          snprintf(vs, sizeof(vs), r.base > 0 ? "%+.1f%%" : "-", (r.mpxs / r.base - 1) * 100);
+          int slow = r.base > 0 && r.mpxs < r.base * (1 - bopts.threshold / 100);
+          printf("%-34s %9.4f %9s %8.2f %9.1f %8s %s%s\n", name, r.nsPerPx, cyc, r.gbs,
+                 r.mpxs, vs, r.golden ? "ok" : "MISMATCH", slow ? "  REGRESSION" : "");
+          fflush(stdout);
+          failed += !r.golden;
+          regressed += slow;
+          compared += r.base > 0;
+          results.push_back(r);
+        }
+      }
+    }
+    destroyFrames(&frames);
+  }
+
+  for (int t = 0; t < bopts.nthreads; t++) {
+    if (pools[t]) {
+      pool_destroy(pools[t]);
+      pools[t]->~pool_t();
+      free(pools[t]);
+    }
+  }
+  pc_close(&pc);
+  if (bopts.outFile) {
+    writeResults(bopts.outFile, results, &pc);
+  }
+
+  printf("%zu cases, %d golden mismatches", results.size(), failed);
+  if (bopts.baselineFile) {
+    printf(", %d of %d compared cases more than %.0f%% below %s",
+           regressed, compared, bopts.threshold, bopts.baselineFile);
+  }
+  printf("\n");
+  return failed || regressed ? 1 : 0;
+}
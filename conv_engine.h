@@ -0,0 +1,286 @@
+#ifndef CONV_ENGINE_H
+#define CONV_ENGINE_H
+
+#include <stdint.h>
+#include <string.h>
+#include "sobel_kernels.h"
+
+// Compile-time gradient operators. An operator is a pair of separable 1-D
+// tap lists given as template parameters: a smoothing filter s and a
+// derivative filter d, both 2R+1 long. The horizontal gradient is d across
+// the columns of s down the rows, the vertical one the other way round:
+//
+//   S[x] = sum_y s[y] * p[y][x]        Gx = sum_x d[x] * S[x]
+//   D[x] = sum_y d[y] * p[y][x]        Gy = sum_x s[x] * D[x]
+//
+// Every product is expanded at compile time: zero taps vanish (with the
+// loads only they used), unit taps are plain adds, powers of two are
+// shifts, and taps k and 2R-k are summed or differenced first when their
+// coefficients match up to sign. That is how the hand-written 3x3 kernels
+// share their corner differences, generalised.
+//
+// The engine is generic over a vector type V. Each backend supplies one
+// and instantiates the operators with SOBEL_CONV_TABLE. Everything here
+// has internal linkage: the same template is built once per ISA, and the
+// linker must never swap the AVX-512 copy into the SSE2 table.
+//
+// V provides:
+//   w           16-bit lanes (int for the scalar reference)
+//   L, H        pixels per step, and how many w they take
+//   load(p, h)  widens part h of the L bytes at p
+//   store(p, x) saturates the H parts x[] to bytes and stores L of them
+//   zero, add, sub, shl, mul, abs, min255
+//   l2(gx, gy)  min(floor(sqrt(gx^2 + gy^2)), 255)
+//   gt(a, b)    all ones in the lanes where a > b, else 0
+//   sel(m, a, b) a where the gt() mask m is set, else b
+//   mulhi(a, c) (a * c) >> 16, for a >= 0 and an even 0 < c < 2^15
+
+template <int... C> struct taps {
+  static const int n = sizeof...(C);
+};
+
+// tap<K, T>::value is the K-th coefficient of T
+template <int K, class T> struct tap;
+template <int K, int C0, int... C> struct tap<K, taps<C0, C...> > {
+  static const int value = tap<K-1, taps<C...> >::value;
+};
+template <int C0, int... C> struct tap<0, taps<C0, C...> > {
+  static const int value = C0;
+};
+
+template <class Smooth, class Diff> struct separable_op {
+  typedef Smooth smooth;
+  typedef Diff diff;
+  static const int R = Smooth::n / 2;
+};
+
+typedef separable_op<taps<1, 2, 1>, taps<1, 0, -1> > op_sobel;
+typedef separable_op<taps<3, 10, 3>, taps<1, 0, -1> > op_scharr;
+typedef separable_op<taps<1, 1, 1>, taps<1, 0, -1> > op_prewitt;
+typedef separable_op<taps<1, 4, 6, 4, 1>, taps<1, 2, 0, -2, -1> > op_sobel5;
+
+template <int C> struct log2c {
+  static const int value = 1 + log2c<C/2>::value;
+};
+template <> struct log2c<1> {
+  static const int value = 0;
+};
+
+// C * x for a compile-time C > 0
+template <class V, int C>
+static inline typename V::w scale(typename V::w x)
+{
+  if (C == 1) {
+    return x;
+  }
+  if ((C & (C - 1)) == 0) {
+    return V::shl(x, log2c<(C > 0 ? C : 1)>::value);
+  }
+  return V::mul(x, C);
+}
+
+// acc + C * x
+template <class V, int C>
+static inline typename V::w addScaled(typename V::w acc, typename V::w x)
+{
+  if (C > 0) {
+    return V::add(acc, scale<V, (C > 0 ? C : 1)>(x));
+  }
+  if (C < 0) {
+    return V::sub(acc, scale<V, (C < 0 ? -C : 1)>(x));
+  }
+  return acc;
+}
+
+// acc + sum of T[k] * x[k] for k in [K, N-1-K], pairing k with N-1-k.
+// Rest is the number of taps strictly between the pair.
+template <class V, class T, int K, int N = T::n, int Rest = N - 1 - 2*K>
+struct pair_sum {
+  static inline typename V::w apply(const typename V::w *x, typename V::w acc)
+  {
+    const int a = tap<K, T>::value, b = tap<N-1-K, T>::value;
+    if (a == b) {
+      acc = addScaled<V, a>(acc, V::add(x[K], x[N-1-K]));
+    } else if (a == -b) {
+      acc = addScaled<V, a>(acc, V::sub(x[K], x[N-1-K]));
+    } else {
+      acc = addScaled<V, b>(addScaled<V, a>(acc, x[K]), x[N-1-K]);
+    }
+    return pair_sum<V, T, K+1, N>::apply(x, acc);
+  }
+};
+
+template <class V, class T, int K, int N> struct pair_sum<V, T, K, N, 0> {
+  static inline typename V::w apply(const typename V::w *x, typename V::w acc)
+  {
+    return addScaled<V, tap<K, T>::value>(acc, x[K]);
+  }
+};
+
+template <class V, class T, int K, int N> struct pair_sum<V, T, K, N, -1> {
+  static inline typename V::w apply(const typename V::w *, typename V::w acc)
+  {
+    return acc;
+  }
+};
+
+// Gradient magnitude of part h of the L pixels at column j
+template <class V, class Op, int Mag>
+static inline typename V::w convStep(const uint8_t *const *rows, int j, int h)
+{
+  typedef typename V::w w;
+  const int R = Op::R, N = 2*R + 1;
+  w px[N][N], S[N], D[N];
+
+  // px[x][y]: column x, row y, so each column is one tap list
+  for (int x = 0; x < N; x++) {
+    for (int y = 0; y < N; y++) {
+      px[x][y] = V::load(rows[y] + j + x - R, h);
+    }
+  }
+  for (int x = 0; x < N; x++) {
+    S[x] = pair_sum<V, typename Op::smooth, 0>::apply(px[x], V::zero());
+    D[x] = pair_sum<V, typename Op::diff, 0>::apply(px[x], V::zero());
+  }
+  w gx = pair_sum<V, typename Op::diff, 0>::apply(S, V::zero());
+  w gy = pair_sum<V, typename Op::smooth, 0>::apply(D, V::zero());
+  if (Mag == CONV_L2) {
+    return V::l2(gx, gy);
+  }
+  // Same L1 form as sobelRow; store() saturates the sum
+  return V::add(V::min255(V::abs(gx)), V::min255(V::abs(gy)));
+}
+
+// Scalar reference; also finishes the vector kernels' rows
+struct conv_scalar {
+  typedef int w;
+  static const int L = 1, H = 1;
+  static inline w load(const uint8_t *p, int) { return *p; }
+  static inline void store(uint8_t *p, const w *x) { *p = x[0] > 255 ? 255 : x[0]; }
+  static inline w zero() { return 0; }
+  static inline w add(w a, w b) { return a + b; }
+  static inline w sub(w a, w b) { return a - b; }
+  static inline w shl(w a, int n) { return a * (1 << n); }
+  static inline w mul(w a, int c) { return a * c; }
+  static inline w abs(w a) { return a < 0 ? -a : a; }
+  static inline w min255(w a) { return a > 255 ? 255 : a; }
+  static inline w gt(w a, w b) { return a > b ? -1 : 0; }
+  static inline w sel(w m, w a, w b) { return m ? a : b; }
+  static inline w mulhi(w a, int c) { return (a * c) >> 16; }
+  static inline w l2(w gx, w gy)
+  {
+    int n = gx*gx + gy*gy;
+    int r = 0;
+    n = n > 255*255 ? 255*255 : n;
+    for (int b = 128; b; b >>= 1) {
+      if ((r + b) * (r + b) <= n) {
+        r += b;
+      }
+    }
+    return r;
+  }
+};
+
+/*******************************************
+ * Model: convRow
+ * Input: the 2R+1 gray rows centred on the output row, row width
+ * Output: None directly. Writes out[0..width)
+ * Desc: One output row of operator Op. The R pixels at either end have
+ *  no full neighbourhood and are written as 0, like sobelRow's border.
+ ********************************************/
+template <class V, class Op, int Mag>
+static void convRow(const uint8_t *const *rows, uint8_t *out, int width)
+{
+  const int R = Op::R;
+  if (width <= 2*R) {
+    memset(out, 0, width);
+    return;
+  }
+  memset(out, 0, R);
+  memset(out + width - R, 0, R);
+
+  int j = R;
+  for (; j + V::L + R <= width; j += V::L) {
+    typename V::w mag[V::H];
+    for (int h = 0; h < V::H; h++) {
+      mag[h] = convStep<V, Op, Mag>(rows, j, h);
+    }
+    V::store(out + j, mag);
+  }
+  for (; j < width - R; j++) {
+    int mag = convStep<conv_scalar, Op, Mag>(rows, j, 0);
+    conv_scalar::store(out + j, &mag);
+  }
+}
+
+// tan(22.5 degrees) * 2^16, rounded to even for mulhi
+#define NMS_TAN22 27146
+
+// nmsRow for part h of the L pixels at column j
+template <class V>
+static inline typename V::w nmsStep(const uint8_t *const *gray, const uint8_t *const *mag, int j, int h)
+{
+  typedef typename V::w w;
+  w a0 = V::load(gray[0] + j - 1, h), a1 = V::load(gray[0] + j, h), a2 = V::load(gray[0] + j + 1, h);
+  w r0 = V::load(gray[1] + j - 1, h), r2 = V::load(gray[1] + j + 1, h);
+  w b0 = V::load(gray[2] + j - 1, h), b1 = V::load(gray[2] + j, h), b2 = V::load(gray[2] + j + 1, h);
+
+  // Right minus left and below minus above, in image coordinates
+  w dx = V::add(V::add(V::sub(a2, a0), V::sub(b2, b0)), V::shl(V::sub(r2, r0), 1));
+  w dy = V::add(V::add(V::sub(b0, a0), V::sub(b2, a2)), V::shl(V::sub(b1, a1), 1));
+  w ax = V::abs(dx), ay = V::abs(dy);
+  w zero = V::zero();
+
+  // Within 22.5 degrees of horizontal, of vertical, or on a diagonal.
+  // On a diagonal neither derivative is 0, so dy < 0 is !(dy > 0) there.
+  w notHoriz = V::gt(ay, V::mulhi(ax, NMS_TAN22));
+  w notVert = V::gt(ax, V::mulhi(ay, NMS_TAN22));
+  w sameSign = V::sel(V::gt(dx, zero), V::gt(dy, zero), V::gt(zero, dy));
+
+  const uint8_t *up = mag[0] + j, *row = mag[1] + j, *down = mag[2] + j;
+  // Down-right gradients compare up-left with down-right, down-left ones
+  // up-right with down-left
+  w diag1 = V::sel(sameSign, V::load(up - 1, h), V::load(up + 1, h));
+  w diag2 = V::sel(sameSign, V::load(down + 1, h), V::load(down - 1, h));
+  w n1 = V::sel(notHoriz, V::sel(notVert, diag1, V::load(up, h)), V::load(row - 1, h));
+  w n2 = V::sel(notHoriz, V::sel(notVert, diag2, V::load(down, h)), V::load(row + 1, h));
+
+  w m = V::load(row, h);
+  return V::sel(V::gt(m, n1), V::sel(V::gt(n2, m), zero, m), zero);
+}
+
+/*******************************************
+ * Model: nmsRow
+ * Input: gray rows and magnitude rows above, at and below the output row
+ * Output: None directly. Writes out[0..width)
+ * Desc: Non-maximum suppression (sobel_kernels.h) for one row. The
+ *  first and last pixels have no left or right neighbour and are 0.
+ ********************************************/
+template <class V>
+static void nmsRow(const uint8_t *const *gray, const uint8_t *const *mag, uint8_t *out, int width)
+{
+  out[0] = 0;
+  out[width-1] = 0;
+
+  int j = 1;
+  for (; j + V::L + 1 <= width; j += V::L) {
+    typename V::w keep[V::H];
+    for (int h = 0; h < V::H; h++) {
+      keep[h] = nmsStep<V>(gray, mag, j, h);
+    }
+    V::store(out + j, keep);
+  }
+  for (; j < width - 1; j++) {
+    int keep = nmsStep<conv_scalar>(gray, mag, j, 0);
+    conv_scalar::store(out + j, &keep);
+  }
+}
+
+// A backend's convRow kernels, laid out like sobel_kernels.convRow
+#define SOBEL_CONV_TABLE(V) \
+  { { convRow<V, op_sobel, CONV_L1>, convRow<V, op_sobel, CONV_L2> }, \
+    { convRow<V, op_scharr, CONV_L1>, convRow<V, op_scharr, CONV_L2> }, \
+    { convRow<V, op_prewitt, CONV_L1>, convRow<V, op_prewitt, CONV_L2> }, \
+    { convRow<V, op_sobel5, CONV_L1>, convRow<V, op_sobel5, CONV_L2> } }
+
+#endif
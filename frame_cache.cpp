@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "sobel_alg.h"
+#include "frame_cache.h"
+
+using namespace cv;
+
+#define CACHE_LINE 64
+
+static uint64_t roundUp(uint64_t v, uint64_t to)
+{
+  return (v + to - 1) / to * to;
+}
+
+/*******************************************
+ * Model: dumpFrames
+ * Input: output path, whether to store gray instead of BGR
+ * Output: number of frames written
+ * Desc: Pulls frames from the source selected on the command line and
+ *  writes each one, row-padded, into a frame slot of the cache file. The
+ *  header is written last so a partial dump is never mistaken for a
+ *  valid one.
+ ********************************************/
+int dumpFrames(const char *path, int gray)
+{
+  frame_source_t *source = openFrameSource();
+  cache_header hdr;
+  gray = gray || source->type == CV_8UC1;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+  hdr.version = CACHE_VERSION;
+  hdr.width = source->width;
+  hdr.height = source->height;
+  hdr.channels = gray ? 1 : 3;
+  hdr.stride = roundUp((uint64_t)hdr.width * hdr.channels, CACHE_LINE);
+  hdr.frameBytes = roundUp(hdr.stride * hdr.height, CACHE_ALIGN);
+  hdr.dataOffset = roundUp(sizeof(hdr), CACHE_ALIGN);
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    err(1, "Cannot create %s", path);
+  }
+
+  // One staging frame with the file's layout; padding stays zero
+  void *p;
+  if (posix_memalign(&p, CACHE_ALIGN, hdr.frameBytes)) {
+    errx(1, "dumpFrames: out of memory");
+  }
+  memset(p, 0, hdr.frameBytes);
+  Mat out(hdr.height, hdr.width, gray ? CV_8UC1 : CV_8UC3, p, hdr.stride);
+
+  Mat frame;
+  while ((int)hdr.frames < opts.numFrames && source->read(source, frame)) {
+    if (gray && frame.channels() == 3) {
+      grayScale(frame, out);
+    } else {
+      frame.copyTo(out);
+    }
+    off_t off = hdr.dataOffset + hdr.frames * hdr.frameBytes;
+    if (pwrite(fd, p, hdr.frameBytes, off) != (ssize_t)hdr.frameBytes) {
+      err(1, "Cannot write %s", path);
+    }
+    hdr.frames++;
+  }
+
+  if (pwrite(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) || close(fd)) {
+    err(1, "Cannot write %s", path);
+  }
+  out.release();
+  free(p);
+  closeFrameSource(source);
+  return (int)hdr.frames;
+}
+
+struct cache_state {
+  uint8_t *base;
+  size_t bytes;
+  cache_header hdr;
+  uint64_t next;
+};
+
+// Hands out a Mat header over the mapping; the kernels read the page
+// cache directly
+static int cacheRead(frame_source_t *src, Mat& frame)
+{
+  cache_state *st = (cache_state *)src->state;
+  if (st->next >= st->hdr.frames) {
+    return 0;
+  }
+  uint8_t *data = st->base + st->hdr.dataOffset + st->next * st->hdr.frameBytes;
+  frame = Mat(src->height, src->width, src->type, data, st->hdr.stride);
+  st->next++;
+  return 1;
+}
+
+static void cacheClose(frame_source_t *src)
+{
+  cache_state *st = (cache_state *)src->state;
+  munmap(st->base, st->bytes);
+  delete st;
+}
+
+/*******************************************
+ * Model: openCacheSource
+ * Input: path of a file written by dumpFrames
+ * Output: frame source over the mapped file
+ * Desc: Maps the whole file read-only and asks for sequential readahead,
+ *  so a clip larger than RAM streams from disk at full speed and a cached
+ *  one replays at memory bandwidth. Frames are never copied or decoded.
+ ********************************************/
+frame_source_t *openCacheSource(const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    err(1, "Cannot open %s", path);
+  }
+  struct stat sb;
+  if (fstat(fd, &sb)) {
+    err(1, "Cannot stat %s", path);
+  }
+
+  cache_state *st = new cache_state;
+  if ((size_t)sb.st_size < sizeof(st->hdr) ||
+      pread(fd, &st->hdr, sizeof(st->hdr), 0) != (ssize_t)sizeof(st->hdr) ||
+      memcmp(st->hdr.magic, CACHE_MAGIC, sizeof(st->hdr.magic)) != 0 ||
+      st->hdr.version != CACHE_VERSION) {
+    errx(1, "%s is not a frame cache file", path);
+  }
+  cache_header& hdr = st->hdr;
+  if (hdr.channels == 0) {
+    errx(1, "%s holds -E edge maps, which cannot be replayed", path);
+  }
+  if ((hdr.channels != 1 && hdr.channels != 3) || hdr.width < 3 || hdr.height < 3 ||
+      hdr.stride < (uint64_t)hdr.width * hdr.channels ||
+      hdr.frameBytes < hdr.stride * hdr.height ||
+      hdr.dataOffset % CACHE_ALIGN || hdr.frameBytes % CACHE_ALIGN ||
+      hdr.frames == 0 ||
+      hdr.dataOffset + hdr.frames * hdr.frameBytes > (uint64_t)sb.st_size) {
+    errx(1, "%s: corrupt or truncated frame cache", path);
+  }
+
+  st->bytes = hdr.dataOffset + hdr.frames * hdr.frameBytes;
+  void *p = mmap(NULL, st->bytes, PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    err(1, "Cannot map %s", path);
+  }
+  close(fd);
+  madvise(p, st->bytes, MADV_SEQUENTIAL);
+  st->base = (uint8_t *)p;
+  st->next = 0;
+
+  frame_source_t *src = new frame_source_t;
+  src->name = "cache";
+  src->width = hdr.width;
+  src->height = hdr.height;
+  src->type = hdr.channels == 1 ? CV_8UC1 : CV_8UC3;
+  src->persistent = 1;
+  src->read = cacheRead;
+  src->close = cacheClose;
+  src->state = st;
+  return src;
+}
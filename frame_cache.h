@@ -0,0 +1,35 @@
+#ifndef FRAME_CACHE_H
+#define FRAME_CACHE_H
+
+#include <stdint.h>
+#include "frame_source.h"
+
+// Raw frame cache file: decoded frames written once, replayed by mmap.
+//
+//   [header, padded to CACHE_ALIGN][frame 0][frame 1]...
+//
+// Every frame starts on a CACHE_ALIGN boundary and every row on a cache
+// line, so replayed frames are as well aligned as frame_pool buffers.
+#define CACHE_MAGIC "SOBELRAW"
+#define CACHE_VERSION 1
+#define CACHE_ALIGN 4096
+
+struct cache_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t channels;     // 3 = BGR, 1 = gray, 0 = 1-bit edge map (-E; not replayable)
+  uint64_t stride;       // bytes per row
+  uint64_t frameBytes;   // bytes per frame, a multiple of CACHE_ALIGN
+  uint64_t frames;
+  uint64_t dataOffset;   // first frame, a multiple of CACHE_ALIGN
+};
+
+// Decodes up to opts.numFrames frames from the selected source into a
+// cache file at `path`, as gray if `gray` is set. Returns the frame count.
+int dumpFrames(const char *path, int gray);
+// Maps a cache file and serves its frames in place, without copying
+frame_source_t *openCacheSource(const char *path);
+
+#endif
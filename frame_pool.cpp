@@ -0,0 +1,105 @@
+#include "frame_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <err.h>
+#include <sys/mman.h>
+
+using namespace cv;
+
+#define CACHE_LINE 64
+#define HUGE_PAGE (2u << 20)
+
+static size_t roundUp(size_t v, size_t to)
+{
+  return (v + to - 1) / to * to;
+}
+
+/*******************************************
+ * Model: fpool_init
+ * Input: pool, buffer count, frame geometry, hugepage request
+ * Output: None directly. Fills in the pool
+ * Desc: All frame memory for a run is allocated here, up front. Rows are
+ *  padded to a cache line so row kernels never split a line between rows.
+ ********************************************/
+void fpool_init(frame_pool_t *fp, int count, int rows, int cols, int type, int hugepages)
+{
+  if (count < 1 || count > FRAME_POOL_MAX) {
+    errx(1, "fpool_init: invalid buffer count %d", count);
+  }
+  size_t elem = Mat(1, 1, type).elemSize();
+  size_t step = roundUp(cols * elem, CACHE_LINE);
+  size_t page = sysconf(_SC_PAGESIZE);
+
+  fp->count = count;
+  fp->hugepages = 0;
+  fp->bytes = roundUp(step * rows, page);
+  if (hugepages) {
+    // Probe once; without reserved huge pages every buffer falls back
+    size_t bytes = roundUp(step * rows, HUGE_PAGE);
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      munmap(p, bytes);
+      fp->bytes = bytes;
+      fp->hugepages = 1;
+    } else {
+      fprintf(stderr, "Huge pages unavailable, using normal pages for frame buffers\n");
+    }
+  }
+
+  for (int k = 0; k < count; k++) {
+    frame_buf_t *buf = &fp->bufs[k];
+    void *p = mmap(NULL, fp->bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE |
+                   (fp->hugepages ? MAP_HUGETLB : 0), -1, 0);
+    if (p == MAP_FAILED) {
+      err(1, "fpool_init: cannot map frame buffer");
+    }
+    buf->data = (uint8_t *)p;
+    buf->mat = Mat(rows, cols, type, buf->data, step);
+    buf->refs.store(0);
+    buf->pool = fp;
+    buf->index = k;
+  }
+  fp->free_mask.store(count == 64 ? ~0ull : (1ull << count) - 1);
+}
+
+frame_buf_t *fpool_get(frame_pool_t *fp)
+{
+  while (1) {
+    uint64_t mask = fp->free_mask.load(std::memory_order_acquire);
+    while (mask) {
+      int k = __builtin_ctzll(mask);
+      if (fp->free_mask.compare_exchange_weak(mask, mask & ~(1ull << k),
+                                              std::memory_order_acq_rel)) {
+        fp->bufs[k].refs.store(1, std::memory_order_relaxed);
+        return &fp->bufs[k];
+      }
+    }
+    // Every buffer is still held by a later stage
+    sched_yield();
+  }
+}
+
+void fbuf_ref(frame_buf_t *buf)
+{
+  buf->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void fbuf_unref(frame_buf_t *buf)
+{
+  if (buf->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    buf->pool->free_mask.fetch_or(1ull << buf->index, std::memory_order_release);
+  }
+}
+
+void fpool_destroy(frame_pool_t *fp)
+{
+  for (int k = 0; k < fp->count; k++) {
+    fp->bufs[k].mat.release();
+    munmap(fp->bufs[k].data, fp->bytes);
+  }
+  fp->count = 0;
+}
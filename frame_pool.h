@@ -0,0 +1,43 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "opencv2/imgproc/imgproc.hpp"
+
+// Buffers per pool; the free list is a single 64-bit mask
+#define FRAME_POOL_MAX 64
+
+struct frame_pool_t;
+
+// One preallocated frame. `mat` is a header over `data` built once at
+// startup, so handing it around never allocates. The buffer goes back to
+// its pool when the last reference is dropped.
+struct frame_buf_t {
+  cv::Mat mat;
+  uint8_t *data;
+  std::atomic<int> refs;
+  frame_pool_t *pool;
+  int index;
+};
+
+struct frame_pool_t {
+  frame_buf_t bufs[FRAME_POOL_MAX];
+  std::atomic<uint64_t> free_mask;
+  int count;
+  size_t bytes;      // mapping size of each buffer
+  int hugepages;     // buffers are MAP_HUGETLB mappings
+};
+
+// Allocates `count` rows x cols buffers of `type`. Every row starts on a
+// cache line and every buffer on a page (or a 2MB huge page if `hugepages`
+// is set and the kernel has some reserved; otherwise it falls back).
+void fpool_init(frame_pool_t *fp, int count, int rows, int cols, int type, int hugepages);
+// Takes a free buffer with one reference, waiting for one if all are in use
+frame_buf_t *fpool_get(frame_pool_t *fp);
+void fbuf_ref(frame_buf_t *buf);
+void fbuf_unref(frame_buf_t *buf);
+void fpool_destroy(frame_pool_t *fp);
+
+#endif
@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <limits.h>
+#include <err.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include "sobel_alg.h"
+#include "frame_sink.h"
+#include "frame_cache.h"
+#include "pc.h"
+#include "trace.h"
+#include "affinity.h"
+
+using namespace cv;
+
+// Rate stamped into video files; the loops have no fixed frame rate
+#define OUTPUT_FPS 30
+#define CACHE_LINE 64
+
+static uint64_t roundUp(uint64_t v, uint64_t to)
+{
+  return (v + to - 1) / to * to;
+}
+
+// Video file (-o <file>): whatever encoder OpenCV picks for MJPG. Edge
+// maps are unpacked here, on the output thread, since video is 8-bit.
+struct video_state {
+  VideoWriter *vw;
+  Mat unpacked;       // only with -E
+};
+
+static void videoWrite(frame_sink_t *sink, const Mat& frame)
+{
+  video_state *st = (video_state *)sink->state;
+  if (st->unpacked.data) {
+    edgeUnpack(frame, st->unpacked);
+    st->vw->write(st->unpacked);
+  } else {
+    st->vw->write(frame);
+  }
+}
+
+static void videoClose(frame_sink_t *sink)
+{
+  video_state *st = (video_state *)sink->state;
+  st->vw->release();
+  delete st->vw;
+  delete st;
+}
+
+static void openVideoSink(frame_sink_t *sink, const char *path, int rows, int cols, int packed)
+{
+  video_state *st = new video_state;
+  st->vw = new VideoWriter(path, CV_FOURCC('M', 'J', 'P', 'G'), OUTPUT_FPS,
+                           Size(cols, rows), false);
+  if (!st->vw->isOpened()) {
+    errx(1, "Cannot open video output %s", path);
+  }
+  if (packed) {
+    st->unpacked.create(rows, cols, CV_8UC1);
+  }
+  sink->name = "video";
+  sink->write = videoWrite;
+  sink->close = videoClose;
+  sink->state = st;
+}
+
+// Raw file (-o raw:<file>): a gray frame cache, so -r can replay it, or
+// with -E a cache of edge maps (channels 0) for other readers
+struct raw_state {
+  int fd;
+  const char *path;
+  cache_header hdr;
+  uint8_t *staging;   // one frame in the file's layout
+};
+
+static void rawWrite(frame_sink_t *sink, const Mat& frame)
+{
+  raw_state *st = (raw_state *)sink->state;
+  cache_header& hdr = st->hdr;
+  for (uint32_t i = 0; i < hdr.height; i++) {
+    memcpy(st->staging + i * hdr.stride, frame.ptr(i), frame.cols);
+  }
+  off_t off = hdr.dataOffset + hdr.frames * hdr.frameBytes;
+  if (pwrite(st->fd, st->staging, hdr.frameBytes, off) != (ssize_t)hdr.frameBytes) {
+    err(1, "Cannot write %s", st->path);
+  }
+  hdr.frames++;
+}
+
+// The header goes in last, as in dumpFrames
+static void rawClose(frame_sink_t *sink)
+{
+  raw_state *st = (raw_state *)sink->state;
+  if (pwrite(st->fd, &st->hdr, sizeof(st->hdr), 0) != (ssize_t)sizeof(st->hdr) ||
+      close(st->fd)) {
+    err(1, "Cannot write %s", st->path);
+  }
+  free(st->staging);
+  delete st;
+}
+
+static void openRawSink(frame_sink_t *sink, const char *path, int rows, int cols, int packed)
+{
+  raw_state *st = new raw_state;
+  cache_header& hdr = st->hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+  hdr.version = CACHE_VERSION;
+  hdr.width = cols;
+  hdr.height = rows;
+  hdr.channels = packed ? 0 : 1;
+  hdr.stride = roundUp(packed ? EDGE_BYTES(cols) : cols, CACHE_LINE);
+  hdr.frameBytes = roundUp(hdr.stride * rows, CACHE_ALIGN);
+  hdr.dataOffset = roundUp(sizeof(hdr), CACHE_ALIGN);
+  st->path = path;
+  st->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (st->fd < 0) {
+    err(1, "Cannot create %s", path);
+  }
+  if (posix_memalign((void **)&st->staging, CACHE_ALIGN, hdr.frameBytes)) {
+    errx(1, "openRawSink: out of memory");
+  }
+  memset(st->staging, 0, hdr.frameBytes);
+  sink->name = "raw";
+  sink->write = rawWrite;
+  sink->close = rawClose;
+  sink->state = st;
+}
+
+// Shared-memory ring (-o shm:<name>); see shm_header
+struct shm_state {
+  shm_header *hdr;
+  size_t bytes;
+  uint64_t next;
+};
+
+static void shmWrite(frame_sink_t *sink, const Mat& frame)
+{
+  shm_state *st = (shm_state *)sink->state;
+  shm_header *hdr = st->hdr;
+  int slot = st->next % SHM_SLOTS;
+  uint8_t *data = (uint8_t *)hdr + hdr->dataOffset + slot * hdr->slotBytes;
+
+  hdr->seq[slot].store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (uint32_t i = 0; i < hdr->height; i++) {
+    memcpy(data + i * hdr->stride, frame.ptr(i), frame.cols);
+  }
+  st->next++;
+  hdr->seq[slot].store(st->next, std::memory_order_release);
+  hdr->written.store(st->next, std::memory_order_release);
+}
+
+// The object stays in /dev/shm so readers can still take the last frames
+static void shmClose(frame_sink_t *sink)
+{
+  shm_state *st = (shm_state *)sink->state;
+  munmap(st->hdr, st->bytes);
+  delete st;
+}
+
+static void openShmSink(frame_sink_t *sink, const char *name, int rows, int cols, int packed)
+{
+  char path[NAME_MAX];
+  snprintf(path, sizeof(path), "/%s", name[0] == '/' ? name + 1 : name);
+  uint64_t stride = roundUp(packed ? EDGE_BYTES(cols) : cols, CACHE_LINE);
+  uint64_t slotBytes = roundUp(stride * rows, SHM_ALIGN);
+  uint64_t dataOffset = roundUp(sizeof(shm_header), SHM_ALIGN);
+  size_t bytes = dataOffset + SHM_SLOTS * slotBytes;
+
+  int fd = shm_open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    err(1, "Cannot create shared memory %s", path);
+  }
+  if (ftruncate(fd, bytes)) {
+    err(1, "Cannot size shared memory %s", path);
+  }
+  void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+  if (p == MAP_FAILED) {
+    err(1, "Cannot map shared memory %s", path);
+  }
+  close(fd);
+
+  // Geometry first, magic last: a reader that sees the magic sees the rest
+  shm_header *hdr = new (p) shm_header;
+  hdr->version = SHM_VERSION;
+  hdr->width = cols;
+  hdr->height = rows;
+  hdr->slots = SHM_SLOTS;
+  hdr->bits = packed ? 1 : 8;
+  hdr->stride = stride;
+  hdr->slotBytes = slotBytes;
+  hdr->dataOffset = dataOffset;
+  hdr->written.store(0);
+  for (int k = 0; k < SHM_SLOTS; k++) {
+    hdr->seq[k].store(0);
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(hdr->magic, SHM_MAGIC, sizeof(hdr->magic));
+
+  shm_state *st = new shm_state;
+  st->hdr = hdr;
+  st->bytes = bytes;
+  st->next = 0;
+  sink->name = "shm";
+  sink->write = shmWrite;
+  sink->close = shmClose;
+  sink->state = st;
+}
+
+static void futexWait(std::atomic<uint32_t> *addr, uint32_t val)
+{
+  syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futexWake(std::atomic<uint32_t> *addr)
+{
+  syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/*******************************************
+ * Model: outputMain
+ * Input: output_t* to drain
+ * Output: None
+ * Desc: The output thread. Writes queued frames to the sink in order and
+ *  sleeps on a futex while the queue is empty, so an idle sink costs no
+ *  CPU. A NULL entry ends the stream.
+ ********************************************/
+static void *outputMain(void *ptr)
+{
+  output_t *out = (output_t *)ptr;
+  frame_buf_t *buf;
+
+  TRACE_THREAD("output");
+  AFFINITY_THREAD(AFF_OUTPUT, 0);
+  while (1) {
+    uint32_t seen = out->pushed.load(std::memory_order_seq_cst);
+    if (!out->ring.pop(buf)) {
+      TRACE_BEGIN("idle");
+      out->sleeping.store(1, std::memory_order_seq_cst);
+      if (out->pushed.load(std::memory_order_seq_cst) == seen) {
+        futexWait(&out->pushed, seen);
+      }
+      out->sleeping.store(0, std::memory_order_relaxed);
+      TRACE_END("idle");
+      continue;
+    }
+    if (buf == NULL) {
+      break;
+    }
+    TRACE_BEGIN("write");
+    uint64_t t0 = pc_now_ns();
+    out->sink->write(out->sink, buf->mat);
+    out->write_ns += pc_now_ns() - t0;
+    out->written++;
+    TRACE_END("write");
+    fbuf_unref(buf);
+  }
+  return NULL;
+}
+
+static void wakeOutput(output_t *out)
+{
+  out->pushed.fetch_add(1, std::memory_order_seq_cst);
+  if (out->sleeping.load(std::memory_order_seq_cst)) {
+    futexWake(&out->pushed);
+  }
+}
+
+/*******************************************
+ * Model: openOutput
+ * Input: frame geometry
+ * Output: running output, or NULL if -o was not given
+ * Desc: -o <file> writes a video, raw:<file> a gray frame cache and
+ *  shm:<name> a shared-memory ring. With -E the queue carries packed
+ *  edge maps, an eighth of the bytes. One buffer more than the queue holds
+ *  covers the frame being written, so taking a buffer never waits once
+ *  the queue has room.
+ ********************************************/
+output_t *openOutput(int rows, int cols)
+{
+  if (opts.outputSpec == NULL) {
+    return NULL;
+  }
+  // The ring is cache-line aligned, which plain new does not honour
+  void *mem;
+  if (posix_memalign(&mem, 64, sizeof(output_t))) {
+    errx(1, "openOutput: out of memory");
+  }
+  output_t *out = new (mem) output_t;
+  out->sink = new frame_sink_t;
+  int packed = opts.edgeThreshold != 0;
+  if (strncmp(opts.outputSpec, "shm:", 4) == 0) {
+    openShmSink(out->sink, opts.outputSpec + 4, rows, cols, packed);
+  } else if (strncmp(opts.outputSpec, "raw:", 4) == 0) {
+    openRawSink(out->sink, opts.outputSpec + 4, rows, cols, packed);
+  } else {
+    openVideoSink(out->sink, opts.outputSpec, rows, cols, packed);
+  }
+  out->policy = opts.outputPolicy;
+  fpool_init(&out->pool, OUTPUT_QUEUE + 1, rows, packed ? EDGE_BYTES(cols) : cols, CV_8UC1, opts.hugepages);
+  out->pushed.store(0);
+  out->sleeping.store(0);
+  out->queued = out->dropped = out->stall_ns = 0;
+  out->written = out->write_ns = 0;
+  int ret = pthread_create(&out->thread, NULL, outputMain, out);
+  if (ret) {
+    errx(1, "Thread creation failed: %d", ret);
+  }
+  return out;
+}
+
+int output_push(output_t *out, const Mat& frame)
+{
+  if (out->ring.full()) {
+    if (out->policy == OUTPUT_DROP) {
+      out->dropped++;
+      return 0;
+    }
+    TRACE_BEGIN("wait output");
+    uint64_t t0 = pc_now_ns();
+    while (out->ring.full()) {
+      sched_yield();
+    }
+    out->stall_ns += pc_now_ns() - t0;
+    TRACE_END("wait output");
+  }
+  frame_buf_t *buf = fpool_get(&out->pool);
+  frame.copyTo(buf->mat);
+  out->ring.push(buf);
+  out->queued++;
+  wakeOutput(out);
+  return 1;
+}
+
+void closeOutput(output_t *out, std::ostream& csv)
+{
+  out->ring.pushWait(NULL);
+  wakeOutput(out);
+  pthread_join(out->thread, NULL);
+  out->sink->close(out->sink);
+
+  csv << "Output, " << out->sink->name << " " << opts.outputSpec
+      << (out->policy == OUTPUT_DROP ? " (drop when behind)" : " (block when behind)") << std::endl;
+  csv << "Output frames written, " << out->written << std::endl;
+  csv << "Output frames dropped, " << out->dropped << std::endl;
+  csv << "Output stall (ms), " << out->stall_ns/1e6 << std::endl;
+  csv << "Output write time per frame (ms), " << (out->written ? out->write_ns/1e6/out->written : 0) << std::endl;
+
+  delete out->sink;
+  fpool_destroy(&out->pool);
+  out->~output_t();
+  free(out);
+}
@@ -0,0 +1,84 @@
+#ifndef FRAME_SINK_H
+#define FRAME_SINK_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <ostream>
+#include "opencv2/imgproc/imgproc.hpp"
+#include "frame_pool.h"
+#include "spsc.h"
+
+// Where Sobel output goes besides the window. Like frame_source_t, each
+// sink is a small table of functions plus its own state. Sinks are only
+// ever called from the output thread, so a slow disk or encoder never
+// holds up compute.
+struct frame_sink_t {
+  const char *name;
+  // Writes one gray frame
+  void (*write)(frame_sink_t *sink, const cv::Mat& frame);
+  void (*close)(frame_sink_t *sink);
+  void *state;
+};
+
+// Shared-memory ring (-o shm:<name>), created as /dev/shm/<name>:
+//
+//   [shm_header, padded to SHM_ALIGN][slot 0][slot 1]...[slot SHM_SLOTS-1]
+//
+// Frame n goes to slot n % SHM_SLOTS. The writer never waits for readers:
+// it zeroes seq[slot], writes the frame, sets seq[slot] to n+1 and then
+// `written` to n+1. A reader takes n = written-1, checks seq[slot] == n+1,
+// uses the frame in place, and checks seq[slot] again afterwards; if it
+// changed, the frame was overwritten while being read.
+#define SHM_MAGIC "SOBELSHM"
+#define SHM_VERSION 2
+#define SHM_SLOTS 4
+#define SHM_ALIGN 4096
+
+struct shm_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t slots;
+  uint32_t bits;         // per pixel: 8 = gray, 1 = edge map (-E, LSB first)
+  uint64_t stride;       // bytes per row
+  uint64_t slotBytes;    // bytes per slot, a multiple of SHM_ALIGN
+  uint64_t dataOffset;   // slot 0, a multiple of SHM_ALIGN
+  std::atomic<uint64_t> written;
+  std::atomic<uint64_t> seq[SHM_SLOTS];
+};
+
+// What the compute side does when the output thread is behind
+enum { OUTPUT_BLOCK, OUTPUT_DROP };
+
+// Frames queued for the output thread. Power of two (spsc_ring).
+#define OUTPUT_QUEUE 8
+
+struct output_t {
+  frame_sink_t *sink;
+  pthread_t thread;
+  int policy;
+  // Queued frames are copies, so the loops may reuse their buffers at once
+  frame_pool_t pool;
+  spsc_ring<frame_buf_t *, OUTPUT_QUEUE> ring;
+  // Futex word the output thread sleeps on while the ring is empty
+  std::atomic<uint32_t> pushed __attribute__((aligned(64)));
+  std::atomic<int> sleeping;
+  // Compute side only
+  uint64_t queued, dropped, stall_ns;
+  // Output thread only
+  uint64_t written, write_ns;
+};
+
+// Opens the -o sink for rows x cols gray frames, or with -E for their
+// packed edge maps, and starts its thread; NULL without -o
+output_t *openOutput(int rows, int cols);
+// Queues a copy of `frame`. Under OUTPUT_DROP a full queue drops the frame
+// (returns 0); under OUTPUT_BLOCK it waits for room.
+int output_push(output_t *out, const cv::Mat& frame);
+// Writes out what is queued, stops the thread, closes the sink and
+// appends the output lines to the perf CSV
+void closeOutput(output_t *out, std::ostream& csv);
+
+#endif
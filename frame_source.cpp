@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+#include <vector>
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include "sobel_alg.h"
+#include "frame_source.h"
+#include "frame_cache.h"
+
+using namespace cv;
+using namespace std;
+
+// Distinct frames generated for -g; the source cycles through them
+#define SYNTH_FRAMES 16
+
+/*******************************************
+ * Capture source: file or webcam through OpenCV. The first frame is
+ * decoded on open so the geometry is known before any buffers are sized.
+ ********************************************/
+struct capture_state {
+  CvCapture *cap;
+  IplImage *pending;
+};
+
+static int captureRead(frame_source_t *src, Mat& frame)
+{
+  capture_state *st = (capture_state *)src->state;
+  IplImage *img = st->pending ? st->pending : cvQueryFrame(st->cap);
+  st->pending = NULL;
+  if (img == NULL) {
+    return 0;
+  }
+  frame = img;
+  return 1;
+}
+
+static void captureClose(frame_source_t *src)
+{
+  capture_state *st = (capture_state *)src->state;
+  cvReleaseCapture(&st->cap);
+  delete st;
+}
+
+// Opens `path`, or camera number `camera` when path is NULL (-1: any)
+static frame_source_t *openCapture(const char *path, int camera)
+{
+  capture_state *st = new capture_state;
+  if (path == NULL) {
+    st->cap = cvCreateCameraCapture(camera);
+  } else {
+    st->cap = cvCreateFileCapture(path);
+  }
+  if (st->cap == NULL) {
+    errx(1, "Cannot open video source %s", path ? path : "webcam");
+  }
+  cvSetCaptureProperty(st->cap, CV_CAP_PROP_FRAME_WIDTH, CAPTURE_WIDTH);
+  cvSetCaptureProperty(st->cap, CV_CAP_PROP_FRAME_HEIGHT, CAPTURE_HEIGHT);
+  st->pending = cvQueryFrame(st->cap);
+  if (st->pending == NULL) {
+    errx(1, "No frames could be read from the video source");
+  }
+
+  frame_source_t *src = new frame_source_t;
+  src->name = path ? "file" : "webcam";
+  src->width = st->pending->width;
+  src->height = st->pending->height;
+  src->type = CV_8UC3;
+  src->persistent = 0;
+  src->read = captureRead;
+  src->close = captureClose;
+  src->state = st;
+  return src;
+}
+
+// Live file or webcam input: the Y plane alone with -y, else BGR through
+// OpenCV, split across -d decoder threads when the input is a file whose
+// frame count is known
+static frame_source_t *openDecoder()
+{
+  if (opts.yuvFormat) {
+    return openYuvSource();
+  }
+  if (opts.decoders > 1 && !opts.webcam) {
+    frame_source_t *src = openSegmentedSource(opts.videoFile, opts.decoders);
+    if (src) {
+      return src;
+    }
+    fprintf(stderr, "Frame count of %s unknown, decoding on one thread\n", opts.videoFile);
+  }
+  return openCapture(opts.webcam ? NULL : opts.videoFile, -1);
+}
+
+/*******************************************
+ * Memory source: a fixed set of decoded frames replayed in a loop, so the
+ * processing loop pays nothing for decode. Used for -p and -g.
+ ********************************************/
+struct memory_state {
+  vector<Mat> frames;
+  unsigned next;
+};
+
+static int memoryRead(frame_source_t *src, Mat& frame)
+{
+  memory_state *st = (memory_state *)src->state;
+  frame = st->frames[st->next];
+  st->next = (st->next + 1) % st->frames.size();
+  return 1;
+}
+
+static void memoryClose(frame_source_t *src)
+{
+  delete (memory_state *)src->state;
+}
+
+static frame_source_t *newMemorySource(const char *name, memory_state *st)
+{
+  frame_source_t *src = new frame_source_t;
+  src->name = name;
+  src->width = st->frames[0].cols;
+  src->height = st->frames[0].rows;
+  src->type = st->frames[0].type();
+  src->persistent = 1;
+  src->read = memoryRead;
+  src->close = memoryClose;
+  src->state = st;
+  st->next = 0;
+  return src;
+}
+
+// Pre-decodes up to opts.preload frames of the capture into memory
+static frame_source_t *openPreloaded()
+{
+  frame_source_t *cap = openDecoder();
+  memory_state *st = new memory_state;
+  Mat frame;
+
+  while ((int)st->frames.size() < opts.preload && cap->read(cap, frame)) {
+    st->frames.push_back(frame.clone());
+  }
+  closeFrameSource(cap);
+  return newMemorySource("memory", st);
+}
+
+// Deterministic test frames: smooth gradients with sharp-edged boxes that
+// move from frame to frame, plus a band of noise, so both the flat and the
+// saturating paths of the Sobel kernel get exercised.
+static frame_source_t *openSynthetic()
+{
+  memory_state *st = new memory_state;
+  int w = opts.synthWidth, h = opts.synthHeight;
+  uint32_t seed = 12345;
+
+  for (int k = 0; k < SYNTH_FRAMES; k++) {
+    Mat frame(h, w, CV_8UC3);
+    for (int i = 0; i < h; i++) {
+      uint8_t *p = frame.ptr(i);
+      for (int j = 0; j < w; j++) {
+        int box = ((i + 8*k) / 64 + (j + 16*k) / 64) & 1;
+        seed = seed * 1103515245u + 12345u;
+        p[3*j] = (uint8_t)(j + 4*k);
+        p[3*j+1] = box ? 220 : (uint8_t)(i + k);
+        p[3*j+2] = (i % 128) < 16 ? (uint8_t)(seed >> 24) : (uint8_t)((i + j) >> 2);
+      }
+    }
+    st->frames.push_back(frame);
+  }
+  return newMemorySource("synthetic", st);
+}
+
+/*******************************************
+ * Model: openFrameSource
+ * Input: None (uses opts)
+ * Output: the frame source selected on the command line
+ * Desc: -r replays a raw frame cache, -g gives synthetic frames, -p
+ *  pre-decodes the file/webcam into memory, otherwise frames are decoded
+ *  live.
+ ********************************************/
+frame_source_t *openFrameSource()
+{
+  if (opts.replayFile) {
+    return openCacheSource(opts.replayFile);
+  }
+  if (opts.synthWidth > 0) {
+    return openSynthetic();
+  }
+  if (opts.preload > 0) {
+    return openPreloaded();
+  }
+  return openDecoder();
+}
+
+frame_source_t *openStreamSource(const struct stream_spec *spec)
+{
+  return openCapture(spec->videoFile, spec->camera);
+}
+
+void closeFrameSource(frame_source_t *src)
+{
+  src->close(src);
+  delete src;
+}
@@ -0,0 +1,43 @@
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+struct stream_spec;
+
+// Where frames come from. Like the kernel table, each source is a small
+// table of functions plus its own state; the processing loops only call
+// through it.
+struct frame_source_t {
+  const char *name;
+  // Geometry of the frames, known as soon as the source is open
+  int width;
+  int height;
+  // CV_8UC3 (BGR) or CV_8UC1 (already gray; the grayscale pass is skipped)
+  int type;
+  // Frames stay valid until the source is closed, not just until the next
+  // read, so stages may hold on to them without copying
+  int persistent;
+  // Points `frame` at the next frame; returns 0 at end of stream. The
+  // frame stays valid until the next read.
+  int (*read)(frame_source_t *src, cv::Mat& frame);
+  void (*close)(frame_source_t *src);
+  void *state;
+};
+
+// Opens the source selected on the command line: a file or webcam capture,
+// optionally pre-decoded into memory (-p), synthetic frames (-g) or a raw
+// frame cache (-r).
+frame_source_t *openFrameSource();
+// One of several -f/-w inputs of multi-stream mode, captured live
+frame_source_t *openStreamSource(const struct stream_spec *spec);
+void closeFrameSource(frame_source_t *src);
+// Decodes a file on `ndecoders` threads, each with its own capture, and
+// yields its frames in order. NULL if the file's frame count is unknown.
+frame_source_t *openSegmentedSource(const char *path, int ndecoders);
+// Y plane only, as CV_8UC1, from the V4L2 device (-w) or a raw YUV file
+// (-f) in the -y format: yuyv, nv12 or i420
+frame_source_t *openYuvSource();
+int yuvFormatValid(const char *name);
+
+#endif
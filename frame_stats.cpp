@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <string>
+#include <fstream>
+
+#include "frame_stats.h"
+#include "sobel_kernels.h"
+
+using namespace std;
+
+// Frames kept for the per-frame report; later ones only reach the totals
+#define STATS_REPORT_FRAMES (1 << 20)
+
+__thread frame_stats *statsSink;
+
+int stats_init(frame_stats *st, int rows, int cols, int tileW, int tileH,
+               int threshold, int maxFrames)
+{
+  if (tileW < 1 || tileH < 1) {
+    return -1;
+  }
+  if (tileW > cols) {
+    tileW = cols;
+  }
+  if (tileH > rows) {
+    tileH = rows;
+  }
+  st->rows = rows;
+  st->cols = cols;
+  st->tileW = tileW;
+  st->tileH = tileH;
+  st->tilesX = (cols + tileW - 1) / tileW;
+  st->tilesY = (rows + tileH - 1) / tileH;
+  st->threshold = threshold;
+  if (st->tilesX > STATS_MAX_TILES_X || (uint64_t)tileW * tileH * 255 > UINT32_MAX) {
+    return -1;
+  }
+  st->tileSums = new std::atomic<uint32_t>[st->tilesX * st->tilesY];
+  st->frames = 0;
+  st->maxFrames = maxFrames < STATS_REPORT_FRAMES ? maxFrames : STATS_REPORT_FRAMES;
+  size_t n = st->maxFrames > 0 ? st->maxFrames : 1;
+  st->frameEnergy = (uint64_t *)calloc(n, sizeof(uint64_t));
+  st->frameDensity = (float *)calloc(n, sizeof(float));
+  st->frameP50 = (uint8_t *)calloc(n, 1);
+  st->frameP99 = (uint8_t *)calloc(n, 1);
+  st->frameHotTile = (int *)calloc(n, sizeof(int));
+  st->frameHotSum = (uint32_t *)calloc(n, sizeof(uint32_t));
+  if (!st->frameEnergy || !st->frameDensity || !st->frameP50 || !st->frameP99 ||
+      !st->frameHotTile || !st->frameHotSum) {
+    errx(1, "stats_init: out of memory");
+  }
+  memset(st->totalHist, 0, sizeof(st->totalHist));
+  st->totalEnergy = 0;
+  return 0;
+}
+
+void stats_begin(frame_stats *st)
+{
+  for (int b = 0; b < STATS_BINS; b++) {
+    st->hist[b].store(0, std::memory_order_relaxed);
+  }
+  st->energy.store(0, std::memory_order_relaxed);
+  for (int k = 0; k < st->tilesX * st->tilesY; k++) {
+    st->tileSums[k].store(0, std::memory_order_relaxed);
+  }
+  statsSink = st;
+}
+
+// Smallest magnitude with at least `fraction` of the pixels at or below it
+static int percentile(const uint32_t *hist, uint64_t pixels, double fraction)
+{
+  uint64_t want = (uint64_t)(pixels * fraction), seen = 0;
+  for (int b = 0; b < STATS_BINS; b++) {
+    seen += hist[b];
+    if (seen > want) {
+      return b;
+    }
+  }
+  return STATS_BINS - 1;
+}
+
+/*******************************************
+ * Model: stats_end
+ * Input: stats of the frame just filtered
+ * Output: fraction of the frame's pixels at or above the threshold
+ * Desc: Called after the frame's last band has finished (pool_run has
+ *  returned), so the band totals are all in. Reads the histogram and the
+ *  tile grid once, which is 256 plus tilesX * tilesY words, not a pass
+ *  over the frame.
+ ********************************************/
+double stats_end(frame_stats *st)
+{
+  uint32_t hist[STATS_BINS];
+  uint64_t pixels = (uint64_t)st->rows * st->cols, over = 0;
+
+  statsSink = NULL;
+  for (int b = 0; b < STATS_BINS; b++) {
+    hist[b] = st->hist[b].load(std::memory_order_relaxed);
+    st->totalHist[b] += hist[b];
+    if (b >= st->threshold) {
+      over += hist[b];
+    }
+  }
+  uint64_t energy = st->energy.load(std::memory_order_relaxed);
+  st->totalEnergy += energy;
+  double density = (double)over / pixels;
+
+  int n = st->frames++;
+  if (n < st->maxFrames) {
+    int hot = 0;
+    uint32_t hotSum = 0;
+    for (int k = 0; k < st->tilesX * st->tilesY; k++) {
+      uint32_t s = st->tileSums[k].load(std::memory_order_relaxed);
+      if (s > hotSum) {
+        hot = k;
+        hotSum = s;
+      }
+    }
+    st->frameEnergy[n] = energy;
+    st->frameDensity[n] = density;
+    st->frameP50[n] = percentile(hist, pixels, 0.50);
+    st->frameP99[n] = percentile(hist, pixels, 0.99);
+    st->frameHotTile[n] = hot;
+    st->frameHotSum[n] = hotSum;
+  }
+  return density;
+}
+
+void stats_report(const frame_stats *st, const char *prefix)
+{
+  ofstream csv((string(prefix) + "_stats.csv").c_str(), ios::out);
+  double pixels = (double)st->rows * st->cols;
+
+  csv << "frame,energy,mean_magnitude,edge_density,p50,p99,hot_tile_x,hot_tile_y,hot_tile_mean" << endl;
+  for (int n = 0; n < st->frames && n < st->maxFrames; n++) {
+    int tx = st->frameHotTile[n] % st->tilesX, ty = st->frameHotTile[n] / st->tilesX;
+    int w = st->cols - tx * st->tileW < st->tileW ? st->cols - tx * st->tileW : st->tileW;
+    int h = st->rows - ty * st->tileH < st->tileH ? st->rows - ty * st->tileH : st->tileH;
+    csv << n << "," << st->frameEnergy[n] << "," << st->frameEnergy[n] / pixels << ","
+        << st->frameDensity[n] << "," << (int)st->frameP50[n] << "," << (int)st->frameP99[n] << ","
+        << tx << "," << ty << "," << (double)st->frameHotSum[n] / ((double)w * h) << endl;
+  }
+
+  ofstream hcsv((string(prefix) + "_histogram.csv").c_str(), ios::out);
+  hcsv << "magnitude,pixels" << endl;
+  for (int b = 0; b < STATS_BINS; b++) {
+    hcsv << b << "," << st->totalHist[b] << endl;
+  }
+}
+
+void stats_destroy(frame_stats *st)
+{
+  delete[] st->tileSums;
+  free(st->frameEnergy);
+  free(st->frameDensity);
+  free(st->frameP50);
+  free(st->frameP99);
+  free(st->frameHotTile);
+  free(st->frameHotSum);
+}
+
+void stats_band_begin(stats_band *b, frame_stats *st)
+{
+  b->st = st;
+  b->ty = -1;
+  b->energy = 0;
+  memset(b->hist, 0, sizeof(b->hist));
+}
+
+// Adds the band's sums for its current tile row into the frame's grid
+static void flushTiles(stats_band *b)
+{
+  frame_stats *st = b->st;
+  if (b->ty < 0) {
+    return;
+  }
+  std::atomic<uint32_t> *sums = st->tileSums + b->ty * st->tilesX;
+  for (int tx = 0; tx < st->tilesX; tx++) {
+    if (b->tiles[tx]) {
+      sums[tx].fetch_add(b->tiles[tx], std::memory_order_relaxed);
+      b->energy += b->tiles[tx];
+    }
+  }
+}
+
+/*******************************************
+ * Model: stats_band_row
+ * Input: band totals, magnitude row `row` of the frame
+ * Output: None directly. Adds the row to the band's totals
+ * Desc: Called by the band kernels on each output row right after they
+ *  write it. The tile sums are the backend's sumRow (psadbw against zero
+ *  on x86) over each tile's span of the row; the energy is their total.
+ *  The histogram has no vector form, so it is a scalar scatter over
+ *  8-byte loads into four copies of the bins, which keeps runs of equal
+ *  magnitudes (flat regions are all 0) from stalling on the same counter.
+ ********************************************/
+void stats_band_row(stats_band *b, const uint8_t *mag, int row)
+{
+  frame_stats *st = b->st;
+  int cols = st->cols;
+  int ty = row / st->tileH;
+
+  if (ty != b->ty) {
+    flushTiles(b);
+    b->ty = ty;
+    memset(b->tiles, 0, st->tilesX * sizeof(uint32_t));
+  }
+  for (int tx = 0, x = 0; tx < st->tilesX; tx++, x += st->tileW) {
+    b->tiles[tx] += kernels->sumRow(mag + x, cols - x < st->tileW ? cols - x : st->tileW);
+  }
+
+  uint32_t (*hist)[STATS_BINS] = b->hist;
+  int j = 0;
+  for (; j + 8 <= cols; j += 8) {
+    uint64_t v;
+    memcpy(&v, mag + j, 8);
+    hist[0][v & 0xff]++;
+    hist[1][v >> 8 & 0xff]++;
+    hist[2][v >> 16 & 0xff]++;
+    hist[3][v >> 24 & 0xff]++;
+    hist[0][v >> 32 & 0xff]++;
+    hist[1][v >> 40 & 0xff]++;
+    hist[2][v >> 48 & 0xff]++;
+    hist[3][v >> 56]++;
+  }
+  for (; j < cols; j++) {
+    hist[j & 3][mag[j]]++;
+  }
+}
+
+/*******************************************
+ * Model: stats_band_end
+ * Input: band totals
+ * Output: None directly. Adds them to the frame's stats
+ * Desc: The only writes to shared state: one relaxed fetch_add per
+ *  non-empty bin and tile and one for the energy. Bands that share a
+ *  tile row both add into it. No ordering is needed beyond the pool's
+ *  join, which stats_end runs after.
+ ********************************************/
+void stats_band_end(stats_band *b)
+{
+  frame_stats *st = b->st;
+  flushTiles(b);
+  for (int k = 0; k < STATS_BINS; k++) {
+    uint32_t n = b->hist[0][k] + b->hist[1][k] + b->hist[2][k] + b->hist[3][k];
+    if (n) {
+      st->hist[k].fetch_add(n, std::memory_order_relaxed);
+    }
+  }
+  st->energy.fetch_add(b->energy, std::memory_order_relaxed);
+}
@@ -0,0 +1,72 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <stdint.h>
+#include <atomic>
+
+// Per-frame reductions of the Sobel magnitudes (-X): a 256-bin histogram,
+// the total edge energy (sum of magnitudes) and the sum of every tile of
+// a tileW x tileH grid. The band kernels produce them as each output row
+// is written, while the row is still in L1, so they cost no pass over the
+// frame. Each band keeps private totals and adds them into the frame's
+// atomics once at its end, so bands on different threads never lock or
+// share a cache line more than once per band.
+#define STATS_BINS 256
+// Tile columns a band can hold partial sums for
+#define STATS_MAX_TILES_X 512
+// Edge density threshold when neither -X nor -E gives one
+#define STATS_THRESHOLD 64
+
+struct frame_stats {
+  int rows, cols;
+  int tileW, tileH, tilesX, tilesY;
+  int threshold;                  // edge density counts magnitudes >= this
+
+  // The frame being filtered, written by the bands
+  std::atomic<uint32_t> hist[STATS_BINS];
+  std::atomic<uint64_t> energy;
+  std::atomic<uint32_t> *tileSums;  // tilesX * tilesY, row-major
+
+  // Closed frames, for the report
+  int frames, maxFrames;
+  uint64_t totalHist[STATS_BINS];
+  uint64_t totalEnergy;
+  uint64_t *frameEnergy;
+  float *frameDensity;            // fraction of pixels >= threshold
+  uint8_t *frameP50, *frameP99;   // magnitude percentiles
+  int *frameHotTile;              // tile with the largest sum
+  uint32_t *frameHotSum;
+};
+
+// A band's private totals, on its stack
+struct stats_band {
+  frame_stats *st;
+  int ty;                              // tile row being summed, -1 if none
+  uint64_t energy;
+  uint32_t hist[4][STATS_BINS];        // four copies, see stats_band_row
+  uint32_t tiles[STATS_MAX_TILES_X];   // current tile row
+};
+
+// -1 if the grid has more than STATS_MAX_TILES_X columns or a tile
+// could sum past 32 bits. Keeps a report line for up to maxFrames frames.
+int stats_init(frame_stats *st, int rows, int cols, int tileW, int tileH,
+               int threshold, int maxFrames);
+// Clears the frame's totals and has the calling thread's next
+// sobelCalc/sobelFused/sobelEdge, or their MT versions, fill them
+void stats_begin(frame_stats *st);
+// Stops collecting and records the frame; returns its edge density
+double stats_end(frame_stats *st);
+// Writes <prefix>_stats.csv, one line per frame, and
+// <prefix>_histogram.csv, the histogram of all frames
+void stats_report(const frame_stats *st, const char *prefix);
+void stats_destroy(frame_stats *st);
+
+// Stats the calling thread's kernels fill; NULL when not collecting
+extern __thread frame_stats *statsSink;
+
+// Used by the band kernels
+void stats_band_begin(stats_band *b, frame_stats *st);
+void stats_band_row(stats_band *b, const uint8_t *mag, int row);
+void stats_band_end(stats_band *b);
+
+#endif
@@ -0,0 +1,112 @@
+#include "histogram.h"
+#include <string.h>
+#include <string>
+#include <fstream>
+
+using namespace std;
+
+#define SUB (1u << HIST_SUB_BITS)
+
+static int bucketOf(uint64_t v)
+{
+  if (v < SUB) {
+    return (int)v;
+  }
+  int e = 63 - __builtin_clzll(v);
+  return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+         (int)((v >> (e - HIST_SUB_BITS)) & (SUB - 1));
+}
+
+// Largest value that lands in bucket b
+static uint64_t bucketTop(int b)
+{
+  if (b < (int)SUB) {
+    return b;
+  }
+  int shift = (b >> HIST_SUB_BITS) - 1;
+  uint64_t low = (uint64_t)(SUB + (b & (SUB - 1))) << shift;
+  return low + ((1ull << shift) - 1);
+}
+
+void hist_init(hist_t *h, const char *name)
+{
+  memset(h, 0, sizeof(*h));
+  h->name = name;
+  h->min = UINT64_MAX;
+}
+
+void hist_add(hist_t *h, uint64_t v)
+{
+  h->buckets[bucketOf(v)]++;
+  h->count++;
+  h->sum += v;
+  h->min = v < h->min ? v : h->min;
+  h->max = v > h->max ? v : h->max;
+}
+
+uint64_t hist_percentile(const hist_t *h, double pct)
+{
+  if (h->count == 0) {
+    return 0;
+  }
+  // Rank of the sample we want, 1-based, rounded up
+  uint64_t rank = (uint64_t)(pct / 100.0 * h->count);
+  if ((double)rank < pct / 100.0 * h->count || rank == 0) {
+    rank++;
+  }
+  uint64_t seen = 0;
+  for (int b = 0; b < HIST_BUCKETS; b++) {
+    seen += h->buckets[b];
+    if (seen >= rank) {
+      uint64_t top = bucketTop(b);
+      return top < h->max ? top : h->max;
+    }
+  }
+  return h->max;
+}
+
+static const struct {
+  const char *name;
+  double pct;
+} percentiles[] = {
+  { "p50", 50 }, { "p90", 90 }, { "p99", 99 }, { "p999", 99.9 },
+};
+#define NUM_PCT (int)(sizeof(percentiles) / sizeof(percentiles[0]))
+
+/*******************************************
+ * Model: hist_report
+ * Input: file prefix, histograms
+ * Output: None directly. Writes the CSV and JSON files
+ * Desc: Same numbers in both files: count, mean, min, p50/p90/p99/p99.9
+ *  and max per stage, as integer nanoseconds.
+ ********************************************/
+void hist_report(const char *prefix, const hist_t *hists, int n)
+{
+  ofstream csv((string(prefix) + "_latency.csv").c_str(), ios::out);
+  ofstream json((string(prefix) + "_latency.json").c_str(), ios::out);
+
+  csv << "stage,count,mean_ns,min_ns";
+  for (int p = 0; p < NUM_PCT; p++) {
+    csv << "," << percentiles[p].name << "_ns";
+  }
+  csv << ",max_ns" << endl;
+
+  json << "{\"unit\": \"ns\", \"stages\": [";
+  for (int k = 0; k < n; k++) {
+    const hist_t *h = &hists[k];
+    uint64_t mean = h->count ? h->sum / h->count : 0;
+    uint64_t min = h->count ? h->min : 0;
+
+    csv << h->name << "," << h->count << "," << mean << "," << min;
+    json << (k ? ",\n  " : "\n  ") << "{\"stage\": \"" << h->name << "\", \"count\": "
+         << h->count << ", \"mean\": " << mean << ", \"min\": " << min;
+    for (int p = 0; p < NUM_PCT; p++) {
+      uint64_t v = hist_percentile(h, percentiles[p].pct);
+      csv << "," << v;
+      json << ", \"" << percentiles[p].name << "\": " << v;
+    }
+    csv << "," << h->max << endl;
+    json << ", \"max\": " << h->max << "}";
+  }
+  json << "\n]}" << endl;
+}
@@ -0,0 +1,31 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+// Log-linear buckets: values below 2^HIST_SUB_BITS get one bucket each,
+// and every power of two above that is split into 2^HIST_SUB_BITS equal
+// buckets, so any recorded value is off by at most 1/32 (~3%). The full
+// uint64_t range fits in HIST_BUCKETS counters with no allocation.
+#define HIST_SUB_BITS 5
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+struct hist_t {
+  const char *name;
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[HIST_BUCKETS];
+};
+
+void hist_init(hist_t *h, const char *name);
+void hist_add(hist_t *h, uint64_t v);
+// Smallest value v such that at least pct% of samples are <= v, reported
+// as the top of v's bucket and capped at max
+uint64_t hist_percentile(const hist_t *h, double pct);
+// Writes <prefix>_latency.csv and <prefix>_latency.json, one row/object
+// per histogram, all values in nanoseconds
+void hist_report(const char *prefix, const hist_t *hists, int n);
+
+#endif
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <string>
+#include <fstream>
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "incremental.h"
+#include "sobel_alg.h"
+#include "sobel_kernels.h"
+
+using namespace cv;
+using namespace std;
+
+// Frames kept for the per-frame report; later ones only reach the totals
+#define INCR_REPORT_FRAMES (1 << 20)
+
+void incr_init(incr_t *inc, int rows, int cols, int threshold, int maxFrames)
+{
+  inc->rows = rows;
+  inc->cols = cols;
+  inc->tilesX = (cols + INCR_TILE_W - 1) / INCR_TILE_W;
+  inc->tilesY = (rows + INCR_TILE_H - 1) / INCR_TILE_H;
+  inc->threshold = threshold;
+  inc->primed = 0;
+  fpool_init(&inc->refPool, 1, rows, cols, CV_8UC1, opts.hugepages);
+  inc->ref = fpool_get(&inc->refPool);
+  inc->changed = (uint8_t *)calloc(inc->tilesX * inc->tilesY, 1);
+  inc->skipped = (int *)calloc(inc->tilesY, sizeof(int));
+  inc->frames = 0;
+  inc->maxFrames = maxFrames < INCR_REPORT_FRAMES ? maxFrames : INCR_REPORT_FRAMES;
+  inc->frameSkipped = (int *)calloc(inc->maxFrames, sizeof(int));
+  if (!inc->changed || !inc->skipped || !inc->frameSkipped) {
+    errx(1, "incr_init: out of memory");
+  }
+  inc->tilesTotal = 0;
+  inc->skippedTotal = 0;
+}
+
+static inline int isChanged(const incr_t *inc, int tx, int ty)
+{
+  if (tx < 0 || tx >= inc->tilesX || ty < 0 || ty >= inc->tilesY) {
+    return 0;
+  }
+  return inc->changed[ty * inc->tilesX + tx];
+}
+
+/*******************************************
+ * Model: incr_diff_rows
+ * Input: incremental state, gray frame, tile rows [ty0, ty1)
+ * Output: None directly. Sets the changed flags and refreshes the ref
+ * Desc: A tile has changed when the SAD between its gray pixels and the
+ *  reference exceeds threshold * pixels. The sum stops as soon as it
+ *  passes the limit, so a moving tile costs about one row. Before the
+ *  first frame is primed every tile counts as changed.
+ ********************************************/
+void incr_diff_rows(incr_t *inc, Mat& gray, int ty0, int ty1)
+{
+  Mat& ref = inc->ref->mat;
+
+  for (int ty = ty0; ty < ty1; ty++) {
+    int y0 = ty * INCR_TILE_H;
+    int y1 = y0 + INCR_TILE_H < inc->rows ? y0 + INCR_TILE_H : inc->rows;
+    int skipped = 0;
+    for (int tx = 0; tx < inc->tilesX; tx++) {
+      int x0 = tx * INCR_TILE_W;
+      int w = x0 + INCR_TILE_W < inc->cols ? INCR_TILE_W : inc->cols - x0;
+      int changed = !inc->primed;
+      if (!changed) {
+        uint32_t limit = (uint32_t)inc->threshold * w * (y1 - y0);
+        uint32_t sad = 0;
+        for (int i = y0; i < y1 && !changed; i++) {
+          sad += kernels->sadRow(gray.ptr(i) + x0, ref.ptr(i) + x0, w);
+          changed = sad > limit;
+        }
+      }
+      if (changed) {
+        for (int i = y0; i < y1; i++) {
+          memcpy(ref.ptr(i) + x0, gray.ptr(i) + x0, w);
+        }
+      } else {
+        skipped++;
+      }
+      inc->changed[ty * inc->tilesX + tx] = changed;
+    }
+    inc->skipped[ty] = skipped;
+  }
+}
+
+/*******************************************
+ * Model: incr_sobel_rows
+ * Input: incremental state, gray frame, tile rows [ty0, ty1)
+ * Output: None directly. Modifies a ref parameter out
+ * Desc: Changed tiles are recomputed whole, runs of them along a tile row
+ *  in one go. An unchanged tile keeps its cached output except for the R
+ *  pixel strips whose neighbourhood reaches into a changed neighbour: the
+ *  top strip for a change above (corners included), the bottom one for
+ *  below, and the side strips for the tiles left and right. Writes stay
+ *  inside each tile, so tile rows can run in parallel.
+ ********************************************/
+void incr_sobel_rows(incr_t *inc, Mat& gray, Mat& out, int ty0, int ty1)
+{
+  int R = conv_ops[convOp].radius;
+
+  for (int ty = ty0; ty < ty1; ty++) {
+    int y0 = ty * INCR_TILE_H;
+    int y1 = y0 + INCR_TILE_H < inc->rows ? y0 + INCR_TILE_H : inc->rows;
+    int tx = 0;
+    while (tx < inc->tilesX) {
+      int x0 = tx * INCR_TILE_W;
+      if (isChanged(inc, tx, ty)) {
+        int end = tx + 1;
+        while (isChanged(inc, end, ty)) {
+          end++;
+        }
+        int x1 = end * INCR_TILE_W < inc->cols ? end * INCR_TILE_W : inc->cols;
+        sobelCalcRect(gray, out, x0, x1, y0, y1);
+        tx = end;
+        continue;
+      }
+      int x1 = x0 + INCR_TILE_W < inc->cols ? x0 + INCR_TILE_W : inc->cols;
+      if (isChanged(inc, tx-1, ty-1) || isChanged(inc, tx, ty-1) || isChanged(inc, tx+1, ty-1)) {
+        sobelCalcRect(gray, out, x0, x1, y0, y0+R < y1 ? y0+R : y1);
+      }
+      if (isChanged(inc, tx-1, ty+1) || isChanged(inc, tx, ty+1) || isChanged(inc, tx+1, ty+1)) {
+        sobelCalcRect(gray, out, x0, x1, y1-R > y0 ? y1-R : y0, y1);
+      }
+      if (isChanged(inc, tx-1, ty)) {
+        sobelCalcRect(gray, out, x0, x0+R < x1 ? x0+R : x1, y0, y1);
+      }
+      if (isChanged(inc, tx+1, ty)) {
+        sobelCalcRect(gray, out, x1-R > x0 ? x1-R : x0, x1, y0, y1);
+      }
+      tx++;
+    }
+  }
+}
+
+double incr_finish(incr_t *inc)
+{
+  int skipped = 0;
+  for (int ty = 0; ty < inc->tilesY; ty++) {
+    skipped += inc->skipped[ty];
+  }
+  if (inc->frames < inc->maxFrames) {
+    inc->frameSkipped[inc->frames] = skipped;
+  }
+  inc->frames++;
+  inc->tilesTotal += inc->tilesX * inc->tilesY;
+  inc->skippedTotal += skipped;
+  inc->primed = 1;
+  return (double)skipped / (inc->tilesX * inc->tilesY);
+}
+
+double incr_sobel(incr_t *inc, Mat& gray, Mat& out)
+{
+  incr_diff_rows(inc, gray, 0, inc->tilesY);
+  incr_sobel_rows(inc, gray, out, 0, inc->tilesY);
+  return incr_finish(inc);
+}
+
+void incr_report(const incr_t *inc, const char *prefix)
+{
+  ofstream csv((string(prefix) + "_incremental.csv").c_str(), ios::out);
+  int tiles = inc->tilesX * inc->tilesY;
+
+  csv << "frame,tiles,skipped,fraction_skipped" << endl;
+  for (int n = 0; n < inc->frames && n < inc->maxFrames; n++) {
+    csv << n << "," << tiles << "," << inc->frameSkipped[n] << ","
+        << (double)inc->frameSkipped[n] / tiles << endl;
+  }
+}
+
+void incr_destroy(incr_t *inc)
+{
+  fbuf_unref(inc->ref);
+  fpool_destroy(&inc->refPool);
+  free(inc->changed);
+  free(inc->skipped);
+  free(inc->frameSkipped);
+}
@@ -0,0 +1,46 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <stdint.h>
+#include "opencv2/imgproc/imgproc.hpp"
+#include "frame_pool.h"
+
+// Change-detection tiles. A tile row is one pool task, so INCR_TILE_H
+// also sets the parallel grain; 64 px is one AVX-512 SAD step per row.
+#define INCR_TILE_W 64
+#define INCR_TILE_H 32
+
+// State for -I. The reference frame holds, per tile, the gray pixels the
+// tile's cached output was last computed from; only changed tiles are
+// copied into it, so slow drift below the threshold still adds up to a
+// change eventually.
+struct incr_t {
+  frame_pool_t refPool;
+  frame_buf_t *ref;
+  int rows, cols;
+  int tilesX, tilesY;
+  int threshold;      // mean absolute difference per pixel that counts
+  int primed;         // ref and the output hold a full frame
+  uint8_t *changed;   // tilesX * tilesY flags for the current frame
+  int *skipped;       // unchanged tiles per tile row, current frame
+  int frames, maxFrames;
+  int *frameSkipped;  // unchanged tiles per frame, for the report
+  uint64_t tilesTotal, skippedTotal;
+};
+
+void incr_init(incr_t *inc, int rows, int cols, int threshold, int maxFrames);
+// Flags tile rows [ty0, ty1) of `gray` and refreshes their changed tiles
+// in the reference. Tile rows are independent.
+void incr_diff_rows(incr_t *inc, cv::Mat& gray, int ty0, int ty1);
+// Recomputes the output of tile rows [ty0, ty1) that depends on a changed
+// tile. Needs the flags of every tile row, so runs after all diffs.
+void incr_sobel_rows(incr_t *inc, cv::Mat& gray, cv::Mat& out, int ty0, int ty1);
+// Closes the frame; returns the fraction of its tiles that were skipped
+double incr_finish(incr_t *inc);
+// All three steps over the whole frame on the calling thread
+double incr_sobel(incr_t *inc, cv::Mat& gray, cv::Mat& out);
+// Writes <prefix>_incremental.csv, one line per frame
+void incr_report(const incr_t *inc, const char *prefix);
+void incr_destroy(incr_t *inc);
+
+#endif
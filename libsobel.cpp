@@ -0,0 +1,239 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <new>
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "libsobel.h"
+#include "sobel_alg.h"
+#include "sobel_kernels.h"
+#include "frame_pool.h"
+#include "frame_stats.h"
+#include "pool.h"
+
+using namespace cv;
+
+static_assert((int)SOBEL_OP_SOBEL == CONV_SOBEL && (int)SOBEL_OP_SCHARR == CONV_SCHARR &&
+              (int)SOBEL_OP_PREWITT == CONV_PREWITT && (int)SOBEL_OP_SOBEL5 == CONV_SOBEL5 &&
+              (int)SOBEL_MAG_L1 == CONV_L1 && (int)SOBEL_MAG_L2 == CONV_L2,
+              "libsobel.h enums must match sobel_kernels.h");
+
+struct sobel_ctx {
+  sobel_config cfg;
+  pool_t *pool;            // NULL when threads == 1
+  frame_pool_t scratch;    // gray frame for the two-pass path
+  frame_buf_t *gray;
+  frame_stats *stats;      // NULL without statsTileW/statsTileH
+};
+
+// Guards the process-wide backend and operator against racing creates
+static pthread_mutex_t ctxLock = PTHREAD_MUTEX_INITIALIZER;
+static int liveContexts;
+
+void sobel_config_init(struct sobel_config *cfg, int width, int height, int format)
+{
+  memset(cfg, 0, sizeof(*cfg));
+  cfg->width = width;
+  cfg->height = height;
+  cfg->format = format;
+  cfg->threads = 1;
+  cfg->isa = NULL;
+  cfg->op = SOBEL_OP_SOBEL;
+  cfg->mag = SOBEL_MAG_L1;
+  cfg->fused = 0;
+  cfg->edges = 0;
+  cfg->nms = 0;
+  cfg->statsTileW = 0;
+  cfg->statsTileH = 0;
+}
+
+// Takes the context's backend and operator, or checks them against the
+// ones live contexts already use. Called with ctxLock held.
+static int claimSettings(const sobel_config *cfg)
+{
+  const struct sobel_kernels *k = selectKernels(cfg->isa);
+  if (k == NULL) {
+    return -1;
+  }
+  if (liveContexts == 0) {
+    kernels = k;
+    convOp = cfg->op;
+    convMag = cfg->mag;
+  } else if (k != kernels || cfg->op != convOp || cfg->mag != convMag) {
+    return -1;
+  }
+  liveContexts++;
+  return 0;
+}
+
+/*******************************************
+ * Model: sobel_create
+ * Input: configuration
+ * Output: new context, or NULL
+ * Desc: Everything a frame needs is set up here: the worker pool (the
+ *  calling thread of sobel_process is worker 0), one gray scratch frame
+ *  for two-pass BGR and the frame stats. sobel_process never allocates.
+ ********************************************/
+sobel_ctx *sobel_create(const struct sobel_config *cfg)
+{
+  if (cfg->width < 3 || cfg->height < 3 ||
+      (cfg->format != SOBEL_GRAY && cfg->format != SOBEL_BGR) ||
+      cfg->threads < 1 || cfg->threads > POOL_MAX_THREADS ||
+      cfg->op < 0 || cfg->op >= CONV_NUM_OPS || cfg->mag < 0 || cfg->mag >= CONV_NUM_MAGS ||
+      cfg->edges < 0 || cfg->edges > 255 || (cfg->statsTileW > 0) != (cfg->statsTileH > 0)) {
+    return NULL;
+  }
+  frame_stats *stats = NULL;
+  if (cfg->statsTileW > 0) {
+    stats = new frame_stats;
+    if (stats_init(stats, cfg->height, cfg->width, cfg->statsTileW, cfg->statsTileH,
+                   cfg->edges ? cfg->edges : STATS_THRESHOLD, 0)) {
+      delete stats;
+      return NULL;
+    }
+  }
+  pthread_mutex_lock(&ctxLock);
+  int ret = claimSettings(cfg);
+  pthread_mutex_unlock(&ctxLock);
+  if (ret) {
+    if (stats) {
+      stats_destroy(stats);
+      delete stats;
+    }
+    return NULL;
+  }
+
+  sobel_ctx *ctx = new sobel_ctx;
+  ctx->cfg = *cfg;
+  ctx->pool = NULL;
+  ctx->gray = NULL;
+  ctx->stats = stats;
+  if (cfg->threads > 1) {
+    // Slots are cache-line aligned, which plain new does not honour
+    void *mem;
+    if (posix_memalign(&mem, POOL_CACHE_LINE, sizeof(pool_t))) {
+      errx(1, "sobel_create: out of memory");
+    }
+    ctx->pool = new (mem) pool_t;
+    pool_init(ctx->pool, cfg->threads);
+  }
+  if (cfg->format == SOBEL_BGR && (!cfg->fused || cfg->edges)) {
+    fpool_init(&ctx->scratch, 1, cfg->height, cfg->width, CV_8UC1, 0);
+    ctx->gray = fpool_get(&ctx->scratch);
+  }
+  return ctx;
+}
+
+/*******************************************
+ * Model: sobel_process
+ * Input: context, source rows and stride, destination rows and stride
+ * Output: 0, or -1 if the arguments do not fit the context
+ * Desc: Wraps both buffers in Mat headers (no copy, no allocation) and
+ *  runs the same kernels as the driver: straight to Sobel for gray
+ *  input, fused or gray + Sobel for BGR, over the pool if there is one.
+ *  Edge maps always go through the gray frame.
+ ********************************************/
+int sobel_process(sobel_ctx *ctx, const uint8_t *src, size_t srcStride,
+                  uint8_t *dst, size_t dstStride)
+{
+  const sobel_config& cfg = ctx->cfg;
+  int dstCols = cfg.edges ? EDGE_BYTES(cfg.width) : cfg.width;
+  if (src == NULL || dst == NULL ||
+      srcStride < (size_t)cfg.width * cfg.format || dstStride < (size_t)dstCols) {
+    return -1;
+  }
+  Mat in(cfg.height, cfg.width, cfg.format == SOBEL_GRAY ? CV_8UC1 : CV_8UC3,
+         (void *)src, srcStride);
+  Mat out(cfg.height, dstCols, CV_8UC1, dst, dstStride);
+  pool_t *pool = ctx->pool;
+
+  if (ctx->stats) {
+    stats_begin(ctx->stats);
+  }
+  if (cfg.edges) {
+    Mat& gray = cfg.format == SOBEL_GRAY ? in : ctx->gray->mat;
+    if (cfg.format == SOBEL_BGR) {
+      if (pool) {
+        grayScaleMT(pool, in, gray);
+      } else {
+        grayScale(in, gray);
+      }
+    }
+    if (pool) {
+      sobelEdgeMT(pool, gray, out, cfg.edges, cfg.nms);
+    } else {
+      sobelEdge(gray, out, cfg.edges, cfg.nms);
+    }
+  } else if (cfg.format == SOBEL_GRAY) {
+    if (pool) {
+      sobelMT(pool, in, out);
+    } else {
+      sobelCalc(in, out);
+    }
+  } else if (cfg.fused) {
+    if (pool) {
+      sobelFusedMT(pool, in, out);
+    } else {
+      sobelFused(in, out);
+    }
+  } else {
+    Mat& gray = ctx->gray->mat;
+    if (pool) {
+      grayScaleMT(pool, in, gray);
+      sobelMT(pool, gray, out);
+    } else {
+      grayScale(in, gray);
+      sobelCalc(gray, out);
+    }
+  }
+  if (ctx->stats) {
+    stats_end(ctx->stats);
+  }
+  return 0;
+}
+
+int sobel_get_stats(const sobel_ctx *ctx, struct sobel_stats *out, uint32_t *tiles)
+{
+  const frame_stats *st = ctx->stats;
+  if (st == NULL) {
+    return -1;
+  }
+  for (int b = 0; b < STATS_BINS; b++) {
+    out->hist[b] = st->hist[b].load(std::memory_order_relaxed);
+  }
+  out->energy = st->energy.load(std::memory_order_relaxed);
+  out->tilesX = st->tilesX;
+  out->tilesY = st->tilesY;
+  if (tiles) {
+    for (int k = 0; k < st->tilesX * st->tilesY; k++) {
+      tiles[k] = st->tileSums[k].load(std::memory_order_relaxed);
+    }
+  }
+  return 0;
+}
+
+const char *sobel_backend(const sobel_ctx *)
+{
+  return kernels->name;
+}
+
+void sobel_destroy(sobel_ctx *ctx)
+{
+  if (ctx->pool) {
+    pool_destroy(ctx->pool);
+    ctx->pool->~pool_t();
+    free(ctx->pool);
+  }
+  if (ctx->gray) {
+    fbuf_unref(ctx->gray);
+    fpool_destroy(&ctx->scratch);
+  }
+  if (ctx->stats) {
+    stats_destroy(ctx->stats);
+    delete ctx->stats;
+  }
+  delete ctx;
+  pthread_mutex_lock(&ctxLock);
+  liveContexts--;
+  pthread_mutex_unlock(&ctxLock);
+}
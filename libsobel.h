@@ -0,0 +1,73 @@
+#ifndef LIBSOBEL_H
+#define LIBSOBEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// libsobel: the edge filter without the driver. Link libsobel.a or
+// libsobel.so (plus opencv_core and -pthread). A context owns the worker
+// pool and any scratch frame; sobel_process() then filters caller-owned
+// memory in place, with no copies and no allocation.
+//
+// The kernel backend and operator are process-wide, as -i and -k are for
+// the driver. Every context alive at once must agree on them;
+// sobel_create() fails otherwise.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum { SOBEL_GRAY = 1, SOBEL_BGR = 3 };          // source pixel formats
+enum { SOBEL_OP_SOBEL, SOBEL_OP_SCHARR, SOBEL_OP_PREWITT, SOBEL_OP_SOBEL5 };
+enum { SOBEL_MAG_L1, SOBEL_MAG_L2 };
+
+struct sobel_config {
+  int width;          // at least 3
+  int height;         // at least 3
+  int format;         // SOBEL_GRAY or SOBEL_BGR
+  int threads;        // 1 filters on the calling thread alone
+  const char *isa;    // scalar, neon, sse2, avx2, avx512 or NULL for the widest
+  int op;             // SOBEL_OP_*
+  int mag;            // SOBEL_MAG_*
+  int fused;          // BGR only: single-pass gray + Sobel, no gray scratch
+  int edges;          // 1..255: dst gets a 1-bit edge map at this threshold
+  int nms;            // with edges: thin them by non-maximum suppression
+  int statsTileW;     // both > 0: gather sobel_get_stats() for every frame,
+  int statsTileH;     // with tile sums over a grid of tiles this size
+};
+
+// Reductions of one frame's magnitudes (before any nms), taken by the
+// kernels as they write each row
+struct sobel_stats {
+  uint32_t hist[256];   // pixels per magnitude
+  uint64_t energy;      // sum of every magnitude
+  int tilesX, tilesY;   // tile grid; the last column and row may be narrower
+};
+
+typedef struct sobel_ctx sobel_ctx;
+
+// Fills `cfg` with defaults for a width x height source in `format`
+void sobel_config_init(struct sobel_config *cfg, int width, int height, int format);
+// NULL if the configuration is invalid or clashes with a live context
+sobel_ctx *sobel_create(const struct sobel_config *cfg);
+// Filters one frame. src holds height rows of width pixels in the
+// context's format, srcStride bytes apart; dst gets height rows of width
+// gray bytes, dstStride bytes apart. With edges, each dst row is instead
+// (width+7)/8 bytes, bit j%8 of byte j/8 set for an edge at pixel j, and
+// fused is ignored. Returns 0, or -1 on bad arguments.
+// One call at a time per context; separate contexts may run concurrently.
+int sobel_process(sobel_ctx *ctx, const uint8_t *src, size_t srcStride,
+                  uint8_t *dst, size_t dstStride);
+// Stats of the last frame sobel_process() filtered. tiles, if not NULL,
+// gets tilesX * tilesY sums, row by row. Returns 0, or -1 if the context
+// has no statsTileW/statsTileH.
+int sobel_get_stats(const sobel_ctx *ctx, struct sobel_stats *out, uint32_t *tiles);
+// Name of the kernel backend in use
+const char *sobel_backend(const sobel_ctx *ctx);
+void sobel_destroy(sobel_ctx *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
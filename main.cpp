@@ -3,8 +3,18 @@
 #include <unistd.h>
 #include <string.h>
 #include <locale.h>
+#include <sched.h>
 #include <err.h>
 #include "sobel_alg.h"
+#include "sobel_kernels.h"
+#include "frame_cache.h"
+#include "frame_source.h"
+#include "incremental.h"
+#include "frame_stats.h"
+#include "frame_sink.h"
+#include "pc.h"
+#include "trace.h"
+#include "affinity.h"
 
 #define EPRINTF(...) fprintf(stderr, __VA_ARGS__)
 struct opts opts;
@@ -17,23 +27,184 @@ void printHelp(int argc, char **argv)
   EPRINTF("OPTS can be a combination of the following:\n");
   EPRINTF("-n <num>  :  Number of frames after which program should quit. Must be a positive integer\n");
   EPRINTF("-m        :  Run the Multi-threaded version\n");
+  EPRINTF("-t <num>  :  Number of worker threads for the Multi-threaded version (default 2, implies -m)\n");
   EPRINTF("-f <file> :  Get input video from file. This is the default (defaults to 'baxter.avi' if unspecified)\n");
-  EPRINTF("-w        :  Get input video from webcam (if connected to board). Must use either '-w' or '-f', not both\n");
+  EPRINTF("             Several -f/-w run every input as its own stream on one shared -t pool\n");
+  EPRINTF("-W <list> :  Multi-stream weights, comma separated in -f/-w order (1..%d, default 1): each\n", MAX_STREAM_WEIGHT);
+  EPRINTF("             stream's share of pool time when all have frames waiting\n");
+  EPRINTF("-d <num>  :  Decode the -f file on <num> threads, each seeking to its own segments (frames stay in order)\n");
+  EPRINTF("-w        :  Get input video from webcam (if connected to board). Must use either '-w' or '-f', not both,\n");
+  EPRINTF("             unless running several streams; each further -w takes the next camera\n");
+  EPRINTF("-P        :  Pipeline capture, compute and display on separate threads (compute uses the -t pool with -m)\n");
+  EPRINTF("-O        :  Offline batch mode: -t workers each filter whole frames, output stays in frame order\n");
+  EPRINTF("-R <ms>   :  Real time: always filter the newest frame, drop stale ones, and skip the display or\n");
+  EPRINTF("             filter at half resolution when a frame would miss <ms> from capture to screen\n");
+  EPRINTF("-s        :  Use the fused single-pass grayscale+Sobel kernel instead of two separate passes\n");
+  EPRINTF("-L        :  Back frame buffers with huge pages when the kernel has some reserved\n");
+  EPRINTF("-i <isa>  :  Force a kernel backend: scalar, neon, sse2, avx2 or avx512 (default: widest the CPU supports)\n");
+  EPRINTF("-k <op>[:l2] : Edge operator: sobel (default), scharr, prewitt or sobel5 (5x5); :l2 takes\n");
+  EPRINTF("             sqrt(Gx^2+Gy^2) instead of |Gx|+|Gy|\n");
+  EPRINTF("-I <thr>  :  Incremental: only recompute Sobel for %dx%d tiles whose mean absolute gray change\n", INCR_TILE_W, INCR_TILE_H);
+  EPRINTF("             since they were last computed exceeds <thr> (0: any change), plus their halo\n");
+  EPRINTF("-E <thr>[:nms] : Binary edge map, one bit per pixel, set where the magnitude is at least <thr>\n");
+  EPRINTF("             (1..255); :nms first thins edges by non-maximum suppression along the gradient\n");
+  EPRINTF("-X <WxH>[:thr] : Per-frame magnitude histogram, edge energy and sums of WxH tiles, taken by the\n");
+  EPRINTF("             kernels as they write each row; edge density counts magnitudes of at least <thr>\n");
+  EPRINTF("             (default the -E threshold, else %d)\n", STATS_THRESHOLD);
+  EPRINTF("-o <sink> :  Also write the Sobel output, from its own thread, to a video file (<file>), a raw\n");
+  EPRINTF("             gray frame cache (raw:<file>) or a shared-memory ring (shm:<name>)\n");
+  EPRINTF("-b <pol>  :  When -o falls behind: block (default) waits for it, drop skips the frame\n");
+  EPRINTF("-H        :  Headless: never open a window; with -p or -g the run measures grayscale+Sobel only\n");
+  EPRINTF("-p <num>  :  Pre-decode up to <num> frames of the file/webcam into memory and replay them in a loop\n");
+  EPRINTF("-g <WxH>  :  Use generated frames of the given size instead of a file or webcam (e.g. -g 1920x1080)\n");
+  EPRINTF("-y <fmt>[:WxH] : Take only the Y plane of yuyv, nv12 or i420 input: -w captures it from V4L2,\n");
+  EPRINTF("             -f reads a raw YUV file of that size. Skips the BGR and grayscale conversions\n");
+  EPRINTF("-D <file> :  Decode up to -n frames of the input into a raw frame cache file and exit\n");
+  EPRINTF("-G        :  With -D, store grayscale frames instead of BGR\n");
+  EPRINTF("-r <file> :  Replay frames from a frame cache written by -D (memory-mapped, no decode or copy)\n");
+  EPRINTF("-A <role>:<cpus> : Pin compute, capture or output threads: core (one per physical core), smt\n");
+  EPRINTF("             (every SMT sibling) or a CPU list such as 0,2,4-7. Repeat per role; -t defaults to\n");
+  EPRINTF("             the compute CPU count\n");
+  EPRINTF("-S <cls>  :  Scheduling for the threads: fifo[:<prio>] (SCHED_FIFO, default priority 10) or nice:<n>\n");
+  EPRINTF("-T <file> :  Write a Chrome trace (chrome://tracing, ui.perfetto.dev) of every thread's stages and waits\n");
+  EPRINTF("-e <list> :  Extra perf events to count, comma separated, up to %d of:\n", PC_MAX_EXTRA);
+  EPRINTF("             %s\n", pc_event_names());
+}
+
+// Every -f/-w is also recorded as a stream; with two or more of them the
+// run is multi-stream
+static void addStream(char *file, int camera)
+{
+  if (opts.numStreams == MAX_STREAMS) {
+    EPRINTF("At most %d -f/-w inputs\n", MAX_STREAMS);
+    exit(-1);
+  }
+  struct stream_spec *spec = &opts.streams[opts.numStreams++];
+  spec->videoFile = file;
+  spec->camera = camera;
+  spec->weight = 1;
 }
 
 void parseOpts(int argc, char **argv)
 {
   int c;
-  int inputSrc = 0;
+  int inputSrc = 0, cameras = 0;
+  char *weights = NULL;
   memset(&opts, 0, sizeof(struct opts));
-  while ((c = getopt (argc, argv, "mwn:f:")) != -1) {
+  while ((c = getopt (argc, argv, "mPOsLHGwn:f:i:t:p:g:D:r:e:T:d:y:k:I:o:b:W:R:A:S:E:X:")) != -1) {
     switch (c) {
       case 'm':
         opts.multiThreaded = 1;
         break;
+      case 'P':
+        opts.pipelined = 1;
+        break;
+      case 'O':
+        opts.offline = 1;
+        break;
+      case 'L':
+        opts.hugepages = 1;
+        break;
+      case 's':
+        opts.fused = 1;
+        break;
+      case 'H':
+        opts.headless = 1;
+        break;
+      case 'D':
+        opts.dumpFile = optarg;
+        break;
+      case 'G':
+        opts.dumpGray = 1;
+        break;
+      case 'r':
+        opts.replayFile = optarg;
+        inputSrc++;
+        break;
+      case 'e':
+        opts.events = optarg;
+        break;
+      case 'T':
+        opts.traceFile = optarg;
+        break;
+      case 'd':
+        opts.decoders = atoi(optarg);
+        if (opts.decoders < 1) {
+          EPRINTF("Invalid number of decoders: %s\n", optarg);
+          exit(-1);
+        }
+        break;
+      case 'o':
+        opts.outputSpec = optarg;
+        break;
+      case 'b':
+        if (strcmp(optarg, "block") == 0) {
+          opts.outputPolicy = OUTPUT_BLOCK;
+        } else if (strcmp(optarg, "drop") == 0) {
+          opts.outputPolicy = OUTPUT_DROP;
+        } else {
+          EPRINTF("Invalid output policy: %s (block or drop)\n", optarg);
+          exit(-1);
+        }
+        break;
+      case 'I':
+        opts.incremental = 1;
+        opts.incrThreshold = atoi(optarg);
+        if (opts.incrThreshold < 0 || opts.incrThreshold > 255) {
+          EPRINTF("Invalid change threshold: %s (0..255)\n", optarg);
+          exit(-1);
+        }
+        break;
+      case 'E': {
+        char *nms = strchr(optarg, ':');
+        if (nms) {
+          *nms++ = '\0';
+        }
+        opts.edgeThreshold = atoi(optarg);
+        if (opts.edgeThreshold < 1 || opts.edgeThreshold > 255 || (nms && strcmp(nms, "nms") != 0)) {
+          EPRINTF("Invalid edge map: %s (threshold 1..255, optionally :nms)\n", optarg);
+          exit(-1);
+        }
+        opts.edgeNms = nms != NULL;
+        break;
+      }
+      case 'X': {
+        char *thr = strchr(optarg, ':');
+        if (thr) {
+          *thr++ = '\0';
+          opts.statsThreshold = atoi(thr);
+        }
+        if (sscanf(optarg, "%dx%d", &opts.statsTileW, &opts.statsTileH) != 2 ||
+            opts.statsTileW < 1 || opts.statsTileH < 1 ||
+            (thr && (opts.statsThreshold < 1 || opts.statsThreshold > 255))) {
+          EPRINTF("Invalid frame statistics: %s (tile WxH, optionally :threshold 1..255)\n", optarg);
+          exit(-1);
+        }
+        break;
+      }
+      case 'p':
+        opts.preload = atoi(optarg);
+        if (opts.preload <= 0) {
+          EPRINTF("Invalid number of frames to pre-decode: %s\n", optarg);
+          exit(-1);
+        }
+        break;
+      case 'g':
+        if (sscanf(optarg, "%dx%d", &opts.synthWidth, &opts.synthHeight) != 2 ||
+            opts.synthWidth < 3 || opts.synthHeight < 3) {
+          EPRINTF("Invalid synthetic frame size: %s (WxH, at least 3x3)\n", optarg);
+          exit(-1);
+        }
+        inputSrc++;
+        break;
+      case 't':
+        opts.multiThreaded = 1;
+        opts.numThreads = atoi(optarg);
+        break;
       case 'w':
         opts.webcam = 1;
         inputSrc++;
+        addStream(NULL, cameras++);
         break;
       case 'n':
         opts.numFrames = atoi(optarg);
@@ -41,9 +212,75 @@ void parseOpts(int argc, char **argv)
       case 'f':
         opts.videoFile = optarg;
         inputSrc++;
+        addStream(optarg, -1);
+        break;
+      case 'W':
+        weights = optarg;
+        break;
+      case 'R':
+        opts.deadlineUs = (int)(atof(optarg) * 1000);
+        if (opts.deadlineUs <= 0) {
+          EPRINTF("Invalid deadline: %s (milliseconds, more than 0)\n", optarg);
+          exit(-1);
+        }
+        break;
+      case 'A':
+        if (affinity_set(optarg)) {
+          EPRINTF("Invalid placement: %s (compute, capture or output, then :core, :smt or a list of usable CPUs)\n", optarg);
+          exit(-1);
+        }
         break;
+      case 'S':
+        if (affinity_sched(optarg)) {
+          EPRINTF("Invalid scheduling: %s (fifo, fifo:<%d..%d> or nice:<-20..19>)\n", optarg,
+                  sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+          exit(-1);
+        }
+        break;
+      case 'i':
+        opts.isa = optarg;
+        break;
+      case 'k': {
+        char *mag = strchr(optarg, ':');
+        if (mag) {
+          *mag++ = '\0';
+        }
+        convOp = -1;
+        for (int k = 0; k < CONV_NUM_OPS; k++) {
+          if (strcmp(optarg, conv_ops[k].name) == 0) {
+            convOp = k;
+          }
+        }
+        if (convOp < 0 || (mag && strcmp(mag, "l1") != 0 && strcmp(mag, "l2") != 0)) {
+          EPRINTF("Invalid operator: %s (sobel, scharr, prewitt or sobel5, optionally :l1 or :l2)\n", optarg);
+          exit(-1);
+        }
+        convMag = mag && strcmp(mag, "l2") == 0 ? CONV_L2 : CONV_L1;
+        break;
+      }
+      case 'y': {
+        char *size = strchr(optarg, ':');
+        if (size) {
+          *size++ = '\0';
+        }
+        if (!yuvFormatValid(optarg) ||
+            (size && (sscanf(size, "%dx%d", &opts.yuvWidth, &opts.yuvHeight) != 2 ||
+                      opts.yuvWidth < 3 || opts.yuvHeight < 3))) {
+          EPRINTF("Invalid YUV input: %s (yuyv, nv12 or i420, optionally :WxH)\n", optarg);
+          exit(-1);
+        }
+        opts.yuvFormat = optarg;
+        // There is no colour left to store
+        opts.dumpGray = 1;
+        break;
+      }
       case '?':
-        if (optopt == 'n' || optopt == 'f') {
+        if (optopt == 'n' || optopt == 'f' || optopt == 'i' || optopt == 't' ||
+            optopt == 'p' || optopt == 'g' || optopt == 'D' || optopt == 'r' ||
+            optopt == 'e' || optopt == 'T' || optopt == 'd' || optopt == 'y' ||
+            optopt == 'k' || optopt == 'I' || optopt == 'o' || optopt == 'b' ||
+            optopt == 'W' || optopt == 'R' || optopt == 'A' || optopt == 'S' ||
+            optopt == 'E' || optopt == 'X') {
           EPRINTF("Option %c requires an argument\n", optopt);
         }
         else if (isprint(optopt)) {
@@ -65,77 +302,184 @@ void parseOpts(int argc, char **argv)
     printHelp(argc, argv);
     exit(-1);
   }
+  if (opts.numThreads == 0) {
+    // One worker per pinned compute CPU
+    opts.numThreads = affinity_count(AFF_COMPUTE) ? affinity_count(AFF_COMPUTE) : 2;
+    if (opts.numThreads > MAX_THREADS) {
+      opts.numThreads = MAX_THREADS;
+    }
+  }
+  if (opts.numThreads < 1 || opts.numThreads > MAX_THREADS) {
+    EPRINTF("Invalid number of threads: %d (must be 1..%d)\n", opts.numThreads, MAX_THREADS);
+    printHelp(argc, argv);
+    exit(-1);
+  }
   if (inputSrc == 0) {
     if (opts.videoFile == NULL) {
       opts.videoFile = defaultVideo;
     }
-  } else if (inputSrc > 1) {
-    EPRINTF("Both file and webcam options specified; please specify either -f or -w, not both\n");
+  } else if (inputSrc > 1 && inputSrc != opts.numStreams) {
+    EPRINTF("More than one input specified; please specify only one of -f, -w, -g or -r, or several -f/-w\n");
+    printHelp(argc, argv);
+    exit(-1);
+  }
+  if (opts.numStreams < 2) {
+    opts.numStreams = 0;
+    if (weights) {
+      EPRINTF("-W needs several -f/-w inputs\n");
+      exit(-1);
+    }
+  } else if (opts.pipelined || opts.offline || opts.incremental || opts.outputSpec ||
+             opts.dumpFile || opts.preload || opts.yuvFormat || opts.decoders) {
+    EPRINTF("Several -f/-w inputs run in multi-stream mode, which has no -P, -O, -I, -o, -D, -p, -y or -d\n");
+    printHelp(argc, argv);
+    exit(-1);
+  }
+  if (weights) {
+    int k = 0;
+    for (char *w = strtok(weights, ","); w; w = strtok(NULL, ","), k++) {
+      int weight = atoi(w);
+      if (k >= opts.numStreams || weight < 1 || weight > MAX_STREAM_WEIGHT) {
+        EPRINTF("Invalid weights: one per -f/-w input, each 1..%d\n", MAX_STREAM_WEIGHT);
+        exit(-1);
+      }
+      opts.streams[k].weight = weight;
+    }
+  }
+
+  if (opts.deadlineUs && (opts.pipelined || opts.offline || opts.incremental ||
+                          opts.numStreams > 1 || opts.dumpFile)) {
+    EPRINTF("-R runs its own loop; it does not combine with -P, -O, -I, -D or several streams\n");
+    printHelp(argc, argv);
+    exit(-1);
+  }
+  if (opts.incremental && (opts.pipelined || opts.offline)) {
+    EPRINTF("-I works with the single- and multi-threaded loops only, not -P or -O\n");
+    printHelp(argc, argv);
+    exit(-1);
+  }
+  if (opts.edgeThreshold && (opts.pipelined || opts.offline || opts.incremental ||
+                             opts.deadlineUs || opts.numStreams > 1 || opts.dumpFile)) {
+    EPRINTF("-E works with the single- and multi-threaded loops only, not -P, -O, -I, -R, -D or several streams\n");
+    printHelp(argc, argv);
+    exit(-1);
+  }
+  if (opts.statsTileW && (opts.pipelined || opts.offline || opts.incremental ||
+                          opts.deadlineUs || opts.numStreams > 1 || opts.dumpFile)) {
+    EPRINTF("-X works with the single- and multi-threaded loops only, not -P, -O, -I, -R, -D or several streams\n");
+    printHelp(argc, argv);
+    exit(-1);
+  }
+  if (opts.statsTileW && opts.statsThreshold == 0) {
+    opts.statsThreshold = opts.edgeThreshold ? opts.edgeThreshold : STATS_THRESHOLD;
+  }
+  if (opts.edgeThreshold && opts.fused) {
+    // The edge kernels read the gray frame
+    EPRINTF("-E needs the gray frame; ignoring -s\n");
+    opts.fused = 0;
+  }
+  if (opts.incremental && opts.fused) {
+    // Change detection works on the gray frame, which -s never writes
+    EPRINTF("-I needs the gray frame; ignoring -s\n");
+    opts.fused = 0;
+  }
+
+  kernels = selectKernels(opts.isa);
+  if (kernels == NULL) {
+    EPRINTF("Kernel backend '%s' is unknown or not supported by this CPU\n", opts.isa);
     printHelp(argc, argv);
     exit(-1);
   }
   return;
 }
 
+int mainDump()
+{
+  int n = dumpFrames(opts.dumpFile, opts.dumpGray);
+  printf("Wrote %d %s frames to %s\n", n, opts.dumpGray ? "gray" : "BGR", opts.dumpFile);
+  return 0;
+}
+
 int mainSingleThread()
 {
+  AFFINITY_THREAD(AFF_COMPUTE, 0);
   runSobelST();
   return 0;
 }
 
-// This mutex will be used to allow threads to contest for thread 0 status
-pthread_barrier_t endSobel;
-pthread_mutex_t thread0 = PTHREAD_MUTEX_INITIALIZER;
-pthread_t thread0_id = 0;
-
-pthread_barrier_t capReady;
-pthread_barrier_t srcReady;
-pthread_barrier_t grayReady;
-pthread_barrier_t sobelReady;
+// Worker pool shared by every frame of the multi-threaded version
+static pool_t pool;
 
 int mainMultiThread()
 {
-  // Thread variables
-  pthread_t sobel1, sobel2;
-
-  // Set up a barrier to synchronize both threads at the end of runSobel
-  pthread_barrier_init(&endSobel, NULL, 2);
-  pthread_barrier_init(&capReady, NULL, 2);
-  pthread_barrier_init(&srcReady, NULL, 2);
-  pthread_barrier_init(&grayReady, NULL, 2);
-  pthread_barrier_init(&sobelReady, NULL, 2);
-
-  // Call threads
-  int ret;
-  if ( (ret = pthread_create( &sobel1, NULL, runSobelMT, NULL)) ){
-    printf("Thread creation failed: %d\n", ret);
-    exit(1);
-  }
-  if ( (ret = pthread_create( &sobel2, NULL, runSobelMT, NULL)) ){
-    printf("Thread creation failed: %d\n", ret);
-    exit(1);
-  }
-
-  // Wait for them to finish
-  pthread_join(sobel1, NULL);
-  pthread_join(sobel2, NULL);
-
-  // Destroy the barriers
-  pthread_barrier_destroy(&endSobel);
-  pthread_barrier_destroy(&capReady);
-  pthread_barrier_destroy(&srcReady);
-  pthread_barrier_destroy(&grayReady);
-  pthread_barrier_destroy(&sobelReady);
+  pool_init(&pool, opts.numThreads);
+  // Filters its share of every frame as pool slot 0
+  AFFINITY_THREAD(AFF_COMPUTE, 0);
+  runSobelMT(&pool);
+  pool_destroy(&pool);
 
   // Return ok if sobel returns correctly
   return 0;
 }
 
+int mainMultiStream()
+{
+  pool_init(&pool, opts.numThreads);
+  AFFINITY_THREAD(AFF_COMPUTE, 0);
+  runSobelMulti(&pool);
+  pool_destroy(&pool);
+  return 0;
+}
+
+int mainRealTime()
+{
+  AFFINITY_THREAD(AFF_COMPUTE, 0);
+  if (opts.multiThreaded) {
+    pool_init(&pool, opts.numThreads);
+    runSobelRT(&pool);
+    pool_destroy(&pool);
+  } else {
+    runSobelRT(NULL);
+  }
+  return 0;
+}
+
+int mainPipelined()
+{
+  if (opts.multiThreaded) {
+    pool_init(&pool, opts.numThreads);
+    runSobelPipe(&pool);
+    pool_destroy(&pool);
+  } else {
+    runSobelPipe(NULL);
+  }
+  return 0;
+}
+
 int main(int argc, char **argv)
 {
   parseOpts(argc, argv);
+  if (opts.traceFile) {
+    trace_init(opts.traceFile);
+    trace_thread_name("main");
+  }
 
-  if (opts.multiThreaded == 0) {
+  if (opts.dumpFile) {
+    mainDump();
+  }
+  else if (opts.numStreams > 1) {
+    mainMultiStream();
+  }
+  else if (opts.deadlineUs) {
+    mainRealTime();
+  }
+  else if (opts.offline) {
+    runSobelOffline(opts.numThreads);
+  }
+  else if (opts.pipelined) {
+    mainPipelined();
+  }
+  else if (opts.multiThreaded == 0) {
     mainSingleThread();
   }
   else if (opts.multiThreaded == 1) {
@@ -144,5 +488,6 @@ int main(int argc, char **argv)
   else {  // Invalid argument
    fprintf(stderr,"Usage: %s [-m]\n",argv[0]);
   }
+  trace_dump();
   return 0;
 }
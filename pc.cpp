@@ -1,104 +1,146 @@
 #include "pc.h"
 #include <stdio.h>
 #include <stdlib.h>
-#include "opencv2/imgproc/imgproc.hpp"
-#include "opencv2/highgui/highgui.hpp"
 #include <time.h>
-#include <iostream>
-#include <fstream>
 #include <errno.h>
 #include <unistd.h>
 #include <string.h>
-#include <locale.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 #include <err.h>
 
-#ifdef __arm__
-#include <perfmon/pfmlib.h>
-#include <perfmon/pfmlib_perf_event.h>
-#endif
-
-// Setup the counters and populate the counters struct with their data
-void pc_init(counters_t *counters, int pid)
+#include "sobel_alg.h"
+
+#define HW_CACHE(id, op, result) \
+  ((id) | (PERF_COUNT_HW_CACHE_OP_##op << 8) | (PERF_COUNT_HW_CACHE_RESULT_##result << 16))
+
+// Generic kernel events, so the same names work on the ARM board and on
+// x86 hosts without libpfm
+static const struct {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+} eventTable[] = {
+  { "cycles",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "l1d-misses",       PERF_TYPE_HW_CACHE, HW_CACHE(PERF_COUNT_HW_CACHE_L1D, READ, MISS) },
+  { "llc-misses",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { "llc-refs",         PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+  { "branches",         PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+  { "branch-misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  { "stalled-frontend", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND },
+  { "stalled-backend",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND },
+  { "dtlb-misses",      PERF_TYPE_HW_CACHE, HW_CACHE(PERF_COUNT_HW_CACHE_DTLB, READ, MISS) },
+  { "page-faults",      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+#define NUM_EVENTS (int)(sizeof(eventTable) / sizeof(eventTable[0]))
+
+const char *pc_event_names(void)
 {
+  static char names[256];
+  if (names[0] == 0) {
+    for (int k = 0; k < NUM_EVENTS; k++) {
+      if (k) {
+        strcat(names, ",");
+      }
+      strcat(names, eventTable[k].name);
+    }
+  }
+  return names;
+}
 
-#ifndef __arm__
-  return;
-
-#else
-  int ret;
-  ret = pfm_initialize();
-
-  if (ret != PFM_SUCCESS) {
-    errx(1, "cannot initialize library: %s", pfm_strerror(ret));
+static int findEvent(const char *name)
+{
+  for (int k = 0; k < NUM_EVENTS; k++) {
+    if (strcmp(eventTable[k].name, name) == 0) {
+      return k;
+    }
   }
+  return -1;
+}
 
-  // Set values for getting cycle count
-  memset(&counters->cycles.attr, 0, sizeof(counters->cycles.attr));
-  memset(&counters->l1_misses.attr, 0, sizeof(counters->l1_misses.attr));
-  memset(&counters->ic.attr, 0, sizeof(counters->ic.attr));
-
-  memset(&counters->cycles.arg, 0, sizeof(counters->cycles.arg));
-  memset(&counters->l1_misses.arg, 0, sizeof(counters->l1_misses.arg));
-  memset(&counters->ic.arg, 0, sizeof(counters->ic.arg));
-
-  counters->cycles.count = 0;
-  counters->l1_misses.count = 0;
-  counters->ic.count = 0;
-
-  counters->cycles.arg.size = sizeof(counters->cycles.arg);
-  counters->l1_misses.arg.size = sizeof(counters->l1_misses.arg);
-  counters->ic.arg.size = sizeof(counters->ic.arg);
-
-  counters->cycles.arg.attr = &counters->cycles.attr;
-  counters->l1_misses.arg.attr = &counters->l1_misses.attr;
-  counters->ic.arg.attr = &counters->ic.attr;
+static int openEvent(int ev, int pid, int group, int excludeKernel)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = eventTable[ev].type;
+  attr.config = eventTable[ev].config;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  // Only the leader starts disabled; members follow it
+  attr.disabled = group < 0;
+  attr.exclude_kernel = excludeKernel;
+  attr.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &attr, pid, -1, group, 0);
+}
 
-  // Get the encoding for the events
-  // cycles
-  ret = pfm_get_os_event_encoding("cycles", PFM_PLM0|PFM_PLM3, PFM_OS_PERF_EVENT, &counters->cycles.arg);
-  if (ret != PFM_SUCCESS) {
-    err(1,"Cycles: cannot get encoding %s", pfm_strerror(ret));
-  }
-  // l1 cache misses
-  ret = pfm_get_os_event_encoding("l1-dcache-load-misses", PFM_PLM0|PFM_PLM3, PFM_OS_PERF_EVENT, &counters->l1_misses.arg);
-  if (ret != PFM_SUCCESS) {
-    err(1,"L1 Cache Misses:cannot get encoding %s", pfm_strerror(ret));
+// Adds an event to the group; an event the PMU does not have reads as 0
+static void addEvent(counters_t *counters, perf_counter_t *pc, int ev, int pid, int excludeKernel)
+{
+  pc->name = eventTable[ev].name;
+  pc->fd = openEvent(ev, pid, counters->cycles.fd, excludeKernel);
+  if (pc->fd < 0) {
+    fprintf(stderr, "Counter %s unavailable (%s), reporting 0\n", pc->name, strerror(errno));
+    return;
   }
+  counters->order[counters->nr++] = pc;
+}
 
-  // instruction count misses
-  ret = pfm_get_os_event_encoding("instructions", PFM_PLM0|PFM_PLM3, PFM_OS_PERF_EVENT, &counters->ic.arg);
-  if (ret != PFM_SUCCESS) {
-    err(1,"Instruction Count:cannot get encoding %s", pfm_strerror(ret));
+/*******************************************
+ * Model: pc_init
+ * Input: counters to fill in, thread to count (0 = caller), extra events
+ * Output: None directly. Opens the counter group
+ * Desc: Opens cycles as the group leader and everything else as members.
+ *  Kernel-mode counting is dropped if perf_event_paranoid forbids it.
+ *  Nothing here is fatal except an unknown event name.
+ ********************************************/
+void pc_init(counters_t *counters, int pid, const char *events)
+{
+  memset(counters, 0, sizeof(*counters));
+  counters->cycles.fd = counters->l1_misses.fd = counters->ic.fd = -1;
+  counters->cycles.name = "cycles";
+
+  int extra[PC_MAX_EXTRA];
+  if (events) {
+    char list[256];
+    char *save, *name;
+    snprintf(list, sizeof(list), "%s", events);
+    for (name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+      int ev = findEvent(name);
+      if (ev < 0) {
+        errx(1, "Unknown perf event '%s' (known: %s)", name, pc_event_names());
+      }
+      if (counters->nextra == PC_MAX_EXTRA) {
+        errx(1, "At most %d extra perf events", PC_MAX_EXTRA);
+      }
+      extra[counters->nextra] = ev;
+      counters->extra[counters->nextra].name = eventTable[ev].name;
+      counters->extra[counters->nextra].fd = -1;
+      counters->nextra++;
+    }
+  }
+
+  int excludeKernel = 0;
+  counters->cycles.fd = openEvent(findEvent("cycles"), pid, -1, excludeKernel);
+  if (counters->cycles.fd < 0 && (errno == EACCES || errno == EPERM)) {
+    excludeKernel = 1;
+    counters->cycles.fd = openEvent(findEvent("cycles"), pid, -1, excludeKernel);
   }
-
-  // Set more options
-  counters->cycles.attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
-  counters->l1_misses.attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
-  counters->ic.attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
-
-  // do not start immediately after perf_event_open()
-  counters->cycles.attr.disabled = 1;
-  counters->l1_misses.attr.disabled = 1;
-  counters->ic.attr.disabled = 1;
-
-  // Open the counters
-  counters->cycles.fd = perf_event_open(&counters->cycles.attr, pid, -1, -1, 0);
   if (counters->cycles.fd < 0) {
-    err(1, "Cycle: cannot create event");
+    fprintf(stderr, "Hardware counters unavailable (%s); cycles are estimated from the wall clock\n",
+            strerror(errno));
+    counters->estimated = 1;
+    return;
   }
+  counters->order[counters->nr++] = &counters->cycles;
 
-  counters->l1_misses.fd = perf_event_open(&counters->l1_misses.attr, pid, -1, -1, 0);
-  if (counters->l1_misses.fd < 0) {
-    err(1, "L1 miss: cannot create event");
+  addEvent(counters, &counters->l1_misses, findEvent("l1d-misses"), pid, excludeKernel);
+  addEvent(counters, &counters->ic, findEvent("instructions"), pid, excludeKernel);
+  for (int k = 0; k < counters->nextra; k++) {
+    addEvent(counters, &counters->extra[k], extra[k], pid, excludeKernel);
   }
-
-  counters->ic.fd = perf_event_open(&counters->ic.attr, pid, -1, -1, 0);
-  if (counters->ic.fd < 0) {
-    err(1, "Instruction count: cannot create event");
-  }
-  return;
-#endif
 }
 
 void pc_start(counters_t *counters)
@@ -106,82 +148,70 @@ void pc_start(counters_t *counters)
   counters->cycles.count = 0;
   counters->l1_misses.count = 0;
   counters->ic.count = 0;
-
-#ifndef __arm__
-  return;
-
-#else
-  int ret;
-  ret = ioctl(counters->cycles.fd, PERF_EVENT_IOC_RESET, 0);
-  if (ret) {
-    err(1, "ioctl(reset) failed");
-  }
-
-  ret = ioctl(counters->l1_misses.fd, PERF_EVENT_IOC_RESET, 0);
-  if (ret) {
-    err(1, "ioctl(reset) failed");
+  for (int k = 0; k < counters->nextra; k++) {
+    counters->extra[k].count = 0;
   }
 
-  ret = ioctl(counters->ic.fd, PERF_EVENT_IOC_RESET, 0);
-  if (ret) {
-    err(1, "ioctl(reset) failed");
+  if (counters->estimated) {
+    counters->t_start = pc_now_ns();
+    return;
   }
-
-  ret = ioctl(counters->cycles.fd, PERF_EVENT_IOC_ENABLE, 0);
-  if (ret) {
+  if (ioctl(counters->cycles.fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP)) {
     err(1, "ioctl(enable) failed");
   }
-
-  ret = ioctl(counters->l1_misses.fd, PERF_EVENT_IOC_ENABLE, 0);
-  if (ret) {
-    err(1, "ioctl(enable) failed");
-  }
-
-  ret = ioctl(counters->ic.fd, PERF_EVENT_IOC_ENABLE, 0);
-  if (ret) {
-    err(1, "ioctl(enable) failed");
-  }
-  return;
-#endif
 }
 
+/*******************************************
+ * Model: pc_stop
+ * Input: counters
+ * Output: None directly. Sets count (and adds to total) for every counter
+ * Desc: One ioctl stops the group and one read returns every value plus
+ *  the group's enabled/running times, which scale the window if the
+ *  kernel had to multiplex the PMU.
+ ********************************************/
 void pc_stop(counters_t *counters)
 {
-#ifndef __arm__
-  return;
-#else
-  ioctl(counters->cycles.fd, PERF_EVENT_IOC_DISABLE, 0);
-  ioctl(counters->l1_misses.fd, PERF_EVENT_IOC_DISABLE, 0);
-  ioctl(counters->ic.fd, PERF_EVENT_IOC_DISABLE, 0);
-
-  read(counters->cycles.fd, counters->cycles.values, sizeof(counters->cycles.values));
-  read(counters->l1_misses.fd, counters->l1_misses.values, sizeof(counters->l1_misses.values));
-  read(counters->ic.fd, counters->ic.values, sizeof(counters->ic.values));
-
-  if (counters->cycles.values[2]) {
-    counters->cycles.count = (uint64_t)((double)counters->cycles.values[0] *
-		     counters->cycles.values[1]/counters->cycles.values[2]);
-  }
-  else {
-    counters->cycles.count = (uint64_t)counters->cycles.values[0];
+  if (counters->estimated) {
+    uint64_t ns = pc_now_ns() - counters->t_start;
+    counters->cycles.count = (uint64_t)(ns * (PROC_FREQ / 1e9));
+    counters->cycles.total += counters->cycles.count;
+    return;
+  }
+
+  // nr, time_enabled, time_running, then one value per event
+  uint64_t buf[3 + 3 + PC_MAX_EXTRA];
+  ioctl(counters->cycles.fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  if (read(counters->cycles.fd, buf, sizeof(buf)) < (ssize_t)((3 + counters->nr) * sizeof(uint64_t))) {
+    err(1, "read(counters) failed");
+  }
+
+  uint64_t enabled = buf[1] - counters->enabled;
+  uint64_t running = buf[2] - counters->running;
+  counters->enabled = buf[1];
+  counters->running = buf[2];
+  for (int k = 0; k < counters->nr; k++) {
+    perf_counter_t *pc = counters->order[k];
+    uint64_t delta = buf[3 + k] - pc->last;
+    pc->last = buf[3 + k];
+    if (running && running < enabled) {
+      delta = (uint64_t)((double)delta * enabled / running);
+    }
+    pc->count = delta;
+    pc->total += delta;
   }
+}
 
-  if (counters->l1_misses.values[2]) {
-    counters->l1_misses.count = (uint64_t)
-      ((double)counters->l1_misses.values[0] *
-       counters->l1_misses.values[1]/counters->l1_misses.values[2]);
-  }
-  else {
-    counters->l1_misses.count = (uint64_t)counters->l1_misses.values[0];
+void pc_close(counters_t *counters)
+{
+  for (int k = counters->nr - 1; k >= 0; k--) {
+    close(counters->order[k]->fd);
   }
+  counters->nr = 0;
+}
 
-  if (counters->ic.values[2]) {
-    counters->ic.count = (uint64_t)((double)counters->ic.values[0] * 
-			    counters->ic.values[1]/counters->ic.values[2]);
-  }
-  else {
-    counters->ic.count = (uint64_t)counters->ic.values[0];
-  }
-  return;
-#endif
+uint64_t pc_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
 }
@@ -1,31 +1,49 @@
 #ifndef PERF_COUNTER_H
  #define PERF_COUNTER_H
 
-  #ifdef __arm__
-    #include <perfmon/pfmlib.h>
-    #include <perfmon/pfmlib_perf_event.h>
-  #else
-struct pfm_perf_encode_arg_t{};
-struct perf_event_attr{};
-typedef unsigned long uint64_t;
-  #endif
+#include <stdint.h>
+
+// Events beyond the three fixed ones that -e may add to the group
+#define PC_MAX_EXTRA 4
 
 struct perf_counter_t{
-  struct perf_event_attr attr;
-  pfm_perf_encode_arg_t arg;
-  int fd;
-  uint64_t count, values[3];
+  const char *name;
+  int fd;           // -1 when the event could not be opened
+  uint64_t count;   // value over the last pc_start/pc_stop window
+  uint64_t total;   // sum of every window since pc_init
+  uint64_t last;    // raw group value at the previous pc_stop
 };
 
+// All counters are opened as one perf_event group led by `cycles`, so the
+// whole set is enabled with one ioctl and read back with one read().
+// Counters are never reset: each window is the difference between two
+// group reads. If the group cannot be opened at all (no PMU, or
+// perf_event_paranoid too strict), `estimated` is set and cycles are
+// derived from the wall clock at PROC_FREQ instead.
 struct counters_t{
   perf_counter_t cycles;
   perf_counter_t l1_misses;
   perf_counter_t ic;
+  perf_counter_t extra[PC_MAX_EXTRA];
+  int nextra;
+  int estimated;
+  int nr;                                   // events in the group
+  perf_counter_t *order[3 + PC_MAX_EXTRA];  // group read order
+  uint64_t enabled, running;                // group times at the last read
+  uint64_t t_start;                         // wall clock, when estimated
 };
 
 
-void pc_init(counters_t *counters, int pid);
+// `events` is a comma-separated list of extra events (see pc_event_names),
+// or NULL for just cycles, L1 misses and instructions
+void pc_init(counters_t *counters, int pid, const char *events);
 void pc_start(counters_t *counters);
 void pc_stop(counters_t *counters);
+void pc_close(counters_t *counters);
+// Names accepted in the -e list, comma separated
+const char *pc_event_names(void);
+
+// Monotonic wall-clock time in nanoseconds
+uint64_t pc_now_ns(void);
 
 #endif
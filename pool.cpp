@@ -0,0 +1,200 @@
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <err.h>
+#include "trace.h"
+#include "affinity.h"
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Spins before a worker gives up its core and sleeps on the job futex
+#define POOL_SPIN 4096
+
+static inline uint64_t packCursor(uint32_t job, int next, int end)
+{
+  return ((uint64_t)job << 32) | ((uint64_t)next << 16) | (uint64_t)end;
+}
+
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+static void futexWait(std::atomic<uint32_t> *addr, uint32_t val)
+{
+  syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futexWake(std::atomic<uint32_t> *addr)
+{
+  syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+// Claims one task from slot `victim` for job `job`, or returns -1
+static int claim(pool_slot_t *victim, uint32_t job)
+{
+  uint64_t c = victim->cursor.load(std::memory_order_acquire);
+  while (1) {
+    int next = (c >> 16) & 0xffff;
+    int end = c & 0xffff;
+    if ((uint32_t)(c >> 32) != job || next >= end) {
+      return -1;
+    }
+    if (victim->cursor.compare_exchange_weak(c, c + (1 << 16),
+                                             std::memory_order_acq_rel)) {
+      return next;
+    }
+  }
+}
+
+/*******************************************
+ * Model: runTasks
+ * Input: pool, worker index, job tag
+ * Output: None
+ * Desc: Drains this worker's own slice, then steals from the other workers'
+ *  slices in turn until no task of `job` is left.
+ ********************************************/
+static void runTasks(pool_t *pool, int self, uint32_t job)
+{
+  pool_fn fn = pool->fn.load(std::memory_order_acquire);
+  void *arg = pool->arg.load(std::memory_order_acquire);
+  int n = pool->nthreads;
+
+  for (int k = 0; k < n; k++) {
+    pool_slot_t *victim = &pool->slots[(self + k) % n];
+    int task;
+    while ((task = claim(victim, job)) >= 0) {
+      // Tasks taken from another worker's slice show up as steals
+      const char *span = k ? "steal" : "task";
+      TRACE_BEGIN(span);
+      fn(arg, task);
+      TRACE_END(span);
+      pool->remaining.fetch_sub(1, std::memory_order_acq_rel);
+    }
+  }
+}
+
+static void *workerMain(void *ptr)
+{
+  pool_slot_t *slot = (pool_slot_t *)ptr;
+  pool_t *pool = slot->pool;
+  uint32_t seen = 0;
+
+  if (trace_on) {
+    char name[32];
+    snprintf(name, sizeof(name), "pool worker %d", slot->self);
+    trace_thread_name(name);
+  }
+  AFFINITY_THREAD(AFF_COMPUTE, slot->self);
+
+  while (1) {
+    // Wait for a new job: spin briefly, then sleep on the job word
+    uint32_t job;
+    int spins = 0;
+    TRACE_BEGIN("idle");
+    while ((job = pool->job.load(std::memory_order_acquire)) == seen) {
+      if (++spins < POOL_SPIN) {
+        cpuRelax();
+        continue;
+      }
+      pool->sleepers.fetch_add(1, std::memory_order_seq_cst);
+      if (pool->job.load(std::memory_order_seq_cst) == seen) {
+        futexWait(&pool->job, seen);
+      }
+      pool->sleepers.fetch_sub(1, std::memory_order_relaxed);
+      spins = 0;
+    }
+    TRACE_END("idle");
+    seen = job;
+    if (pool->shutdown.load(std::memory_order_acquire)) {
+      break;
+    }
+    runTasks(pool, slot->self, job);
+  }
+  return NULL;
+}
+
+void pool_init(pool_t *pool, int nthreads)
+{
+  if (nthreads < 1 || nthreads > POOL_MAX_THREADS) {
+    errx(1, "pool_init: invalid thread count %d", nthreads);
+  }
+  pool->nthreads = nthreads;
+  pool->job.store(0);
+  pool->fn.store(NULL);
+  pool->arg.store(NULL);
+  pool->sleepers.store(0);
+  pool->shutdown.store(0);
+  pool->remaining.store(0);
+  for (int k = 0; k < nthreads; k++) {
+    pool->slots[k].cursor.store(0);
+    pool->slots[k].pool = pool;
+    pool->slots[k].self = k;
+  }
+
+  for (int k = 1; k < nthreads; k++) {
+    int ret = pthread_create(&pool->slots[k].thread, NULL, workerMain, &pool->slots[k]);
+    if (ret) {
+      errx(1, "Thread creation failed: %d", ret);
+    }
+  }
+}
+
+/*******************************************
+ * Model: pool_run
+ * Input: pool, task function and argument, number of tasks
+ * Output: None
+ * Desc: Hands each worker a contiguous slice of the task indices, wakes
+ *  the pool, works through the tasks itself, and returns once the
+ *  `remaining` counter reaches zero.
+ ********************************************/
+void pool_run(pool_t *pool, pool_fn fn, void *arg, int ntasks)
+{
+  int n = pool->nthreads;
+  if (ntasks <= 0) {
+    return;
+  }
+  if (ntasks > 0xffff) {
+    errx(1, "pool_run: too many tasks (%d)", ntasks);
+  }
+
+  uint32_t job = pool->job.load(std::memory_order_relaxed) + 1;
+  pool->fn.store(fn, std::memory_order_relaxed);
+  pool->arg.store(arg, std::memory_order_relaxed);
+  pool->remaining.store(ntasks, std::memory_order_relaxed);
+  for (int k = 0; k < n; k++) {
+    int start = (int)((long)ntasks * k / n);
+    int end = (int)((long)ntasks * (k+1) / n);
+    pool->slots[k].cursor.store(packCursor(job, start, end), std::memory_order_relaxed);
+  }
+  pool->job.store(job, std::memory_order_seq_cst);
+  if (pool->sleepers.load(std::memory_order_seq_cst) > 0) {
+    futexWake(&pool->job);
+  }
+
+  runTasks(pool, 0, job);
+
+  // Stragglers are typically mid-task; yield rather than burn their core
+  TRACE_BEGIN("wait workers");
+  while (pool->remaining.load(std::memory_order_acquire) > 0) {
+    sched_yield();
+  }
+  TRACE_END("wait workers");
+}
+
+void pool_destroy(pool_t *pool)
+{
+  pool->shutdown.store(1, std::memory_order_release);
+  pool->job.fetch_add(1, std::memory_order_seq_cst);
+  futexWake(&pool->job);
+  for (int k = 1; k < pool->nthreads; k++) {
+    pthread_join(pool->slots[k].thread, NULL);
+  }
+}
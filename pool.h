@@ -0,0 +1,50 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+
+#define POOL_MAX_THREADS 64
+#define POOL_CACHE_LINE 64
+
+// Runs task `task` (0..ntasks-1) of the current job
+typedef void (*pool_fn)(void *arg, int task);
+
+// Each worker owns a contiguous slice of the job's task indices, packed into
+// one 64-bit word: job tag (32) | next (16) | end (16). Owners and thieves
+// both claim with the same CAS, and the tag keeps a worker that is still
+// looking at an old job from claiming tasks of the next one.
+struct pool_t;
+struct pool_slot_t {
+  std::atomic<uint64_t> cursor;
+  pthread_t thread;
+  pool_t *pool;
+  int self;
+} __attribute__((aligned(POOL_CACHE_LINE)));
+
+struct pool_t {
+  pool_slot_t slots[POOL_MAX_THREADS];
+  int nthreads;
+
+  // Current job. `job` is the futex word workers sleep on; it is bumped
+  // once per pool_run after fn/arg and the cursors are in place.
+  std::atomic<uint32_t> job __attribute__((aligned(POOL_CACHE_LINE)));
+  std::atomic<pool_fn> fn;
+  std::atomic<void *> arg;
+  std::atomic<int> sleepers;
+  std::atomic<int> shutdown;
+
+  // Per-job completion: tasks left to finish
+  std::atomic<int> remaining __attribute__((aligned(POOL_CACHE_LINE)));
+};
+
+// Starts nthreads-1 persistent workers; the thread calling pool_run acts
+// as worker 0.
+void pool_init(pool_t *pool, int nthreads);
+// Runs fn(arg, 0..ntasks-1) across the pool and returns when all are done.
+// Only one thread may call pool_run on a given pool at a time.
+void pool_run(pool_t *pool, pool_fn fn, void *arg, int ntasks);
+void pool_destroy(pool_t *pool);
+
+#endif
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+#include <err.h>
+#include <atomic>
+#include <new>
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include "sobel_alg.h"
+#include "frame_source.h"
+#include "frame_pool.h"
+#include "spsc.h"
+#include "trace.h"
+#include "affinity.h"
+
+using namespace cv;
+
+// Frames per segment. Segments are dealt round-robin to the decoders, so
+// while the consumer reads segment s, decoders s+1..s+N-1 fill theirs.
+// About one second of video: long enough that the seek at each segment
+// start (which decodes forward from the previous keyframe) stays cheap.
+#define SEG_FRAMES 30
+// Each decoder may finish its next segment while its current one is
+// still being read, plus a few frames of slack
+#define SEG_BUFFERS (SEG_FRAMES + 4)
+#define MAX_DECODERS 16
+
+struct decoder_t {
+  pthread_t thread;
+  int self;
+  struct segment_state *st;
+  frame_pool_t pool;
+  // Decoded frames in order; NULL closes a segment
+  spsc_ring<frame_buf_t *, 64> ring;
+};
+
+struct segment_state {
+  const char *path;
+  int ndecoders;
+  int limit;             // frames to decode in total
+  std::atomic<int> stop;
+  decoder_t dec[MAX_DECODERS];
+  int seg;               // segment being read
+  int segFrames;         // frames read from it so far
+  int ended;             // a segment came back empty: the file is done
+  frame_buf_t *current;  // frame handed out by the last read
+};
+
+// Pushes unless the source is closing; returns 0 if it is
+static int pushFrame(decoder_t *d, frame_buf_t *buf)
+{
+  while (!d->ring.push(buf)) {
+    if (d->st->stop.load(std::memory_order_acquire)) {
+      if (buf) {
+        fbuf_unref(buf);
+      }
+      return 0;
+    }
+    sched_yield();
+  }
+  return 1;
+}
+
+/*******************************************
+ * Model: decoderMain
+ * Input: decoder_t* for this thread
+ * Output: None
+ * Desc: Decodes segments self, self+N, self+2N, ... with its own capture
+ *  handle, seeking to each segment's first frame.
+ ********************************************/
+static void *decoderMain(void *ptr)
+{
+  decoder_t *d = (decoder_t *)ptr;
+  segment_state *st = d->st;
+  int pos = 0;
+
+  if (trace_on) {
+    char name[32];
+    snprintf(name, sizeof(name), "decoder %d", d->self);
+    trace_thread_name(name);
+  }
+  AFFINITY_THREAD(AFF_CAPTURE, d->self + 1);
+  CvCapture *cap = cvCreateFileCapture(st->path);
+  if (cap == NULL) {
+    errx(1, "Cannot open video source %s", st->path);
+  }
+
+  for (int seg = d->self; seg * SEG_FRAMES < st->limit; seg += st->ndecoders) {
+    int start = seg * SEG_FRAMES;
+    int end = start + SEG_FRAMES < st->limit ? start + SEG_FRAMES : st->limit;
+    if (pos != start) {
+      cvSetCaptureProperty(cap, CV_CAP_PROP_POS_FRAMES, start);
+      pos = start;
+    }
+    TRACE_BEGIN("decode segment");
+    for (; pos < end; pos++) {
+      if (st->stop.load(std::memory_order_acquire)) {
+        TRACE_END("decode segment");
+        cvReleaseCapture(&cap);
+        return NULL;
+      }
+      IplImage *img = cvQueryFrame(cap);
+      if (img == NULL) {
+        break;
+      }
+      frame_buf_t *buf = fpool_get(&d->pool);
+      Mat dst = buf->mat;
+      Mat(img).copyTo(dst);
+      if (!pushFrame(d, buf)) {
+        break;
+      }
+    }
+    TRACE_END("decode segment");
+    if (!pushFrame(d, NULL)) {
+      break;
+    }
+  }
+  cvReleaseCapture(&cap);
+  return NULL;
+}
+
+// Reads the segments in order: all of segment s from decoder s % N, then
+// s+1. An empty segment means the file ended early.
+static int segmentRead(frame_source_t *src, Mat& frame)
+{
+  segment_state *st = (segment_state *)src->state;
+  if (st->current) {
+    fbuf_unref(st->current);
+    st->current = NULL;
+  }
+
+  while (!st->ended && st->seg * SEG_FRAMES < st->limit) {
+    decoder_t *d = &st->dec[st->seg % st->ndecoders];
+    frame_buf_t *buf;
+    TRACE_BEGIN("wait decoder");
+    d->ring.popWait(buf);
+    TRACE_END("wait decoder");
+    if (buf) {
+      st->segFrames++;
+      st->current = buf;
+      frame = buf->mat;
+      return 1;
+    }
+    if (st->segFrames == 0) {
+      st->ended = 1;
+      break;
+    }
+    st->seg++;
+    st->segFrames = 0;
+  }
+  return 0;
+}
+
+static void segmentClose(frame_source_t *src)
+{
+  segment_state *st = (segment_state *)src->state;
+  st->stop.store(1, std::memory_order_release);
+  if (st->current) {
+    fbuf_unref(st->current);
+  }
+  // Free whatever is queued so a decoder blocked on its pool can see stop
+  for (int k = 0; k < st->ndecoders; k++) {
+    frame_buf_t *buf;
+    while (st->dec[k].ring.pop(buf)) {
+      if (buf) {
+        fbuf_unref(buf);
+      }
+    }
+  }
+  for (int k = 0; k < st->ndecoders; k++) {
+    pthread_join(st->dec[k].thread, NULL);
+    fpool_destroy(&st->dec[k].pool);
+  }
+  st->~segment_state();
+  free(st);
+}
+
+/*******************************************
+ * Model: openSegmentedSource
+ * Input: video file path, number of decoder threads
+ * Output: frame source that yields the file's frames in order
+ * Desc: Splits the first opts.numFrames frames of the file into
+ *  SEG_FRAMES-long segments and decodes them on `ndecoders` threads. A
+ *  probe capture reads the geometry and frame count first; without a
+ *  frame count the file cannot be split and the caller falls back to a
+ *  single decoder.
+ ********************************************/
+frame_source_t *openSegmentedSource(const char *path, int ndecoders)
+{
+  CvCapture *probe = cvCreateFileCapture(path);
+  if (probe == NULL) {
+    errx(1, "Cannot open video source %s", path);
+  }
+  int count = (int)cvGetCaptureProperty(probe, CV_CAP_PROP_FRAME_COUNT);
+  IplImage *first = cvQueryFrame(probe);
+  if (first == NULL) {
+    errx(1, "No frames could be read from the video source");
+  }
+  int width = first->width, height = first->height;
+  cvReleaseCapture(&probe);
+  if (count <= 0) {
+    return NULL;
+  }
+  if (ndecoders > MAX_DECODERS) {
+    ndecoders = MAX_DECODERS;
+  }
+
+  // The rings are cache-line aligned, which plain new does not honour
+  void *mem;
+  if (posix_memalign(&mem, 64, sizeof(segment_state))) {
+    errx(1, "openSegmentedSource: out of memory");
+  }
+  segment_state *st = new (mem) segment_state;
+  st->path = path;
+  st->ndecoders = ndecoders;
+  st->limit = count < opts.numFrames ? count : opts.numFrames;
+  st->stop.store(0);
+  st->seg = 0;
+  st->segFrames = 0;
+  st->ended = 0;
+  st->current = NULL;
+  for (int k = 0; k < ndecoders; k++) {
+    decoder_t *d = &st->dec[k];
+    d->self = k;
+    d->st = st;
+    fpool_init(&d->pool, SEG_BUFFERS, height, width, CV_8UC3, opts.hugepages);
+    int ret = pthread_create(&d->thread, NULL, decoderMain, d);
+    if (ret) {
+      errx(1, "Thread creation failed: %d", ret);
+    }
+  }
+
+  frame_source_t *src = new frame_source_t;
+  src->name = "file (segmented)";
+  src->width = width;
+  src->height = height;
+  src->type = CV_8UC3;
+  src->persistent = 0;
+  src->read = segmentRead;
+  src->close = segmentClose;
+  src->state = st;
+  return src;
+}
@@ -12,26 +12,49 @@
 #include <locale.h>
 #include <err.h>
 
-#define IMG_WIDTH 640
-#define IMG_HEIGHT 480
-#define STEP0 1920
-#define STEP1 3
+#include "pool.h"
+
+// Resolution requested from the camera or decoder. Only a hint: buffers
+// and kernels follow whatever size the first frame actually has.
+#define CAPTURE_WIDTH 640
+#define CAPTURE_HEIGHT 480
 #define PROC_FREQ 866000000
 #define PROC_EPC 1.4
 #define NCORES 1
 
+// Upper bound for -t
+#define MAX_THREADS POOL_MAX_THREADS
+// Row bands handed to the pool per thread and per frame, and their minimum
+// height
+#define TILES_PER_THREAD 4
+#define MIN_TILE_ROWS 16
+#define MAX_TILES (MAX_THREADS*TILES_PER_THREAD)
+// Frames processed before the steady-state allocation count starts
+#define WARMUP_FRAMES 2
+// Bytes per row of a 1-bit edge map (sobelEdgeRows)
+#define EDGE_BYTES(cols) (((cols) + 7) / 8)
+// Inputs in multi-stream mode (several -f/-w), and the largest -W weight
+#define MAX_STREAMS 16
+#define MAX_STREAM_WEIGHT 100
+
 using namespace cv;
 using namespace std;
 
-//This mutex will be used to allow threads to contest for thread 0 status
-extern pthread_barrier_t endSobel;
-extern pthread_mutex_t thread0;
-extern pthread_t thread0_id;
+struct incr_t;
+struct frame_stats;
 
-extern pthread_barrier_t capReady;
-extern pthread_barrier_t srcReady;
-extern pthread_barrier_t grayReady;
-extern pthread_barrier_t sobelReady;
+// A band of output rows [rowStart, rowEnd)
+struct tile {
+  int rowStart;
+  int rowEnd;
+};
+
+// One multi-stream input: a file, or a camera number when videoFile is NULL
+struct stream_spec {
+  char *videoFile;
+  int camera;
+  int weight;
+};
 
 // Commandline options
 struct opts {
@@ -39,15 +62,66 @@ struct opts {
   int webcam;
   int numFrames;
   int multiThreaded;
+  char *isa;
+  int fused;
+  int numThreads;
+  int pipelined;
+  int offline;
+  int decoders;
+  int hugepages;
+  int headless;
+  int preload;
+  int synthWidth;
+  int synthHeight;
+  char *dumpFile;
+  int dumpGray;
+  char *replayFile;
+  char *events;
+  char *traceFile;
+  char *yuvFormat;
+  int yuvWidth;
+  int yuvHeight;
+  int incremental;
+  int incrThreshold;
+  char *outputSpec;
+  int outputPolicy;
+  int numStreams;
+  struct stream_spec streams[MAX_STREAMS];
+  int deadlineUs;
+  int edgeThreshold;
+  int edgeNms;
+  int statsTileW;
+  int statsTileH;
+  int statsThreshold;
 };
 
 extern struct opts opts;
 
 void sobelCalc(Mat& img_gray, Mat& img_sobel_out);
+void sobelFused(Mat& img, Mat& img_sobel_out);
+void splitRows(int rows, int n, struct tile *tiles);
+void grayScaleRows(Mat& img, Mat& img_gray_out, int rowStart, int rowEnd);
+void sobelCalcRows(Mat& img_gray, Mat& img_sobel_out, int rowStart, int rowEnd, frame_stats *stats);
+void sobelCalcRect(Mat& img_gray, Mat& img_sobel_out, int x0, int x1, int y0, int y1);
+void sobelFusedRows(Mat& img, Mat& img_sobel_out, int rowStart, int rowEnd, frame_stats *stats);
+void sobelEdgeRows(Mat& img_gray, Mat& img_edges, int rowStart, int rowEnd, int threshold, int nms,
+                   frame_stats *stats);
+void sobelEdge(Mat& img_gray, Mat& img_edges, int threshold, int nms);
+void edgeUnpack(const Mat& img_edges, Mat& img_out);
 void grayScale(Mat& img, Mat& img_gray_out);
 void grayScale_mt(Mat& img, Mat& img_gray_out, int start);
 void sobelCalc_mt(Mat& img_gray, Mat& img_sobel_out, int start);
 
+void grayScaleMT(pool_t *pool, Mat& img, Mat& img_gray_out);
+void sobelMT(pool_t *pool, Mat& img_gray, Mat& img_sobel_out);
+void sobelFusedMT(pool_t *pool, Mat& img, Mat& img_sobel_out);
+void sobelEdgeMT(pool_t *pool, Mat& img_gray, Mat& img_edges, int threshold, int nms);
+void sobelIncrementalMT(pool_t *pool, incr_t *inc, Mat& img_gray, Mat& img_sobel_out);
+
 void runSobelST();
-void *runSobelMT(void *ptr);
+void runSobelMT(pool_t *pool);
+void runSobelPipe(pool_t *pool);
+void runSobelOffline(int nworkers);
+void runSobelMulti(pool_t *pool);
+void runSobelRT(pool_t *pool);
 #endif
@@ -1,108 +1,513 @@
 #include "opencv2/imgproc/imgproc.hpp"
 #include "sobel_alg.h"
-#include "arm_neon.h"
+#include "sobel_kernels.h"
+#include "frame_stats.h"
 using namespace cv;
 
+const struct sobel_kernels *kernels = &sobel_kernels_scalar;
+
+// 640x480, 1280x720, 1920x1080, 3840x2160
+const int sobel_fixed_widths[SOBEL_NUM_FIXED] = {640, 1280, 1920, 3840};
+
+const struct conv_op conv_ops[CONV_NUM_OPS] = {
+  {"sobel", 1}, {"scharr", 1}, {"prewitt", 1}, {"sobel5", 2},
+};
+int convOp = CONV_SOBEL, convMag = CONV_L1;
+
+// The hand-written sobelRow covers the default operator
+static inline int useConv()
+{
+  return convOp != CONV_SOBEL || convMag != CONV_L1;
+}
+
+static int always()
+{
+  return 1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static int haveAvx512()
+{
+  return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+}
+
+static int haveAvx2()
+{
+  return __builtin_cpu_supports("avx2");
+}
+
+static int haveSse2()
+{
+  return __builtin_cpu_supports("sse2");
+}
+#endif
+
+// Candidate backends, widest first. Each entry is only taken if the CPU
+// reports the features it was compiled for.
+static const struct {
+  const struct sobel_kernels *table;
+  int (*supported)();
+} backends[] = {
+#if defined(__x86_64__) || defined(__i386__)
+  {&sobel_kernels_avx512, haveAvx512},
+  {&sobel_kernels_avx2, haveAvx2},
+  {&sobel_kernels_sse2, haveSse2},
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  // Built with -mfpu=neon, so the rest of the binary already assumes NEON.
+  {&sobel_kernels_neon, always},
+#endif
+  {&sobel_kernels_scalar, always},
+};
+
 /*******************************************
- * Model: grayScale
- * Input: Mat img
- * Output: None directly. Modifies a ref parameter img_gray_out
- * Desc: This module converts the image to grayscale
+ * Model: selectKernels
+ * Input: backend name, or NULL to pick automatically
+ * Output: the chosen kernel table, or NULL if `name` can't run here
+ * Desc: Runtime CPU dispatch for the grayscale and Sobel kernels.
  ********************************************/
-void grayScale(Mat& img, Mat& img_gray_out)
+const struct sobel_kernels *selectKernels(const char *name)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+#endif
+  for (unsigned i = 0; i < sizeof(backends)/sizeof(backends[0]); i++) {
+    if (name != NULL && strcmp(name, backends[i].table->name) != 0) {
+      continue;
+    }
+    if (backends[i].supported()) {
+      return backends[i].table;
+    }
+    if (name != NULL) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+gray_row_fn grayRowFor(int width)
 {
-  unsigned img_len = img.rows * img.cols;
-  
-  uint8x8x3_t rgbs;
-  for (unsigned i = 0; i < img_len/8; i++) {
+  for (int k = 0; k < SOBEL_NUM_FIXED; k++) {
+    if (width == sobel_fixed_widths[k]) {
+      return kernels->grayRowFixed[k];
+    }
+  }
+  return kernels->grayRow;
+}
 
-    rgbs = vld3_u8(img.data+i*3*8);
+sobel_row_fn sobelRowFor(int width)
+{
+  for (int k = 0; k < SOBEL_NUM_FIXED; k++) {
+    if (width == sobel_fixed_widths[k]) {
+      return kernels->sobelRowFixed[k];
+    }
+  }
+  return kernels->sobelRow;
+}
 
-    uint16x8_t rs = vmovl_u8(rgbs.val[0]);
-    uint16x8_t gs = vmovl_u8(rgbs.val[1]);
-    uint16x8_t bs = vmovl_u8(rgbs.val[2]);
+/*******************************************
+ * Model: splitRows
+ * Input: frame height, number of bands
+ * Output: None directly. Fills tiles[0..n)
+ * Desc: Cuts the frame into n contiguous row bands of near-equal height.
+ *  The band kernels below read their one-row halos straight from the
+ *  source, so bands never depend on each other.
+ ********************************************/
+void splitRows(int rows, int n, struct tile *tiles)
+{
+  for (int k = 0; k < n; k++) {
+    tiles[k].rowStart = (int)((long)rows * k / n);
+    tiles[k].rowEnd = (int)((long)rows * (k+1) / n);
+  }
+}
 
-    rs = vmulq_n_u16(rs, 29);
-    gs = vmulq_n_u16(gs, 150);
-    bs = vmulq_n_u16(bs, 76);
+/*******************************************
+ * Model: grayScaleRows
+ * Input: Mat img, row range [rowStart, rowEnd)
+ * Output: None directly. Modifies a ref parameter img_gray_out
+ * Desc: Converts the given rows of the image to grayscale
+ ********************************************/
+void grayScaleRows(Mat& img, Mat& img_gray_out, int rowStart, int rowEnd)
+{
+  gray_row_fn grayRow = grayRowFor(img.cols);
 
-    rs = vshrq_n_u16(rs, 8);
-    gs = vshrq_n_u16(gs, 8);
-    bs = vshrq_n_u16(bs, 8);
+  for (int i = rowStart; i < rowEnd; i++) {
+    grayRow(img.ptr(i), img_gray_out.ptr(i), img.cols);
+  }
+}
 
-    uint16x8_t color = vaddq_u16(rs, gs);
-    color = vaddq_u16(color, bs);
+/*******************************************
+ * Model: sobelCalcRows
+ * Input: Mat img_gray, row range [rowStart, rowEnd)
+ * Output: None directly. Modifies a ref parameter img_sobel_out
+ * Desc: Sobel (or the -k operator, of radius R) for the given output
+ *  rows. Reads R gray rows on either side as halos, so those must already
+ *  be converted. The R rows at the top and bottom of the frame have no
+ *  full neighbourhood and are written as 0. With stats, each row is also
+ *  added to them as soon as it is written.
+ ********************************************/
+void sobelCalcRows(Mat& img_gray, Mat& img_sobel_out, int rowStart, int rowEnd, frame_stats *stats)
+{
+  int rows = img_gray.rows;
+  int cols = img_gray.cols;
+  sobel_row_fn sobelRow = sobelRowFor(cols);
+  conv_row_fn convRow = kernels->convRow[convOp][convMag];
+  int conv = useConv();
+  int R = conv_ops[convOp].radius;
+  const uint8_t *win[CONV_MAX_TAPS];
+  stats_band band;
 
-    vst1_u8(img_gray_out.data+i*8, vmovn_u16(color));
+  if (stats) {
+    stats_band_begin(&band, stats);
+  }
+  for (int i = rowStart; i < rowEnd; i++) {
+    if (i < R || i >= rows-R) {
+      memset(img_sobel_out.ptr(i), 0, cols);
+    } else if (conv) {
+      for (int k = 0; k <= 2*R; k++) {
+        win[k] = img_gray.ptr(i-R+k);
+      }
+      convRow(win, img_sobel_out.ptr(i), cols);
+    } else {
+      sobelRow(img_gray.ptr(i-1), img_gray.ptr(i), img_gray.ptr(i+1),
+               img_sobel_out.ptr(i), cols);
+    }
+    if (stats) {
+      stats_band_row(&band, img_sobel_out.ptr(i), i);
+    }
+  }
+  if (stats) {
+    stats_band_end(&band);
   }
 }
 
+// sobelCalcRect works through each row in chunks of this many output
+// pixels, staged in a stack line so the kernels' zeroed window ends never
+// land on pixels outside the rectangle
+#define RECT_CHUNK 256
+
 /*******************************************
- * Model: sobelCalc
- * Input: Mat img_in
+ * Model: sobelCalcRect
+ * Input: Mat img_gray, output rectangle [x0, x1) x [y0, y1)
  * Output: None directly. Modifies a ref parameter img_sobel_out
- * Desc: This module performs a sobel calculation on an image. It first
- *  converts the image to grayscale, calculates the gradient in the x
- *  direction, calculates the gradient in the y direction and sum it with Gx
- *  to finish the Sobel calculation
+ * Desc: sobelCalcRows restricted to a rectangle. Every pixel written has
+ *  the same value the whole-frame pass gives it, and nothing outside the
+ *  rectangle is touched, so rectangles can be recomputed in parallel
+ *  into a frame whose other pixels are kept from earlier frames.
  ********************************************/
-void sobelCalc(Mat& img_gray, Mat& img_sobel_out)
+void sobelCalcRect(Mat& img_gray, Mat& img_sobel_out, int x0, int x1, int y0, int y1)
 {
-  for (int i=1; i<img_gray.rows; i++) {
-    for (int j=0; j<img_gray.cols; j += 8) {
-      uint8x8_t upper_left = vld1_u8(img_gray.data+IMG_WIDTH*(i-1)+(j));
-      int16x8_t upper_left16 = vreinterpretq_s16_u16(vmovl_u8(upper_left));
+  uint8_t line[RECT_CHUNK + CONV_MAX_TAPS];
+  int rows = img_gray.rows;
+  int cols = img_gray.cols;
+  conv_row_fn convRow = kernels->convRow[convOp][convMag];
+  int conv = useConv();
+  int R = conv_ops[convOp].radius;
+  const uint8_t *win[CONV_MAX_TAPS];
 
-      uint8x8_t lower_left = vld1_u8(img_gray.data+IMG_WIDTH*(i+1)+(j));
-      int16x8_t lower_left16 = vreinterpretq_s16_u16(vmovl_u8(lower_left));
+  for (int i = y0; i < y1; i++) {
+    if (i < R || i >= rows-R) {
+      memset(img_sobel_out.ptr(i) + x0, 0, x1 - x0);
+      continue;
+    }
+    for (int c0 = x0; c0 < x1; c0 += RECT_CHUNK) {
+      int c1 = c0 + RECT_CHUNK < x1 ? c0 + RECT_CHUNK : x1;
+      // The kernel window, widened by R so c0..c1 get full neighbourhoods;
+      // clipped at the frame edge, where the kernel writes the border 0s
+      int a = c0-R > 0 ? c0-R : 0;
+      int b = c1+R < cols ? c1+R : cols;
+      if (conv) {
+        for (int k = 0; k <= 2*R; k++) {
+          win[k] = img_gray.ptr(i-R+k) + a;
+        }
+        convRow(win, line, b - a);
+      } else {
+        kernels->sobelRow(img_gray.ptr(i-1) + a, img_gray.ptr(i) + a,
+                          img_gray.ptr(i+1) + a, line, b - a);
+      }
+      memcpy(img_sobel_out.ptr(i) + c0, line + (c0 - a), c1 - c0);
+    }
+  }
+}
 
-      uint8x8_t upper = vld1_u8(img_gray.data+IMG_WIDTH*(i-1)+(j+1));
-      int16x8_t upper16 = vreinterpretq_s16_u16(vmovl_u8(upper));
-      upper16 = vaddq_s16(upper16, upper16);
+// sobelFusedRows keeps its ring on the stack up to 4K frames; wider ones
+// use a per-thread buffer, grown the first time a thread sees the width
+#define FUSED_STACK_WIDTH 4096
+static __thread uint8_t *fusedRing;
+static __thread int fusedRingWidth;
 
-      uint8x8_t lower = vld1_u8(img_gray.data+IMG_WIDTH*(i+1)+(j+1));
-      int16x8_t lower16 = vreinterpretq_s16_u16(vmovl_u8(lower));
-      lower16 = vaddq_s16(lower16, lower16);
+// Ring rows start on cache-line boundaries
+static inline int ringStride(int cols)
+{
+  return (cols + 63) & ~63;
+}
 
-      uint8x8_t left = vld1_u8(img_gray.data+IMG_WIDTH*(i)+(j));
-      int16x8_t left16 = vreinterpretq_s16_u16(vmovl_u8(left));
-      left16 = vaddq_s16(left16, left16);
+/*******************************************
+ * Model: sobelFusedRows
+ * Input: Mat img (BGR), row range [rowStart, rowEnd)
+ * Output: None directly. Modifies a ref parameter img_sobel_out
+ * Desc: Single-pass grayscale + Sobel. Gray rows go into a ring of 2R+1
+ *  rows (3 for the 3x3 operators) that stays in L1, and each output row is
+ *  emitted as soon as the last row under its window has been converted,
+ *  so no full gray frame is ever written. The halo rows on either side of
+ *  the band are converted locally, which lets bands run in parallel with
+ *  no shared gray data. With stats, each output row is added to them
+ *  while it is still in L1.
+ ********************************************/
+void sobelFusedRows(Mat& img, Mat& img_sobel_out, int rowStart, int rowEnd, frame_stats *stats)
+{
+  uint8_t stackRing[CONV_MAX_TAPS][FUSED_STACK_WIDTH] __attribute__((aligned(64)));
+  uint8_t *ring[CONV_MAX_TAPS];
+  const uint8_t *win[CONV_MAX_TAPS];
+  int rows = img.rows;
+  int cols = img.cols;
+  gray_row_fn grayRow = grayRowFor(cols);
+  sobel_row_fn sobelRow = sobelRowFor(cols);
+  conv_row_fn convRow = kernels->convRow[convOp][convMag];
+  int conv = useConv();
+  int R = conv_ops[convOp].radius;
+  int taps = 2*R + 1;
+  stats_band band;
 
-      uint8x8_t right = vld1_u8(img_gray.data+IMG_WIDTH*(i)+(j+2));
-      int16x8_t right16 = vreinterpretq_s16_u16(vmovl_u8(right));
-      right16 = vaddq_s16(right16, right16);
+  if (cols <= FUSED_STACK_WIDTH) {
+    for (int k = 0; k < taps; k++) {
+      ring[k] = stackRing[k];
+    }
+  } else {
+    if (cols > fusedRingWidth) {
+      free(fusedRing);
+      if (posix_memalign((void **)&fusedRing, 64, CONV_MAX_TAPS * (size_t)ringStride(cols))) {
+        errx(1, "sobelFusedRows: out of memory");
+      }
+      fusedRingWidth = cols;
+    }
+    for (int k = 0; k < taps; k++) {
+      ring[k] = fusedRing + k * (size_t)ringStride(fusedRingWidth);
+    }
+  }
 
-      uint8x8_t upper_right = vld1_u8(img_gray.data+IMG_WIDTH*(i-1)+(j+2));
-      int16x8_t upper_right16 = vreinterpretq_s16_u16(vmovl_u8(upper_right));
+  // Rows with a full neighbourhood; the frame border is written as 0
+  int first = rowStart > R ? rowStart : R;
+  int last = rowEnd < rows-R ? rowEnd : rows-R;
+  if (stats) {
+    stats_band_begin(&band, stats);
+  }
+  for (int i = rowStart; i < rowEnd && i < R; i++) {
+    memset(img_sobel_out.ptr(i), 0, cols);
+    if (stats) {
+      stats_band_row(&band, img_sobel_out.ptr(i), i);
+    }
+  }
+  for (int i = rowStart > rows-R ? rowStart : rows-R; i < rowEnd; i++) {
+    memset(img_sobel_out.ptr(i), 0, cols);
+    if (stats) {
+      stats_band_row(&band, img_sobel_out.ptr(i), i);
+    }
+  }
 
-      uint8x8_t lower_right = vld1_u8(img_gray.data+IMG_WIDTH*(i+1)+(j+2));
-      int16x8_t lower_right16 = vreinterpretq_s16_u16(vmovl_u8(lower_right));
+  if (first < last) {
+    for (int i = first-R; i < first+R; i++) {
+      grayRow(img.ptr(i), ring[i % taps], cols);
+    }
+  }
+  for (int i = first; i < last; i++) {
+    grayRow(img.ptr(i+R), ring[(i+R) % taps], cols);
+    if (conv) {
+      for (int k = 0; k < taps; k++) {
+        win[k] = ring[(i-R+k) % taps];
+      }
+      convRow(win, img_sobel_out.ptr(i), cols);
+    } else {
+      sobelRow(ring[(i-1) % 3], ring[i % 3], ring[(i+1) % 3], img_sobel_out.ptr(i), cols);
+    }
+    if (stats) {
+      stats_band_row(&band, img_sobel_out.ptr(i), i);
+    }
+  }
+  if (stats) {
+    stats_band_end(&band);
+  }
+}
 
-      int16x8_t sobel16x = vsubq_s16(upper_left16, lower_left16);
-      sobel16x = vaddq_s16(sobel16x, upper16);
-      sobel16x = vsubq_s16(sobel16x, lower16);
-      sobel16x = vaddq_s16(sobel16x, upper_right16);
-      sobel16x = vsubq_s16(sobel16x, lower_right16);
+// Magnitude of output row i of the -k operator into `line`; 0 for the
+// border rows, as sobelCalcRows writes them
+static inline void magnitudeRow(Mat& img_gray, int i, uint8_t *line)
+{
+  int rows = img_gray.rows;
+  int cols = img_gray.cols;
+  int R = conv_ops[convOp].radius;
+  const uint8_t *win[CONV_MAX_TAPS];
 
-      sobel16x = vabsq_s16(sobel16x);
-      sobel16x = vminq_s16(sobel16x, vdupq_n_s16(255));
+  if (i < R || i >= rows-R) {
+    memset(line, 0, cols);
+  } else if (useConv()) {
+    for (int k = 0; k <= 2*R; k++) {
+      win[k] = img_gray.ptr(i-R+k);
+    }
+    kernels->convRow[convOp][convMag](win, line, cols);
+  } else {
+    sobelRowFor(cols)(img_gray.ptr(i-1), img_gray.ptr(i), img_gray.ptr(i+1), line, cols);
+  }
+}
 
-      int16x8_t sobel16y = vsubq_s16(upper_left16, upper_right16);
-      sobel16y = vaddq_s16(sobel16y, left16);
-      sobel16y = vsubq_s16(sobel16y, right16);
-      sobel16y = vaddq_s16(sobel16y, lower_left16);
-      sobel16y = vsubq_s16(sobel16y, lower_right16);
+// sobelEdgeRows keeps its magnitude lines on the stack up to this width;
+// wider frames use a per-thread buffer, as sobelFusedRows does
+#define EDGE_STACK_WIDTH 4096
+#define EDGE_LINES 4
+static __thread uint8_t *edgeLines;
+static __thread int edgeLinesWidth;
 
-      sobel16y = vabsq_s16(sobel16y);
-      sobel16y = vminq_s16(sobel16y, vdupq_n_s16(255));
+/*******************************************
+ * Model: sobelEdgeRows
+ * Input: Mat img_gray, row range [rowStart, rowEnd), threshold (1..255),
+ *  whether to thin edges by non-maximum suppression
+ * Output: None directly. Modifies a ref parameter img_edges, which has
+ *  EDGE_BYTES(cols) bytes per row
+ * Desc: Binary edge map, one bit per pixel (sobel_kernels.h has the bit
+ *  order). Each magnitude row is computed into a line that stays in L1
+ *  and packed from there by edgeRow, so the byte-per-pixel Sobel frame is
+ *  never written. With nms, the lines form a ring of the rows above, at
+ *  and below the output row, and nmsRow thins it before packing; the
+ *  band computes its own halo rows, so bands still run in parallel.
+ *  Stats, if given, see each row's magnitudes before suppression, once,
+ *  from the line they were computed into.
+ ********************************************/
+void sobelEdgeRows(Mat& img_gray, Mat& img_edges, int rowStart, int rowEnd, int threshold, int nms,
+                   frame_stats *stats)
+{
+  uint8_t stackLines[EDGE_LINES][EDGE_STACK_WIDTH] __attribute__((aligned(64)));
+  uint8_t *line[EDGE_LINES];
+  const uint8_t *gray[3], *mag[3];
+  int rows = img_gray.rows;
+  int cols = img_gray.cols;
+  int bytes = EDGE_BYTES(cols);
+  stats_band band;
 
-      uint16x8_t sobel16ux = vreinterpretq_u16_s16(sobel16x);
-      uint16x8_t sobel16uy = vreinterpretq_u16_s16(sobel16y);
+  if (cols <= EDGE_STACK_WIDTH) {
+    for (int k = 0; k < EDGE_LINES; k++) {
+      line[k] = stackLines[k];
+    }
+  } else {
+    if (cols > edgeLinesWidth) {
+      free(edgeLines);
+      if (posix_memalign((void **)&edgeLines, 64, EDGE_LINES * (size_t)ringStride(cols))) {
+        errx(1, "sobelEdgeRows: out of memory");
+      }
+      edgeLinesWidth = cols;
+    }
+    for (int k = 0; k < EDGE_LINES; k++) {
+      line[k] = edgeLines + k * (size_t)ringStride(edgeLinesWidth);
+    }
+  }
 
-      uint16x8_t sobel = vaddq_u16(sobel16ux, sobel16uy);
-      sobel = vminq_u16(sobel, vdupq_n_u16(255));
+  if (stats) {
+    stats_band_begin(&band, stats);
+  }
+  if (!nms) {
+    for (int i = rowStart; i < rowEnd; i++) {
+      magnitudeRow(img_gray, i, line[0]);
+      kernels->edgeRow(line[0], img_edges.ptr(i), cols, threshold);
+      if (stats) {
+        stats_band_row(&band, line[0], i);
+      }
+    }
+    if (stats) {
+      stats_band_end(&band);
+    }
+    return;
+  }
 
-      vst1_u8(img_sobel_out.data+IMG_WIDTH*(i)+(j), vmovn_u16(sobel));
+  // line[(i+1) % 3] holds magnitude row i, from row rowStart-1 on;
+  // line[3] takes the suppressed row
+  if (rowStart < rowEnd) {
+    magnitudeRow(img_gray, rowStart > 0 ? rowStart-1 : 0, line[rowStart % 3]);
+    magnitudeRow(img_gray, rowStart, line[(rowStart+1) % 3]);
+  }
+  for (int i = rowStart; i < rowEnd; i++) {
+    magnitudeRow(img_gray, i+1 < rows ? i+1 : i, line[(i+2) % 3]);
+    if (stats) {
+      stats_band_row(&band, line[(i+1) % 3], i);
+    }
+    if (i < 1 || i >= rows-1) {
+      memset(img_edges.ptr(i), 0, bytes);
+      continue;
     }
+    for (int k = 0; k < 3; k++) {
+      gray[k] = img_gray.ptr(i-1+k);
+      mag[k] = line[(i+k) % 3];
+    }
+    kernels->nmsRow(gray, mag, line[3], cols);
+    kernels->edgeRow(line[3], img_edges.ptr(i), cols, threshold);
+  }
+  if (stats) {
+    stats_band_end(&band);
   }
 }
+
+/*******************************************
+ * Model: edgeUnpack
+ * Input: Mat img_edges (packed, EDGE_BYTES(cols) bytes per row)
+ * Output: None directly. Modifies a ref parameter img_out
+ * Desc: Expands an edge map back to one byte per pixel, 255 for an edge
+ *  and 0 elsewhere, for the window and the video sink. The size comes
+ *  from img_out.
+ ********************************************/
+void edgeUnpack(const Mat& img_edges, Mat& img_out)
+{
+  for (int i = 0; i < img_out.rows; i++) {
+    const uint8_t *bits = img_edges.ptr(i);
+    uint8_t *out = img_out.ptr(i);
+    for (int j = 0; j < img_out.cols; j++) {
+      out[j] = (bits[j/8] >> (j%8) & 1) ? 255 : 0;
+    }
+  }
+}
+
+/*******************************************
+ * Model: grayScale
+ * Input: Mat img
+ * Output: None directly. Modifies a ref parameter img_gray_out
+ * Desc: This module converts the image to grayscale
+ ********************************************/
+void grayScale(Mat& img, Mat& img_gray_out)
+{
+  grayScaleRows(img, img_gray_out, 0, img.rows);
+}
+
+/*******************************************
+ * Model: sobelCalc
+ * Input: Mat img_in
+ * Output: None directly. Modifies a ref parameter img_sobel_out
+ * Desc: This module performs a sobel calculation on an image. It calculates
+ *  the gradient in the x direction, calculates the gradient in the y
+ *  direction and sums their magnitudes to finish the Sobel calculation.
+ *  The one-pixel border has no full neighbourhood and is written as 0.
+ *  Fills the stats of a stats_begin() on this thread, if any.
+ ********************************************/
+void sobelCalc(Mat& img_gray, Mat& img_sobel_out)
+{
+  sobelCalcRows(img_gray, img_sobel_out, 0, img_gray.rows, statsSink);
+}
+
+/*******************************************
+ * Model: sobelFused
+ * Input: Mat img (BGR)
+ * Output: None directly. Modifies a ref parameter img_sobel_out
+ * Desc: Whole-frame sobelFusedRows(). Produces the same output as
+ *  grayScale() followed by sobelCalc().
+ ********************************************/
+void sobelFused(Mat& img, Mat& img_sobel_out)
+{
+  sobelFusedRows(img, img_sobel_out, 0, img.rows, statsSink);
+}
+
+/*******************************************
+ * Model: sobelEdge
+ * Input: Mat img_gray, threshold, non-maximum suppression on or off
+ * Output: None directly. Modifies a ref parameter img_edges
+ * Desc: Whole-frame sobelEdgeRows()
+ ********************************************/
+void sobelEdge(Mat& img_gray, Mat& img_edges, int threshold, int nms)
+{
+  sobelEdgeRows(img_gray, img_edges, 0, img_gray.rows, threshold, nms, statsSink);
+}
@@ -0,0 +1,167 @@
+#include "sobel_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include "sobel_x86.h"
+#include "conv_engine.h"
+
+/*******************************************
+ * Model: grayRow (AVX2)
+ * Desc: 32 pixels per iteration, two groups of 16 de-interleaved with
+ *  pshufb. packus works per 128-bit lane, so a permute restores the order.
+ ********************************************/
+template <int W>
+static void grayRow(const uint8_t *bgr, uint8_t *gray, int width)
+{
+  if (W) {
+    width = W;
+  }
+  int j = 0;
+  for (; j + 32 <= width; j += 32) {
+    __m256i y0 = luma16(bgr + 3*j);
+    __m256i y1 = luma16(bgr + 3*j + 48);
+    __m256i y = _mm256_permute4x64_epi64(_mm256_packus_epi16(y0, y1), 0xd8);
+    _mm256_storeu_si256((__m256i *)(gray + j), y);
+  }
+  grayRowScalar(bgr, gray, j, width);
+}
+
+static inline __m256i sobel16(__m256i ul, __m256i u, __m256i ur, __m256i l,
+                              __m256i r, __m256i ll, __m256i lo, __m256i lr)
+{
+  const __m256i max = _mm256_set1_epi16(255);
+  __m256i t1 = _mm256_sub_epi16(ul, lr);
+  __m256i t2 = _mm256_sub_epi16(ur, ll);
+  __m256i dy = _mm256_sub_epi16(u, lo);
+  __m256i dx = _mm256_sub_epi16(l, r);
+  __m256i gx = _mm256_add_epi16(_mm256_add_epi16(t1, t2), _mm256_add_epi16(dy, dy));
+  __m256i gy = _mm256_add_epi16(_mm256_sub_epi16(t1, t2), _mm256_add_epi16(dx, dx));
+  gx = _mm256_min_epi16(_mm256_abs_epi16(gx), max);
+  gy = _mm256_min_epi16(_mm256_abs_epi16(gy), max);
+  return _mm256_add_epi16(gx, gy);
+}
+
+/*******************************************
+ * Model: sobelRow (AVX2)
+ * Desc: 32 output pixels per iteration. unpack and packus are both
+ *  per-lane, so widening and narrowing cancel without a permute.
+ ********************************************/
+template <int W>
+static void sobelRow(const uint8_t *above, const uint8_t *row,
+                     const uint8_t *below, uint8_t *out, int width)
+{
+  if (W) {
+    width = W;
+  }
+  const __m256i zero = _mm256_setzero_si256();
+  out[0] = 0;
+  out[width-1] = 0;
+
+  int j = 1;
+  for (; j + 33 <= width; j += 32) {
+    __m256i v[8];
+    v[0] = _mm256_loadu_si256((const __m256i *)(above + j - 1));
+    v[1] = _mm256_loadu_si256((const __m256i *)(above + j));
+    v[2] = _mm256_loadu_si256((const __m256i *)(above + j + 1));
+    v[3] = _mm256_loadu_si256((const __m256i *)(row + j - 1));
+    v[4] = _mm256_loadu_si256((const __m256i *)(row + j + 1));
+    v[5] = _mm256_loadu_si256((const __m256i *)(below + j - 1));
+    v[6] = _mm256_loadu_si256((const __m256i *)(below + j));
+    v[7] = _mm256_loadu_si256((const __m256i *)(below + j + 1));
+
+    __m256i lo = sobel16(_mm256_unpacklo_epi8(v[0], zero), _mm256_unpacklo_epi8(v[1], zero),
+                         _mm256_unpacklo_epi8(v[2], zero), _mm256_unpacklo_epi8(v[3], zero),
+                         _mm256_unpacklo_epi8(v[4], zero), _mm256_unpacklo_epi8(v[5], zero),
+                         _mm256_unpacklo_epi8(v[6], zero), _mm256_unpacklo_epi8(v[7], zero));
+    __m256i hi = sobel16(_mm256_unpackhi_epi8(v[0], zero), _mm256_unpackhi_epi8(v[1], zero),
+                         _mm256_unpackhi_epi8(v[2], zero), _mm256_unpackhi_epi8(v[3], zero),
+                         _mm256_unpackhi_epi8(v[4], zero), _mm256_unpackhi_epi8(v[5], zero),
+                         _mm256_unpackhi_epi8(v[6], zero), _mm256_unpackhi_epi8(v[7], zero));
+    _mm256_storeu_si256((__m256i *)(out + j), _mm256_packus_epi16(lo, hi));
+  }
+  sobelRowScalar(above, row, below, out, j, width-1);
+}
+
+static uint32_t sadRow(const uint8_t *a, const uint8_t *b, int width)
+{
+  __m256i acc = _mm256_setzero_si256();
+  int j = 0;
+  for (; j + 32 <= width; j += 32) {
+    __m256i va = _mm256_loadu_si256((const __m256i *)(a + j));
+    __m256i vb = _mm256_loadu_si256((const __m256i *)(b + j));
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(va, vb));
+  }
+  __m128i s = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  uint32_t sad = _mm_cvtsi128_si32(s) + _mm_cvtsi128_si32(_mm_srli_si128(s, 8));
+  return sad + sadRowScalar(a, b, j, width);
+}
+
+static uint32_t sumRow(const uint8_t *p, int width)
+{
+  __m256i acc = _mm256_setzero_si256();
+  __m256i zero = _mm256_setzero_si256();
+  int j = 0;
+  for (; j + 32 <= width; j += 32) {
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(p + j)), zero));
+  }
+  __m128i s = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  uint32_t sum = _mm_cvtsi128_si32(s) + _mm_cvtsi128_si32(_mm_srli_si128(s, 8));
+  return sum + sumRowScalar(p, j, width);
+}
+
+// As in the SSE2 backend; the 256-bit movemask keeps pixel order too
+static void edgeRow(const uint8_t *mag, uint8_t *bits, int width, int threshold)
+{
+  const __m256i t = _mm256_set1_epi8((char)threshold);
+  int j = 0;
+  for (; j + 32 <= width; j += 32) {
+    __m256i m = _mm256_loadu_si256((const __m256i *)(mag + j));
+    uint32_t b = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(m, t), m));
+    memcpy(bits + j/8, &b, sizeof(b));
+  }
+  edgeRowScalar(mag, bits, j, width, threshold);
+}
+
+// floor(sqrt(min(n, 255^2))) per 32-bit lane; exact, as in the SSE2 backend
+static inline __m256i isqrt8(__m256i n)
+{
+  __m256 f = _mm256_min_ps(_mm256_cvtepi32_ps(n), _mm256_set1_ps(255.0f * 255.0f));
+  return _mm256_cvttps_epi32(_mm256_sqrt_ps(f));
+}
+
+// conv_engine.h vector type: 32 pixels as two halves of 16 x 16 bits. The
+// unpacks and packs all work within 128-bit lanes, so they cancel out and
+// no permute is needed.
+struct conv_avx2 {
+  typedef __m256i w;
+  static const int L = 32, H = 2;
+  static inline w load(const uint8_t *p, int h)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    return h ? _mm256_unpackhi_epi8(v, _mm256_setzero_si256()) : _mm256_unpacklo_epi8(v, _mm256_setzero_si256());
+  }
+  static inline void store(uint8_t *p, const w *x)
+  {
+    _mm256_storeu_si256((__m256i *)p, _mm256_packus_epi16(x[0], x[1]));
+  }
+  static inline w zero() { return _mm256_setzero_si256(); }
+  static inline w add(w a, w b) { return _mm256_add_epi16(a, b); }
+  static inline w sub(w a, w b) { return _mm256_sub_epi16(a, b); }
+  static inline w shl(w a, int n) { return _mm256_slli_epi16(a, n); }
+  static inline w mul(w a, int c) { return _mm256_mullo_epi16(a, _mm256_set1_epi16(c)); }
+  static inline w abs(w a) { return _mm256_abs_epi16(a); }
+  static inline w min255(w a) { return _mm256_min_epi16(a, _mm256_set1_epi16(255)); }
+  static inline w gt(w a, w b) { return _mm256_cmpgt_epi16(a, b); }
+  static inline w sel(w m, w a, w b) { return _mm256_blendv_epi8(b, a, m); }
+  static inline w mulhi(w a, int c) { return _mm256_mulhi_epi16(a, _mm256_set1_epi16(c)); }
+  static inline w l2(w gx, w gy)
+  {
+    __m256i lo = _mm256_unpacklo_epi16(gx, gy);
+    __m256i hi = _mm256_unpackhi_epi16(gx, gy);
+    return _mm256_packs_epi32(isqrt8(_mm256_madd_epi16(lo, lo)), isqrt8(_mm256_madd_epi16(hi, hi)));
+  }
+};
+
+const struct sobel_kernels sobel_kernels_avx2 =
+  SOBEL_KERNEL_TABLE("avx2", grayRow, sobelRow, conv_avx2, sadRow, sumRow, edgeRow);
+
+#endif
@@ -0,0 +1,188 @@
+#include "sobel_kernels.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include "arm_neon.h"
+#include "conv_engine.h"
+
+/*******************************************
+ * Model: grayRow (NEON)
+ * Desc: Converts 8 BGR pixels per iteration. vld3 de-interleaves the
+ *  channels, each channel is multiplied by its weight (x256) and shifted
+ *  back down before the three are summed.
+ ********************************************/
+template <int W>
+static void grayRow(const uint8_t *bgr, uint8_t *gray, int width)
+{
+  if (W) {
+    width = W;
+  }
+  int j = 0;
+  for (; j + 8 <= width; j += 8) {
+    uint8x8x3_t bgrs = vld3_u8(bgr + 3*j);
+
+    uint16x8_t bs = vmovl_u8(bgrs.val[0]);
+    uint16x8_t gs = vmovl_u8(bgrs.val[1]);
+    uint16x8_t rs = vmovl_u8(bgrs.val[2]);
+
+    bs = vshrq_n_u16(vmulq_n_u16(bs, 29), 8);
+    gs = vshrq_n_u16(vmulq_n_u16(gs, 150), 8);
+    rs = vshrq_n_u16(vmulq_n_u16(rs, 76), 8);
+
+    uint16x8_t color = vaddq_u16(vaddq_u16(bs, gs), rs);
+    vst1_u8(gray + j, vmovn_u16(color));
+  }
+  grayRowScalar(bgr, gray, j, width);
+}
+
+static inline int16x8_t load16(const uint8_t *p)
+{
+  return vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p)));
+}
+
+/*******************************************
+ * Model: sobelRow (NEON)
+ * Desc: 8 output pixels per iteration. The two corner differences are
+ *  computed once and shared between Gx and Gy.
+ ********************************************/
+template <int W>
+static void sobelRow(const uint8_t *above, const uint8_t *row,
+                     const uint8_t *below, uint8_t *out, int width)
+{
+  if (W) {
+    width = W;
+  }
+  const int16x8_t max = vdupq_n_s16(255);
+  out[0] = 0;
+  out[width-1] = 0;
+
+  int j = 1;
+  for (; j + 9 <= width; j += 8) {
+    int16x8_t upper_left = load16(above + j - 1);
+    int16x8_t upper = load16(above + j);
+    int16x8_t upper_right = load16(above + j + 1);
+    int16x8_t left = load16(row + j - 1);
+    int16x8_t right = load16(row + j + 1);
+    int16x8_t lower_left = load16(below + j - 1);
+    int16x8_t lower = load16(below + j);
+    int16x8_t lower_right = load16(below + j + 1);
+
+    int16x8_t t1 = vsubq_s16(upper_left, lower_right);
+    int16x8_t t2 = vsubq_s16(upper_right, lower_left);
+    int16x8_t dy = vsubq_s16(upper, lower);
+    int16x8_t dx = vsubq_s16(left, right);
+
+    int16x8_t sobelx = vaddq_s16(vaddq_s16(t1, t2), vaddq_s16(dy, dy));
+    int16x8_t sobely = vaddq_s16(vsubq_s16(t1, t2), vaddq_s16(dx, dx));
+
+    sobelx = vminq_s16(vabsq_s16(sobelx), max);
+    sobely = vminq_s16(vabsq_s16(sobely), max);
+
+    uint16x8_t sobel = vreinterpretq_u16_s16(vaddq_s16(sobelx, sobely));
+    vst1_u8(out + j, vqmovn_u16(sobel));
+  }
+  sobelRowScalar(above, row, below, out, j, width-1);
+}
+
+// vabd then pairwise widening adds, so no lane can overflow
+static uint32_t sadRow(const uint8_t *a, const uint8_t *b, int width)
+{
+  uint32x4_t acc = vdupq_n_u32(0);
+  int j = 0;
+  for (; j + 16 <= width; j += 16) {
+    uint8x16_t d = vabdq_u8(vld1q_u8(a + j), vld1q_u8(b + j));
+    acc = vpadalq_u16(acc, vpaddlq_u8(d));
+  }
+  uint64x2_t s = vpaddlq_u32(acc);
+  uint32_t sad = (uint32_t)(vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1));
+  return sad + sadRowScalar(a, b, j, width);
+}
+
+static uint32_t sumRow(const uint8_t *p, int width)
+{
+  uint32x4_t acc = vdupq_n_u32(0);
+  int j = 0;
+  for (; j + 16 <= width; j += 16) {
+    acc = vpadalq_u16(acc, vpaddlq_u8(vld1q_u8(p + j)));
+  }
+  uint64x2_t s = vpaddlq_u32(acc);
+  uint32_t sum = (uint32_t)(vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1));
+  return sum + sumRowScalar(p, j, width);
+}
+
+// NEON has no movemask: each compare lane keeps its own bit weight, and
+// three pairwise adds sum every 8 lanes into one byte
+static void edgeRow(const uint8_t *mag, uint8_t *bits, int width, int threshold)
+{
+  static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+  const uint8x16_t w = vld1q_u8(weights);
+  const uint8x16_t t = vdupq_n_u8(threshold);
+  int j = 0;
+  for (; j + 16 <= width; j += 16) {
+    uint8x16_t m = vandq_u8(vcgeq_u8(vld1q_u8(mag + j), t), w);
+    uint8x8_t p = vpadd_u8(vget_low_u8(m), vget_high_u8(m));
+    p = vpadd_u8(p, p);
+    p = vpadd_u8(p, p);
+    vst1_lane_u16((uint16_t *)(bits + j/8), vreinterpret_u16_u8(p), 0);
+  }
+  edgeRowScalar(mag, bits, j, width, threshold);
+}
+
+/*******************************************
+ * Model: isqrt4 (NEON)
+ * Desc: floor(sqrt(min(n, 255^2))) per lane. ARMv7 NEON has no vector
+ *  square root, only a reciprocal estimate: two Newton steps bring it
+ *  within one of the root, and two integer compares settle it exactly.
+ ********************************************/
+static inline int32x4_t isqrt4(int32x4_t n)
+{
+  n = vminq_s32(n, vdupq_n_s32(255 * 255));
+  float32x4_t f = vcvtq_f32_s32(n);
+  float32x4_t e = vrsqrteq_f32(vmaxq_f32(f, vdupq_n_f32(1.0f)));
+  e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(f, e), e));
+  e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(f, e), e));
+  int32x4_t r = vcvtq_s32_f32(vmulq_f32(f, e));
+  // The compares give -1 where true: r+1 if (r+1)^2 <= n, r-1 if r^2 > n
+  int32x4_t r1 = vaddq_s32(r, vdupq_n_s32(1));
+  r = vsubq_s32(r, vreinterpretq_s32_u32(vcleq_s32(vmulq_s32(r1, r1), n)));
+  r = vaddq_s32(r, vreinterpretq_s32_u32(vcgtq_s32(vmulq_s32(r, r), n)));
+  return r;
+}
+
+// conv_engine.h vector type: 16 pixels as two halves of 8 x 16 bits
+struct conv_neon {
+  typedef int16x8_t w;
+  static const int L = 16, H = 2;
+  static inline w load(const uint8_t *p, int h)
+  {
+    uint8x16_t v = vld1q_u8(p);
+    return vreinterpretq_s16_u16(vmovl_u8(h ? vget_high_u8(v) : vget_low_u8(v)));
+  }
+  static inline void store(uint8_t *p, const w *x)
+  {
+    vst1q_u8(p, vcombine_u8(vqmovun_s16(x[0]), vqmovun_s16(x[1])));
+  }
+  static inline w zero() { return vdupq_n_s16(0); }
+  static inline w add(w a, w b) { return vaddq_s16(a, b); }
+  static inline w sub(w a, w b) { return vsubq_s16(a, b); }
+  static inline w shl(w a, int n) { return vshlq_s16(a, vdupq_n_s16(n)); }
+  static inline w mul(w a, int c) { return vmulq_n_s16(a, c); }
+  static inline w abs(w a) { return vabsq_s16(a); }
+  static inline w min255(w a) { return vminq_s16(a, vdupq_n_s16(255)); }
+  static inline w gt(w a, w b) { return vreinterpretq_s16_u16(vcgtq_s16(a, b)); }
+  static inline w sel(w m, w a, w b) { return vbslq_s16(vreinterpretq_u16_s16(m), a, b); }
+  // vqdmulh doubles the product, hence the even c
+  static inline w mulhi(w a, int c) { return vqdmulhq_n_s16(a, c / 2); }
+  static inline w l2(w gx, w gy)
+  {
+    int16x4_t xl = vget_low_s16(gx), yl = vget_low_s16(gy);
+    int16x4_t xh = vget_high_s16(gx), yh = vget_high_s16(gy);
+    int32x4_t lo = vmlal_s16(vmull_s16(xl, xl), yl, yl);
+    int32x4_t hi = vmlal_s16(vmull_s16(xh, xh), yh, yh);
+    return vcombine_s16(vqmovn_s32(isqrt4(lo)), vqmovn_s32(isqrt4(hi)));
+  }
+};
+
+const struct sobel_kernels sobel_kernels_neon =
+  SOBEL_KERNEL_TABLE("neon", grayRow, sobelRow, conv_neon, sadRow, sumRow, edgeRow);
+
+#endif
@@ -0,0 +1,123 @@
+#include "sobel_kernels.h"
+#include "conv_engine.h"
+
+static inline int clamp255(int v)
+{
+  return v > 255 ? 255 : v;
+}
+
+static inline int iabs(int v)
+{
+  return v < 0 ? -v : v;
+}
+
+/*******************************************
+ * Model: grayRowScalar
+ * Input: BGR row, pixel range [start, end)
+ * Output: None directly. Writes gray[start..end)
+ * Desc: Reference BGR -> gray conversion. The vector backends must match
+ *  this bit for bit.
+ ********************************************/
+void grayRowScalar(const uint8_t *bgr, uint8_t *gray, int start, int end)
+{
+  for (int j = start; j < end; j++) {
+    const uint8_t *p = bgr + 3*j;
+    gray[j] = ((p[0]*29) >> 8) + ((p[1]*150) >> 8) + ((p[2]*76) >> 8);
+  }
+}
+
+/*******************************************
+ * Model: sobelRowScalar
+ * Input: three neighbouring gray rows, pixel range [start, end)
+ * Output: None directly. Writes out[start..end)
+ * Desc: Reference Sobel magnitude. Gx and Gy share the corner differences,
+ *  the same way the vector kernels do.
+ ********************************************/
+void sobelRowScalar(const uint8_t *above, const uint8_t *row,
+                    const uint8_t *below, uint8_t *out, int start, int end)
+{
+  for (int j = start; j < end; j++) {
+    int t1 = above[j-1] - below[j+1];
+    int t2 = above[j+1] - below[j-1];
+    int gx = t1 + t2 + 2*(above[j] - below[j]);
+    int gy = t1 - t2 + 2*(row[j-1] - row[j+1]);
+    out[j] = clamp255(clamp255(iabs(gx)) + clamp255(iabs(gy)));
+  }
+}
+
+uint32_t sadRowScalar(const uint8_t *a, const uint8_t *b, int start, int end)
+{
+  uint32_t sad = 0;
+  for (int j = start; j < end; j++) {
+    sad += iabs(a[j] - b[j]);
+  }
+  return sad;
+}
+
+uint32_t sumRowScalar(const uint8_t *p, int start, int end)
+{
+  uint32_t sum = 0;
+  for (int j = start; j < end; j++) {
+    sum += p[j];
+  }
+  return sum;
+}
+
+/*******************************************
+ * Model: edgeRowScalar
+ * Input: magnitude row, pixel range [start, end), threshold
+ * Output: None directly. Writes bits[start/8..(end+7)/8)
+ * Desc: Reference threshold and pack, eight pixels to a byte, least
+ *  significant bit first. The vector backends pack whole registers with a
+ *  compare and a movemask and leave only the tail to this.
+ ********************************************/
+void edgeRowScalar(const uint8_t *mag, uint8_t *bits, int start, int end, int threshold)
+{
+  for (int j = start; j < end; j += 8) {
+    int n = end - j < 8 ? end - j : 8;
+    uint8_t b = 0;
+    for (int k = 0; k < n; k++) {
+      b |= (mag[j+k] >= threshold) << k;
+    }
+    bits[j/8] = b;
+  }
+}
+
+template <int W>
+static void grayRow(const uint8_t *bgr, uint8_t *gray, int width)
+{
+  if (W) {
+    width = W;
+  }
+  grayRowScalar(bgr, gray, 0, width);
+}
+
+template <int W>
+static void sobelRow(const uint8_t *above, const uint8_t *row,
+                     const uint8_t *below, uint8_t *out, int width)
+{
+  if (W) {
+    width = W;
+  }
+  out[0] = 0;
+  out[width-1] = 0;
+  sobelRowScalar(above, row, below, out, 1, width-1);
+}
+
+static uint32_t sadRow(const uint8_t *a, const uint8_t *b, int width)
+{
+  return sadRowScalar(a, b, 0, width);
+}
+
+static uint32_t sumRow(const uint8_t *p, int width)
+{
+  return sumRowScalar(p, 0, width);
+}
+
+static void edgeRow(const uint8_t *mag, uint8_t *bits, int width, int threshold)
+{
+  edgeRowScalar(mag, bits, 0, width, threshold);
+}
+
+const struct sobel_kernels sobel_kernels_scalar =
+  SOBEL_KERNEL_TABLE("scalar", grayRow, sobelRow, conv_scalar, sadRow, sumRow, edgeRow);
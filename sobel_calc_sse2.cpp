@@ -0,0 +1,198 @@
+#include "sobel_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#include "conv_engine.h"
+
+// SSE2 has no byte shuffle, so four BGR pixels are gathered into the four
+// 32-bit lanes of a register with byte shifts instead: lane k = B G R x of
+// pixel k.
+static inline __m128i gather4(const uint8_t *p)
+{
+  __m128i v = _mm_loadu_si128((const __m128i *)p);
+  __m128i lo = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+  __m128i hi = _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9));
+  return _mm_unpacklo_epi64(lo, hi);
+}
+
+static inline __m128i luma4(__m128i px)
+{
+  const __m128i mask = _mm_set1_epi32(0xff);
+  __m128i b = _mm_and_si128(px, mask);
+  __m128i g = _mm_and_si128(_mm_srli_epi32(px, 8), mask);
+  __m128i r = _mm_and_si128(_mm_srli_epi32(px, 16), mask);
+
+  b = _mm_srli_epi32(_mm_mullo_epi16(b, _mm_set1_epi32(29)), 8);
+  g = _mm_srli_epi32(_mm_mullo_epi16(g, _mm_set1_epi32(150)), 8);
+  r = _mm_srli_epi32(_mm_mullo_epi16(r, _mm_set1_epi32(76)), 8);
+  return _mm_add_epi32(_mm_add_epi32(b, g), r);
+}
+
+/*******************************************
+ * Model: grayRow (SSE2)
+ * Desc: 16 pixels per iteration. The last 16-byte load starts at pixel
+ *  j+12, so the loop stops early enough that it never reads past the row.
+ ********************************************/
+template <int W>
+static void grayRow(const uint8_t *bgr, uint8_t *gray, int width)
+{
+  if (W) {
+    width = W;
+  }
+  int j = 0;
+  for (; j + 18 <= width; j += 16) {
+    const uint8_t *p = bgr + 3*j;
+    __m128i y0 = _mm_packs_epi32(luma4(gather4(p)), luma4(gather4(p + 12)));
+    __m128i y1 = _mm_packs_epi32(luma4(gather4(p + 24)), luma4(gather4(p + 36)));
+    _mm_storeu_si128((__m128i *)(gray + j), _mm_packus_epi16(y0, y1));
+  }
+  grayRowScalar(bgr, gray, j, width);
+}
+
+static inline __m128i abs16(__m128i v)
+{
+  return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+// Sobel magnitude for 8 pixels held as 16-bit lanes.
+static inline __m128i sobel8(__m128i ul, __m128i u, __m128i ur, __m128i l,
+                             __m128i r, __m128i ll, __m128i lo, __m128i lr)
+{
+  const __m128i max = _mm_set1_epi16(255);
+  __m128i t1 = _mm_sub_epi16(ul, lr);
+  __m128i t2 = _mm_sub_epi16(ur, ll);
+  __m128i dy = _mm_sub_epi16(u, lo);
+  __m128i dx = _mm_sub_epi16(l, r);
+  __m128i gx = _mm_add_epi16(_mm_add_epi16(t1, t2), _mm_add_epi16(dy, dy));
+  __m128i gy = _mm_add_epi16(_mm_sub_epi16(t1, t2), _mm_add_epi16(dx, dx));
+  gx = _mm_min_epi16(abs16(gx), max);
+  gy = _mm_min_epi16(abs16(gy), max);
+  return _mm_add_epi16(gx, gy);
+}
+
+/*******************************************
+ * Model: sobelRow (SSE2)
+ * Desc: 16 output pixels per iteration, split into two 8x16-bit halves.
+ *  packus saturates the final sum, so no last clamp is needed.
+ ********************************************/
+template <int W>
+static void sobelRow(const uint8_t *above, const uint8_t *row,
+                     const uint8_t *below, uint8_t *out, int width)
+{
+  if (W) {
+    width = W;
+  }
+  const __m128i zero = _mm_setzero_si128();
+  out[0] = 0;
+  out[width-1] = 0;
+
+  int j = 1;
+  for (; j + 17 <= width; j += 16) {
+    __m128i v[8];
+    v[0] = _mm_loadu_si128((const __m128i *)(above + j - 1));
+    v[1] = _mm_loadu_si128((const __m128i *)(above + j));
+    v[2] = _mm_loadu_si128((const __m128i *)(above + j + 1));
+    v[3] = _mm_loadu_si128((const __m128i *)(row + j - 1));
+    v[4] = _mm_loadu_si128((const __m128i *)(row + j + 1));
+    v[5] = _mm_loadu_si128((const __m128i *)(below + j - 1));
+    v[6] = _mm_loadu_si128((const __m128i *)(below + j));
+    v[7] = _mm_loadu_si128((const __m128i *)(below + j + 1));
+
+    __m128i lo = sobel8(_mm_unpacklo_epi8(v[0], zero), _mm_unpacklo_epi8(v[1], zero),
+                        _mm_unpacklo_epi8(v[2], zero), _mm_unpacklo_epi8(v[3], zero),
+                        _mm_unpacklo_epi8(v[4], zero), _mm_unpacklo_epi8(v[5], zero),
+                        _mm_unpacklo_epi8(v[6], zero), _mm_unpacklo_epi8(v[7], zero));
+    __m128i hi = sobel8(_mm_unpackhi_epi8(v[0], zero), _mm_unpackhi_epi8(v[1], zero),
+                        _mm_unpackhi_epi8(v[2], zero), _mm_unpackhi_epi8(v[3], zero),
+                        _mm_unpackhi_epi8(v[4], zero), _mm_unpackhi_epi8(v[5], zero),
+                        _mm_unpackhi_epi8(v[6], zero), _mm_unpackhi_epi8(v[7], zero));
+    _mm_storeu_si128((__m128i *)(out + j), _mm_packus_epi16(lo, hi));
+  }
+  sobelRowScalar(above, row, below, out, j, width-1);
+}
+
+// psadbw: one 64-bit partial sum per 8 bytes
+static uint32_t sadRow(const uint8_t *a, const uint8_t *b, int width)
+{
+  __m128i acc = _mm_setzero_si128();
+  int j = 0;
+  for (; j + 16 <= width; j += 16) {
+    __m128i va = _mm_loadu_si128((const __m128i *)(a + j));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+  }
+  uint32_t sad = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+  return sad + sadRowScalar(a, b, j, width);
+}
+
+// psadbw against zero is a horizontal byte sum
+static uint32_t sumRow(const uint8_t *p, int width)
+{
+  __m128i acc = _mm_setzero_si128();
+  __m128i zero = _mm_setzero_si128();
+  int j = 0;
+  for (; j + 16 <= width; j += 16) {
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(p + j)), zero));
+  }
+  uint32_t sum = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+  return sum + sumRowScalar(p, j, width);
+}
+
+// SSE2 has no unsigned byte compare: mag >= t exactly when max(mag, t) is
+// mag. movemask then packs the 16 compare results, in pixel order.
+static void edgeRow(const uint8_t *mag, uint8_t *bits, int width, int threshold)
+{
+  const __m128i t = _mm_set1_epi8((char)threshold);
+  int j = 0;
+  for (; j + 16 <= width; j += 16) {
+    __m128i m = _mm_loadu_si128((const __m128i *)(mag + j));
+    uint16_t b = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(m, t), m));
+    memcpy(bits + j/8, &b, sizeof(b));
+  }
+  edgeRowScalar(mag, bits, j, width, threshold);
+}
+
+// floor(sqrt(min(n, 255^2))) per 32-bit lane. Below 2^24 the float is
+// exact and sqrtps correctly rounded, so truncation gives the integer root.
+static inline __m128i isqrt4(__m128i n)
+{
+  __m128 f = _mm_min_ps(_mm_cvtepi32_ps(n), _mm_set1_ps(255.0f * 255.0f));
+  return _mm_cvttps_epi32(_mm_sqrt_ps(f));
+}
+
+// conv_engine.h vector type: 16 pixels as two halves of 8 x 16 bits, the
+// same split as sobelRow
+struct conv_sse2 {
+  typedef __m128i w;
+  static const int L = 16, H = 2;
+  static inline w load(const uint8_t *p, int h)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    return h ? _mm_unpackhi_epi8(v, _mm_setzero_si128()) : _mm_unpacklo_epi8(v, _mm_setzero_si128());
+  }
+  static inline void store(uint8_t *p, const w *x)
+  {
+    _mm_storeu_si128((__m128i *)p, _mm_packus_epi16(x[0], x[1]));
+  }
+  static inline w zero() { return _mm_setzero_si128(); }
+  static inline w add(w a, w b) { return _mm_add_epi16(a, b); }
+  static inline w sub(w a, w b) { return _mm_sub_epi16(a, b); }
+  static inline w shl(w a, int n) { return _mm_slli_epi16(a, n); }
+  static inline w mul(w a, int c) { return _mm_mullo_epi16(a, _mm_set1_epi16(c)); }
+  static inline w abs(w a) { return abs16(a); }
+  static inline w min255(w a) { return _mm_min_epi16(a, _mm_set1_epi16(255)); }
+  static inline w gt(w a, w b) { return _mm_cmpgt_epi16(a, b); }
+  static inline w sel(w m, w a, w b) { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); }
+  static inline w mulhi(w a, int c) { return _mm_mulhi_epi16(a, _mm_set1_epi16(c)); }
+  static inline w l2(w gx, w gy)
+  {
+    __m128i lo = _mm_unpacklo_epi16(gx, gy);
+    __m128i hi = _mm_unpackhi_epi16(gx, gy);
+    return _mm_packs_epi32(isqrt4(_mm_madd_epi16(lo, lo)), isqrt4(_mm_madd_epi16(hi, hi)));
+  }
+};
+
+const struct sobel_kernels sobel_kernels_sse2 =
+  SOBEL_KERNEL_TABLE("sse2", grayRow, sobelRow, conv_sse2, sadRow, sumRow, edgeRow);
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef SOBEL_KERNELS_H
+#define SOBEL_KERNELS_H
+
+#include <stdint.h>
+
+// Row-level kernels. Every backend implements the same two primitives so the
+// frame-level code (grayScale, sobelCalc, ...) never has to know which ISA it
+// is running on.
+//
+// grayRow:  converts `width` BGR pixels to 8-bit luma using the fixed-point
+//           weights 29/150/76 (each product shifted right by 8 before summing).
+// sobelRow: computes one output row from the three gray rows around it.
+//           out[0] and out[width-1] are written as 0; every other pixel is
+//           min(min(|Gx|,255) + min(|Gy|,255), 255).
+//
+// Rows are passed as separate pointers, so the kernels never see the frame
+// stride and work on any Mat, padded or not. Any width >= 3 is valid; the
+// part that does not fill a whole vector is finished by the scalar code.
+typedef void (*gray_row_fn)(const uint8_t *bgr, uint8_t *gray, int width);
+typedef void (*sobel_row_fn)(const uint8_t *above, const uint8_t *row,
+                             const uint8_t *below, uint8_t *out, int width);
+
+// Common frame widths get their own instantiation of each kernel, with the
+// width as a compile-time constant: loop trip counts and the tail are then
+// known to the compiler, which unrolls and drops the dead tail code. The
+// `width` argument is ignored by these. Indexed like sobel_fixed_widths.
+#define SOBEL_NUM_FIXED 4
+extern const int sobel_fixed_widths[SOBEL_NUM_FIXED];
+
+// Gradient operators from the convolution engine (conv_engine.h), each in
+// L1 (|Gx|+|Gy|, as sobelRow) and L2 (sqrt(Gx^2+Gy^2)) form. convRow gets
+// the 2R+1 gray rows centred on the output row and zeroes the R-pixel
+// border at both ends. Outputs are unnormalised and saturate at 255.
+enum { CONV_SOBEL, CONV_SCHARR, CONV_PREWITT, CONV_SOBEL5, CONV_NUM_OPS };
+enum { CONV_L1, CONV_L2, CONV_NUM_MAGS };
+typedef void (*conv_row_fn)(const uint8_t *const *rows, uint8_t *out, int width);
+
+// Binary edge maps (sobelEdgeRows). edgeRow thresholds a row of
+// magnitudes and packs it to one bit per pixel: bit j%8 of bits[j/8] is
+// set when mag[j] >= threshold (1..255), least significant bit first, and
+// the unused high bits of the last byte are 0. nmsRow is Canny-style
+// non-maximum suppression: it gets the three gray rows and the three
+// magnitude rows around the output row and keeps mag[1][j] only where it
+// is a maximum along the gradient direction (from the 3x3 Sobel
+// derivatives, quantised to 0, 45, 90 or 135 degrees), else writes 0.
+// The neighbour above or to the left must be strictly smaller, the other
+// one at most equal, so a two-pixel-wide ridge stays one pixel wide.
+typedef void (*edge_row_fn)(const uint8_t *mag, uint8_t *bits, int width, int threshold);
+typedef void (*nms_row_fn)(const uint8_t *const *gray, const uint8_t *const *mag,
+                           uint8_t *out, int width);
+
+#define CONV_MAX_TAPS 5
+
+struct conv_op {
+  const char *name;
+  int radius;
+};
+extern const struct conv_op conv_ops[CONV_NUM_OPS];
+
+struct sobel_kernels {
+  const char *name;
+  gray_row_fn grayRow;
+  sobel_row_fn sobelRow;
+  gray_row_fn grayRowFixed[SOBEL_NUM_FIXED];
+  sobel_row_fn sobelRowFixed[SOBEL_NUM_FIXED];
+  conv_row_fn convRow[CONV_NUM_OPS][CONV_NUM_MAGS];
+  // Sum of absolute differences of two rows of `width` bytes
+  uint32_t (*sadRow)(const uint8_t *a, const uint8_t *b, int width);
+  // Sum of a row of `width` bytes (frame_stats.h tile sums)
+  uint32_t (*sumRow)(const uint8_t *p, int width);
+  edge_row_fn edgeRow;
+  nms_row_fn nmsRow;
+};
+
+// Builds a backend's table from its kernel templates, `template <int W>`,
+// where W == 0 is the generic runtime-width version, and its conv_engine.h
+// vector type, which also builds nmsRow. Keep the widths in step with
+// sobel_fixed_widths.
+#define SOBEL_KERNEL_TABLE(name, gray, sobel, vec, sad, sum, edge) \
+  { name, gray<0>, sobel<0>, \
+    { gray<640>, gray<1280>, gray<1920>, gray<3840> }, \
+    { sobel<640>, sobel<1280>, sobel<1920>, sobel<3840> }, \
+    SOBEL_CONV_TABLE(vec), sad, sum, edge, nmsRow<vec> }
+
+// Scalar reference, also used by the vector backends for their tails.
+// Both work on the half-open pixel range [start, end); for sobelRowScalar the
+// range must lie inside [1, width-1).
+void grayRowScalar(const uint8_t *bgr, uint8_t *gray, int start, int end);
+void sobelRowScalar(const uint8_t *above, const uint8_t *row,
+                    const uint8_t *below, uint8_t *out, int start, int end);
+uint32_t sadRowScalar(const uint8_t *a, const uint8_t *b, int start, int end);
+uint32_t sumRowScalar(const uint8_t *p, int start, int end);
+// start must be a multiple of 8
+void edgeRowScalar(const uint8_t *mag, uint8_t *bits, int start, int end, int threshold);
+
+extern const struct sobel_kernels sobel_kernels_scalar;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+extern const struct sobel_kernels sobel_kernels_neon;
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+extern const struct sobel_kernels sobel_kernels_sse2;
+extern const struct sobel_kernels sobel_kernels_avx2;
+extern const struct sobel_kernels sobel_kernels_avx512;
+#endif
+
+// Active backend. Defaults to the scalar reference until selectKernels runs.
+extern const struct sobel_kernels *kernels;
+// Operator used by sobelCalc/sobelFused (-k). CONV_SOBEL with CONV_L1 runs
+// the hand-written sobelRow; anything else goes through convRow.
+extern int convOp, convMag;
+
+// Row kernels of the active backend for frames `width` pixels wide: the
+// fixed-width instantiation if there is one, else the generic kernel
+gray_row_fn grayRowFor(int width);
+sobel_row_fn sobelRowFor(int width);
+
+// Picks the widest backend the CPU supports, or the one named by `name`
+// ("scalar", "neon", "sse2", "avx2", "avx512"). Returns NULL if the named
+// backend is unknown or unsupported on this host.
+const struct sobel_kernels *selectKernels(const char *name);
+
+#endif
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include <iostream>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <err.h>
+#include <atomic>
+
+#include "sobel_alg.h"
+#include "sobel_kernels.h"
+#include "pc.h"
+#include "spsc.h"
+#include "frame_pool.h"
+#include "alloc_count.h"
+#include "frame_source.h"
+#include "histogram.h"
+#include "trace.h"
+#include "affinity.h"
+
+using namespace cv;
+using namespace std;
+
+// Captured frames in flight per stream. Power of two (spsc_ring).
+#define MULTI_SLOTS 4
+
+struct multi_frame {
+  frame_buf_t *src;
+  uint64_t t_capture;   // before the source read
+  uint64_t t_captured;  // frame copied into its buffer
+};
+
+enum { MLAT_QUEUE, MLAT_COMPUTE, MLAT_E2E, MLAT_STAGES };
+
+// One input. Its capture thread owns the source and fills slots; the
+// scheduler (this file's main loop) owns everything below the rings.
+struct multi_stream {
+  const stream_spec *spec;
+  frame_source_t *source;
+  pthread_t thread;
+  int self;
+  frame_pool_t srcPool;
+  multi_frame slots[MULTI_SLOTS];
+  // freeQ: scheduler -> capture (recycled slots)
+  // readyQ: capture -> scheduler; a NULL frame marks the end of the stream
+  spsc_ring<multi_frame *, MULTI_SLOTS> freeQ, readyQ;
+
+  // Scheduler only
+  multi_frame *next;     // taken from readyQ, waiting for the pool
+  int idle;              // readyQ was empty at the last look
+  int finished;
+  uint64_t pass;         // pool time used, scaled by 1/weight
+  uint64_t frames, busy_ns, queue_ns;
+  char window[32];
+  char names[MLAT_STAGES][32];
+};
+
+static multi_stream streams[MAX_STREAMS];
+static std::atomic<int> stop;
+
+static ofstream results_file;
+
+// latency[0] is end-to-end over every stream, then MLAT_STAGES per stream
+static hist_t latency[1 + MAX_STREAMS * MLAT_STAGES];
+
+/*******************************************
+ * Model: captureStream
+ * Input: multi_stream* to capture for
+ * Output: None
+ * Desc: One per stream: reads up to opts.numFrames frames into free
+ *  slots and hands them to the scheduler. Captures are only valid until
+ *  the next read, so each frame is copied into the stream's pool. Decode
+ *  is per input and mostly waiting, so it keeps its own thread; all the
+ *  filtering happens on the shared pool.
+ ********************************************/
+static void *captureStream(void *ptr)
+{
+  multi_stream *s = (multi_stream *)ptr;
+  frame_source_t *source = s->source;
+  Mat img;
+
+  if (trace_on) {
+    char name[32];
+    snprintf(name, sizeof(name), "capture %d", s->self);
+    trace_thread_name(name);
+  }
+  AFFINITY_THREAD(AFF_CAPTURE, s->self);
+  for (int n = 0; n < opts.numFrames && !stop.load(); n++) {
+    multi_frame *f;
+    TRACE_BEGIN("wait free slot");
+    s->freeQ.popWait(f);
+    TRACE_END("wait free slot");
+
+    TRACE_BEGIN("capture");
+    f->t_capture = pc_now_ns();
+    if (!source->read(source, img)) {
+      TRACE_END("capture");
+      s->freeQ.pushWait(f);
+      break;
+    }
+    f->src = fpool_get(&s->srcPool);
+    img.copyTo(f->src->mat);
+    f->t_captured = pc_now_ns();
+    TRACE_END("capture");
+    TRACE_BEGIN("wait scheduler");
+    s->readyQ.pushWait(f);
+    TRACE_END("wait scheduler");
+  }
+  s->readyQ.pushWait(NULL);
+  return NULL;
+}
+
+/*******************************************
+ * Model: pickStream
+ * Input: virtual time (pass of the last stream served)
+ * Output: stream to run next, or NULL if none has a frame waiting
+ * Desc: Stride scheduling over pool time. Each stream's pass grows by
+ *  the time its frames held the pool divided by its weight, and the
+ *  stream with a waiting frame and the lowest pass goes next, so under
+ *  load stream k gets weight_k / sum(weights) of the pool. A stream that
+ *  had nothing waiting is moved up to the virtual time when its next
+ *  frame arrives, so idling never banks credit for a burst later.
+ ********************************************/
+static multi_stream *pickStream(int nstreams, uint64_t vtime, int *active)
+{
+  multi_stream *best = NULL;
+
+  for (int k = 0; k < nstreams; k++) {
+    multi_stream *s = &streams[k];
+    if (s->finished) {
+      continue;
+    }
+    if (s->next == NULL) {
+      multi_frame *f;
+      if (!s->readyQ.pop(f)) {
+        s->idle = 1;
+        continue;
+      }
+      if (f == NULL) {
+        s->finished = 1;
+        (*active)--;
+        continue;
+      }
+      if (s->idle && s->pass < vtime) {
+        s->pass = vtime;
+      }
+      s->idle = 0;
+      s->next = f;
+    }
+    if (best == NULL || s->pass < best->pass) {
+      best = s;
+    }
+  }
+  return best;
+}
+
+/*******************************************
+ * Model: runSobelMulti
+ * Input: the worker pool every stream shares
+ * Output: None
+ * Desc: Multi-stream mode, for several -f/-w inputs in one process. Each
+ *  input has a capture thread and a few slots; this thread picks the next
+ *  frame by weight (pickStream), filters it band-parallel on the pool and
+ *  shows it in the stream's window. The gray and Sobel scratch frames are
+ *  sized for the largest input and shared, since only one frame is on
+ *  the pool at a time. Writes multi_perf.csv with aggregate and
+ *  per-stream results.
+ ********************************************/
+void runSobelMulti(pool_t *pool)
+{
+  int nstreams = opts.numStreams;
+  int maxRows = 0, maxCols = 0, active = nstreams, n = 0;
+  uint64_t vtime = 0, allocs_start = 0;
+  frame_pool_t scratchPool;
+
+  hist_init(&latency[0], "e2e");
+  for (int k = 0; k < nstreams; k++) {
+    multi_stream *s = &streams[k];
+    s->spec = &opts.streams[k];
+    s->self = k;
+    s->source = openStreamSource(s->spec);
+    int rows = s->source->height, cols = s->source->width;
+    maxRows = rows > maxRows ? rows : maxRows;
+    maxCols = cols > maxCols ? cols : maxCols;
+    fpool_init(&s->srcPool, MULTI_SLOTS, rows, cols, s->source->type, opts.hugepages);
+    s->next = NULL;
+    s->idle = 1;
+    s->finished = 0;
+    s->pass = 0;
+    s->frames = s->busy_ns = s->queue_ns = 0;
+    snprintf(s->window, sizeof(s->window), "Sobel Top %d", k);
+    snprintf(s->names[MLAT_QUEUE], sizeof(s->names[0]), "stream %d queue", k);
+    snprintf(s->names[MLAT_COMPUTE], sizeof(s->names[0]), "stream %d compute", k);
+    snprintf(s->names[MLAT_E2E], sizeof(s->names[0]), "stream %d e2e", k);
+    for (int l = 0; l < MLAT_STAGES; l++) {
+      hist_init(&latency[1 + k * MLAT_STAGES + l], s->names[l]);
+    }
+  }
+  fpool_init(&scratchPool, 2, maxRows, maxCols, CV_8UC1, opts.hugepages);
+  frame_buf_t *grayBuf = fpool_get(&scratchPool);
+  frame_buf_t *sobelBuf = fpool_get(&scratchPool);
+  stop.store(0);
+  uint64_t t_start = pc_now_ns();
+
+  int ret;
+  for (int k = 0; k < nstreams; k++) {
+    multi_stream *s = &streams[k];
+    for (int j = 0; j < MULTI_SLOTS; j++) {
+      s->freeQ.pushWait(&s->slots[j]);
+    }
+    if ((ret = pthread_create(&s->thread, NULL, captureStream, s))) {
+      errx(1, "Thread creation failed: %d", ret);
+    }
+  }
+
+  while (active > 0) {
+    multi_stream *s = pickStream(nstreams, vtime, &active);
+    if (s == NULL) {
+      TRACE_BEGIN("wait frame");
+      sched_yield();
+      TRACE_END("wait frame");
+      continue;
+    }
+    multi_frame *f = s->next;
+    s->next = NULL;
+    // After q, frames already captured are only handed back
+    if (stop.load()) {
+      fbuf_unref(f->src);
+      s->freeQ.pushWait(f);
+      continue;
+    }
+
+    TRACE_BEGIN("compute");
+    uint64_t t_compute = pc_now_ns();
+    Mat& src = f->src->mat;
+    Mat gray = grayBuf->mat(Range(0, src.rows), Range(0, src.cols));
+    Mat img_sobel = sobelBuf->mat(Range(0, src.rows), Range(0, src.cols));
+    if (opts.fused) {
+      sobelFusedMT(pool, src, img_sobel);
+    } else {
+      grayScaleMT(pool, src, gray);
+      sobelMT(pool, gray, img_sobel);
+    }
+    uint64_t t_computed = pc_now_ns();
+    TRACE_END("compute");
+
+    TRACE_BEGIN("display");
+    if (!opts.headless) {
+      namedWindow(s->window, CV_WINDOW_AUTOSIZE);
+      imshow(s->window, img_sobel);
+      // Press q to exit; capture threads stop after their current frame
+      char c = cvWaitKey(1);
+      if (c == 'q') {
+        stop.store(1);
+      }
+    }
+    uint64_t t_shown = pc_now_ns();
+    TRACE_END("display");
+
+    vtime = s->pass;
+    s->pass += (t_computed - t_compute) * MAX_STREAM_WEIGHT / s->spec->weight;
+    s->busy_ns += t_computed - t_compute;
+    s->queue_ns += t_compute - f->t_captured;
+    if (s->frames >= WARMUP_FRAMES) {
+      hist_t *h = &latency[1 + s->self * MLAT_STAGES];
+      hist_add(&h[MLAT_QUEUE], t_compute - f->t_captured);
+      hist_add(&h[MLAT_COMPUTE], t_computed - t_compute);
+      hist_add(&h[MLAT_E2E], t_shown - f->t_capture);
+      hist_add(&latency[0], t_shown - f->t_capture);
+    }
+    s->frames++;
+    n++;
+    if (n == WARMUP_FRAMES * nstreams) {
+      allocs_start = alloc_count();
+    }
+    fbuf_unref(f->src);
+    s->freeQ.pushWait(f);
+  }
+  uint64_t t_end = pc_now_ns();
+  uint64_t allocs = alloc_count() - allocs_start;
+
+  uint64_t busy = 0;
+  for (int k = 0; k < nstreams; k++) {
+    pthread_join(streams[k].thread, NULL);
+    busy += streams[k].busy_ns;
+  }
+
+  double secs = (t_end - t_start) / 1e9;
+  hist_t *e2e = &latency[0];
+  results_file.open("multi_perf.csv", ios::out);
+  results_file << "Summary" << endl;
+  results_file << "Throughput (frames per second), " << n/secs << endl;
+  results_file << "Total frames, " << n << endl;
+  results_file << "Streams, " << nstreams << endl;
+  results_file << "Compute threads, " << pool->nthreads << endl;
+  results_file << "Pool busy (%), " << busy/1e7/secs << endl;
+  results_file << "End-to-end latency p50 (ms), " << hist_percentile(e2e, 50)/1e6 << endl;
+  results_file << "End-to-end latency p99 (ms), " << hist_percentile(e2e, 99)/1e6 << endl;
+  results_file << "Latency histograms, multi_latency.csv multi_latency.json" << endl;
+  results_file << "Kernel backend, " << kernels->name << endl;
+  results_file << "Operator, " << conv_ops[convOp].name << (convMag == CONV_L2 ? " L2" : " L1") << endl;
+  results_file << "Kernel mode, " << (opts.fused ? "fused" : "two-pass") << endl;
+  results_file << "Huge pages, " << (scratchPool.hugepages ? "yes" : "no") << endl;
+  results_file << "Heap allocations after warm-up, " << (n > WARMUP_FRAMES * nstreams ? allocs : 0) << endl;
+  affinity_report(results_file);
+
+  results_file << "\nStream, Source, Size, Weight, Frames, Frames per second, Pool time (%), "
+               << "Queue wait mean (ms), Compute mean (ms), End-to-end p50 (ms), End-to-end p99 (ms)" << endl;
+  for (int k = 0; k < nstreams; k++) {
+    multi_stream *s = &streams[k];
+    uint64_t frames = s->frames ? s->frames : 1;
+    hist_t *h = &latency[1 + k * MLAT_STAGES];
+    results_file << k << ", ";
+    if (s->spec->videoFile) {
+      results_file << s->spec->videoFile;
+    } else {
+      results_file << "camera " << s->spec->camera;
+    }
+    results_file << ", " << s->source->width << "x" << s->source->height
+                 << ", " << s->spec->weight << ", " << s->frames
+                 << ", " << s->frames/secs
+                 << ", " << (busy ? 100.0*s->busy_ns/busy : 0)
+                 << ", " << s->queue_ns/1e6/frames
+                 << ", " << s->busy_ns/1e6/frames
+                 << ", " << hist_percentile(&h[MLAT_E2E], 50)/1e6
+                 << ", " << hist_percentile(&h[MLAT_E2E], 99)/1e6 << endl;
+  }
+  results_file.close();
+  hist_report("multi", latency, 1 + nstreams * MLAT_STAGES);
+
+  for (int k = 0; k < nstreams; k++) {
+    closeFrameSource(streams[k].source);
+    fpool_destroy(&streams[k].srcPool);
+  }
+  fbuf_unref(grayBuf);
+  fbuf_unref(sobelBuf);
+  fpool_destroy(&scratchPool);
+}
@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include <iostream>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <err.h>
+#include <atomic>
+
+#include "sobel_alg.h"
+#include "sobel_kernels.h"
+#include "pc.h"
+#include "frame_pool.h"
+#include "frame_source.h"
+#include "alloc_count.h"
+#include "histogram.h"
+#include "trace.h"
+#include "affinity.h"
+#include "frame_sink.h"
+
+using namespace cv;
+using namespace std;
+
+// Frames between the reader and the writer are held in a window of
+// OFFLINE_WINDOW slots keyed by frame index: slot n % window. The reader
+// never runs more than `window` frames ahead of the writer, so a slot is
+// never reused while its frame is still in flight.
+#define OFFLINE_WINDOW FRAME_POOL_MAX
+
+struct offline_frame {
+  frame_buf_t *src, *sobel;
+  Mat in;
+  std::atomic<int> done;   // result ready for the writer
+  uint64_t t_capture, t_captured, t_computed;
+};
+
+static offline_frame frames[OFFLINE_WINDOW];
+static int window;
+static frame_pool_t srcPool, grayPool, sobelPool;
+
+// The shared work queue is two tickets over the frame index: the reader
+// publishes frames in order and each worker claims the next unclaimed
+// index. `total` is set once the source runs dry.
+static std::atomic<int> published, claimed, written, total, stop;
+
+struct offline_worker {
+  pthread_t thread;
+  int self;
+  int frames;
+} __attribute__((aligned(64)));
+
+static offline_worker workers[MAX_THREADS];
+static ofstream results_file;
+
+enum { LAT_CAPTURE, LAT_COMPUTE, LAT_REORDER, LAT_E2E, LAT_STAGES };
+static hist_t latency[LAT_STAGES];
+
+/*******************************************
+ * Model: readerStage
+ * Input: frame_source_t* to read from
+ * Output: None
+ * Desc: Reads frames into window slots in order and publishes each one
+ *  to the workers. Live frames are copied into the src pool; persistent
+ *  sources are passed on in place.
+ ********************************************/
+static void *readerStage(void *ptr)
+{
+  frame_source_t *source = (frame_source_t *)ptr;
+  Mat img;
+  int n;
+
+  TRACE_THREAD("reader");
+  AFFINITY_THREAD(AFF_CAPTURE, 0);
+  for (n = 0; n < opts.numFrames && !stop.load(); n++) {
+    TRACE_BEGIN("wait window");
+    while (n - written.load(std::memory_order_acquire) >= window) {
+      sched_yield();
+    }
+    TRACE_END("wait window");
+
+    TRACE_BEGIN("capture");
+    offline_frame *f = &frames[n % window];
+    f->t_capture = pc_now_ns();
+    if (!source->read(source, img)) {
+      TRACE_END("capture");
+      break;
+    }
+    if (source->persistent) {
+      f->src = NULL;
+      f->in = img;
+    } else {
+      f->src = fpool_get(&srcPool);
+      f->in = f->src->mat;
+      img.copyTo(f->in);
+    }
+    f->t_captured = pc_now_ns();
+    TRACE_END("capture");
+    published.store(n + 1, std::memory_order_release);
+  }
+  total.store(n, std::memory_order_release);
+  return NULL;
+}
+
+/*******************************************
+ * Model: workerStage
+ * Input: offline_worker* for this thread
+ * Output: None
+ * Desc: Claims the next frame index, waits for the reader to publish it,
+ *  and runs the single-threaded kernels on the whole frame. Workers never
+ *  wait on each other; the writer puts results back in order.
+ ********************************************/
+static void *workerStage(void *ptr)
+{
+  offline_worker *w = (offline_worker *)ptr;
+  frame_buf_t *gray = fpool_get(&grayPool);
+
+  if (trace_on) {
+    char name[32];
+    snprintf(name, sizeof(name), "offline worker %d", w->self);
+    trace_thread_name(name);
+  }
+  AFFINITY_THREAD(AFF_COMPUTE, w->self);
+  while (1) {
+    int n = claimed.fetch_add(1, std::memory_order_relaxed);
+    TRACE_BEGIN("wait frame");
+    while (published.load(std::memory_order_acquire) <= n) {
+      int t = total.load(std::memory_order_acquire);
+      if (t >= 0 && n >= t) {
+        break;
+      }
+      sched_yield();
+    }
+    TRACE_END("wait frame");
+    if (published.load(std::memory_order_acquire) <= n) {
+      break;
+    }
+
+    TRACE_BEGIN("compute");
+    offline_frame *f = &frames[n % window];
+    f->sobel = fpool_get(&sobelPool);
+    Mat& src = f->in;
+    Mat& img_sobel = f->sobel->mat;
+    if (src.channels() == 1) {
+      sobelCalc(src, img_sobel);
+    } else if (opts.fused) {
+      sobelFused(src, img_sobel);
+    } else {
+      grayScale(src, gray->mat);
+      sobelCalc(gray->mat, img_sobel);
+    }
+    f->in.release();
+    if (f->src) {
+      fbuf_unref(f->src);
+      f->src = NULL;
+    }
+    f->t_computed = pc_now_ns();
+    w->frames++;
+    f->done.store(1, std::memory_order_release);
+    TRACE_END("compute");
+  }
+  fbuf_unref(gray);
+  return NULL;
+}
+
+/*******************************************
+ * Model: runSobelOffline
+ * Input: number of worker threads
+ * Output: None
+ * Desc: Batch mode for recorded input, tuned for throughput rather than
+ *  latency. A reader thread decodes frames, K workers each filter whole
+ *  frames, and this thread writes them out (displays, unless -H) strictly
+ *  in frame order, whatever order they finish in. With no per-frame
+ *  barrier, throughput scales with cores until decode is the limit.
+ ********************************************/
+void runSobelOffline(int nworkers)
+{
+  string top = "Sobel Top";
+  pthread_t reader;
+  uint64_t allocs_start = 0;
+  int n = 0;
+
+  frame_source_t *source = openFrameSource();
+  int rows = source->height, cols = source->width;
+  window = 2 * nworkers + 2;
+  if (window > OFFLINE_WINDOW) {
+    window = OFFLINE_WINDOW;
+  }
+  if (!source->persistent) {
+    fpool_init(&srcPool, window, rows, cols, source->type, opts.hugepages);
+  }
+  fpool_init(&grayPool, nworkers, rows, cols, CV_8UC1, opts.hugepages);
+  fpool_init(&sobelPool, window, rows, cols, CV_8UC1, opts.hugepages);
+  output_t *output = openOutput(rows, cols);
+  hist_init(&latency[LAT_CAPTURE], "capture");
+  hist_init(&latency[LAT_COMPUTE], "compute");
+  hist_init(&latency[LAT_REORDER], "reorder");
+  hist_init(&latency[LAT_E2E], "e2e");
+  published.store(0);
+  claimed.store(0);
+  written.store(0);
+  total.store(-1);
+  stop.store(0);
+  uint64_t t_start = pc_now_ns();
+
+  int ret;
+  if ((ret = pthread_create(&reader, NULL, readerStage, source))) {
+    errx(1, "Thread creation failed: %d", ret);
+  }
+  for (int k = 0; k < nworkers; k++) {
+    workers[k].self = k;
+    workers[k].frames = 0;
+    if ((ret = pthread_create(&workers[k].thread, NULL, workerStage, &workers[k]))) {
+      errx(1, "Thread creation failed: %d", ret);
+    }
+  }
+
+  // Reorder: frame n is written only after frames 0..n-1
+  while (1) {
+    offline_frame *f = &frames[n % window];
+    TRACE_BEGIN("wait reorder");
+    while (!f->done.load(std::memory_order_acquire)) {
+      int t = total.load(std::memory_order_acquire);
+      if (t >= 0 && n >= t) {
+        break;
+      }
+      sched_yield();
+    }
+    TRACE_END("wait reorder");
+    if (!f->done.load(std::memory_order_acquire)) {
+      break;
+    }
+
+    TRACE_BEGIN("display");
+    if (output) {
+      output_push(output, f->sobel->mat);
+    }
+    if (!opts.headless) {
+      namedWindow(top, CV_WINDOW_AUTOSIZE);
+      imshow(top, f->sobel->mat);
+      char c = cvWaitKey(1);
+      if (c == 'q') {
+        stop.store(1);
+      }
+    }
+    uint64_t t_written = pc_now_ns();
+    TRACE_END("display");
+
+    if (n >= WARMUP_FRAMES) {
+      hist_add(&latency[LAT_CAPTURE], f->t_captured - f->t_capture);
+      hist_add(&latency[LAT_COMPUTE], f->t_computed - f->t_captured);
+      hist_add(&latency[LAT_REORDER], t_written - f->t_computed);
+      hist_add(&latency[LAT_E2E], t_written - f->t_capture);
+    }
+    fbuf_unref(f->sobel);
+    f->sobel = NULL;
+    f->done.store(0, std::memory_order_relaxed);
+    n++;
+    written.store(n, std::memory_order_release);
+    if (n == WARMUP_FRAMES) {
+      allocs_start = alloc_count();
+    }
+  }
+  uint64_t t_end = pc_now_ns();
+  uint64_t allocs = alloc_count() - allocs_start;
+
+  pthread_join(reader, NULL);
+  int minFrames = n, maxFrames = 0;
+  for (int k = 0; k < nworkers; k++) {
+    pthread_join(workers[k].thread, NULL);
+    minFrames = workers[k].frames < minFrames ? workers[k].frames : minFrames;
+    maxFrames = workers[k].frames > maxFrames ? workers[k].frames : maxFrames;
+  }
+
+  hist_t *e2e = &latency[LAT_E2E];
+  results_file.open("offline_perf.csv", ios::out);
+  results_file << "Summary" << endl;
+  results_file << "Throughput (frames per second), " << n/((t_end - t_start)/1e9) << endl;
+  results_file << "Total frames, " << n << endl;
+  results_file << "Workers, " << nworkers << endl;
+  results_file << "Reorder window (frames), " << window << endl;
+  results_file << "Frames per worker min, " << minFrames << endl;
+  results_file << "Frames per worker max, " << maxFrames << endl;
+  results_file << "End-to-end latency p50 (ms), " << hist_percentile(e2e, 50)/1e6 << endl;
+  results_file << "End-to-end latency p99 (ms), " << hist_percentile(e2e, 99)/1e6 << endl;
+  results_file << "Latency histograms, offline_latency.csv offline_latency.json" << endl;
+  results_file << "Frame source, " << source->name << " " << cols << "x" << rows << endl;
+  results_file << "Kernel backend, " << kernels->name << endl;
+  results_file << "Operator, " << conv_ops[convOp].name << (convMag == CONV_L2 ? " L2" : " L1") << endl;
+  results_file << "Kernel mode, " << (source->type == CV_8UC1 ? "gray input" : opts.fused ? "fused" : "two-pass") << endl;
+  results_file << "Heap allocations after warm-up, " << (n > WARMUP_FRAMES ? allocs : 0) << endl;
+  affinity_report(results_file);
+  if (output) {
+    closeOutput(output, results_file);
+  }
+
+  closeFrameSource(source);
+  results_file.close();
+  hist_report("offline", latency, LAT_STAGES);
+  fpool_destroy(&srcPool);
+  fpool_destroy(&grayPool);
+  fpool_destroy(&sobelPool);
+}
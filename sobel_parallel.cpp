@@ -0,0 +1,106 @@
+#include "opencv2/imgproc/imgproc.hpp"
+#include "sobel_alg.h"
+#include "frame_stats.h"
+
+using namespace cv;
+
+// One frame's worth of pool work: each task is one row band of these
+// shared frames. Bands read one halo row from their neighbours, so the
+// result is identical to the single-threaded version.
+struct frame_job {
+  Mat *src, *gray, *sobel;
+  int threshold, nms;     // sobelEdgeMT only
+  frame_stats *stats;     // the calling thread's statsSink
+  struct tile tiles[MAX_TILES];
+  int ntiles;
+  int rows;
+  pool_t *pool;
+};
+// Per calling thread, so independent pools (libsobel contexts) can run
+// frames from different threads at once
+static __thread frame_job frameJob;
+
+static void grayTask(void *arg, int t)
+{
+  frame_job *job = (frame_job *)arg;
+  grayScaleRows(*job->src, *job->gray, job->tiles[t].rowStart, job->tiles[t].rowEnd);
+}
+
+static void sobelTask(void *arg, int t)
+{
+  frame_job *job = (frame_job *)arg;
+  sobelCalcRows(*job->gray, *job->sobel, job->tiles[t].rowStart, job->tiles[t].rowEnd,
+                job->stats);
+}
+
+static void fusedTask(void *arg, int t)
+{
+  frame_job *job = (frame_job *)arg;
+  sobelFusedRows(*job->src, *job->sobel, job->tiles[t].rowStart, job->tiles[t].rowEnd,
+                 job->stats);
+}
+
+static void edgeTask(void *arg, int t)
+{
+  frame_job *job = (frame_job *)arg;
+  sobelEdgeRows(*job->gray, *job->sobel, job->tiles[t].rowStart, job->tiles[t].rowEnd,
+                job->threshold, job->nms, job->stats);
+}
+
+/*******************************************
+ * Model: grayScaleMT / sobelMT
+ * Input: worker pool, source frame(s)
+ * Output: None directly. Modifies img_gray_out / img_sobel_out
+ * Desc: Frame-level entry points that spread grayScaleRows,
+ *  sobelCalcRows, sobelFusedRows or sobelEdgeRows over the pool. The frame is cut into
+ *  TILES_PER_THREAD bands per pool thread so idle workers can steal from
+ *  slow ones; bands stay at least MIN_TILE_ROWS tall to keep the fused
+ *  halo rows cheap. Only one thread at a time may use a given pool.
+ *  Stats started on the calling thread are filled by whichever workers
+ *  run the bands.
+ ********************************************/
+static void prepareJob(pool_t *pool, Mat& src, Mat& img_gray, Mat& img_sobel)
+{
+  frameJob.src = &src;
+  frameJob.gray = &img_gray;
+  frameJob.sobel = &img_sobel;
+  frameJob.stats = statsSink;
+  if (frameJob.rows != src.rows || frameJob.pool != pool) {
+    frameJob.rows = src.rows;
+    frameJob.pool = pool;
+    frameJob.ntiles = pool->nthreads * TILES_PER_THREAD;
+    if (frameJob.ntiles > src.rows / MIN_TILE_ROWS) {
+      frameJob.ntiles = src.rows / MIN_TILE_ROWS;
+    }
+    if (frameJob.ntiles < 1) {
+      frameJob.ntiles = 1;
+    }
+    splitRows(src.rows, frameJob.ntiles, frameJob.tiles);
+  }
+}
+
+void grayScaleMT(pool_t *pool, Mat& img, Mat& img_gray_out)
+{
+  prepareJob(pool, img, img_gray_out, img_gray_out);
+  pool_run(pool, grayTask, &frameJob, frameJob.ntiles);
+}
+
+void sobelMT(pool_t *pool, Mat& img_gray, Mat& img_sobel_out)
+{
+  prepareJob(pool, img_gray, img_gray, img_sobel_out);
+  pool_run(pool, sobelTask, &frameJob, frameJob.ntiles);
+}
+
+void sobelFusedMT(pool_t *pool, Mat& img, Mat& img_sobel_out)
+{
+  prepareJob(pool, img, img, img_sobel_out);
+  pool_run(pool, fusedTask, &frameJob, frameJob.ntiles);
+}
+
+void sobelEdgeMT(pool_t *pool, Mat& img_gray, Mat& img_edges, int threshold, int nms)
+{
+  prepareJob(pool, img_gray, img_gray, img_edges);
+  frameJob.threshold = threshold;
+  frameJob.nms = nms;
+  pool_run(pool, edgeTask, &frameJob, frameJob.ntiles);
+}
@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include <iostream>
+#include <fstream>
+#include <pthread.h>
+#include <err.h>
+#include <atomic>
+
+#include "sobel_alg.h"
+#include "sobel_kernels.h"
+#include "pc.h"
+#include "spsc.h"
+#include "frame_pool.h"
+#include "alloc_count.h"
+#include "frame_source.h"
+#include "histogram.h"
+#include "trace.h"
+#include "affinity.h"
+#include "frame_sink.h"
+
+using namespace cv;
+using namespace std;
+
+// Frames in flight: one per stage plus one so capture can run ahead
+#define PIPE_SLOTS 4
+
+// Frame buffers come from preallocated pools and are reference counted:
+// capture takes a src buffer, compute takes a sobel (and gray) buffer and
+// drops src, display drops sobel. Nothing is allocated per frame.
+static frame_pool_t srcPool, grayPool, sobelPool;
+
+struct pipe_frame {
+  frame_buf_t *src, *sobel;
+  cv::Mat in;           // the frame to filter: src's buffer, or the source's own
+  int index;
+  uint64_t t_capture;   // before the source read
+  uint64_t t_captured;  // frame copied into the slot
+  uint64_t t_computed;  // Sobel output ready
+};
+
+static pipe_frame frames[PIPE_SLOTS];
+
+// freeQ: display -> capture (recycled slots)
+// capQ:  capture -> compute
+// dispQ: compute -> display
+// A NULL frame marks the end of the stream.
+static spsc_ring<pipe_frame *, PIPE_SLOTS> freeQ, capQ, dispQ;
+static std::atomic<int> stop;
+
+static ofstream results_file;
+
+// Per-stage wall-clock latency of every frame after warm-up
+enum { LAT_CAPTURE, LAT_COMPUTE, LAT_DISPLAY, LAT_E2E, LAT_STAGES };
+static hist_t latency[LAT_STAGES];
+
+/*******************************************
+ * Model: captureStage
+ * Input: frame_source_t* to read from
+ * Output: None
+ * Desc: Decodes frames into free slots until opts.numFrames have been
+ *  read, the source runs dry or the display asks to stop. A frame from a
+ *  live source is only valid until the next read, so it is copied into a
+ *  pooled buffer; persistent sources (memory, frame cache) are passed on
+ *  in place.
+ ********************************************/
+static void *captureStage(void *ptr)
+{
+  frame_source_t *source = (frame_source_t *)ptr;
+  Mat img;
+
+  TRACE_THREAD("capture");
+  AFFINITY_THREAD(AFF_CAPTURE, 0);
+  for (int n = 0; n < opts.numFrames && !stop.load(); n++) {
+    pipe_frame *f;
+    TRACE_BEGIN("wait free slot");
+    freeQ.popWait(f);
+    TRACE_END("wait free slot");
+
+    TRACE_BEGIN("capture");
+    f->t_capture = pc_now_ns();
+    if (!source->read(source, img)) {
+      TRACE_END("capture");
+      freeQ.pushWait(f);
+      break;
+    }
+    if (source->persistent) {
+      f->src = NULL;
+      f->in = img;
+    } else {
+      f->src = fpool_get(&srcPool);
+      f->in = f->src->mat;
+      img.copyTo(f->in);
+    }
+    f->index = n;
+    f->t_captured = pc_now_ns();
+    TRACE_END("capture");
+    TRACE_BEGIN("wait compute");
+    capQ.pushWait(f);
+    TRACE_END("wait compute");
+  }
+  capQ.pushWait(NULL);
+  return NULL;
+}
+
+/*******************************************
+ * Model: computeStage
+ * Input: worker pool, or NULL to compute on this thread alone
+ * Output: None
+ * Desc: Runs grayscale + Sobel on each captured frame while the next one
+ *  is being decoded and the previous one is on screen.
+ ********************************************/
+static void *computeStage(void *ptr)
+{
+  pool_t *pool = (pool_t *)ptr;
+  pipe_frame *f;
+
+  TRACE_THREAD("compute");
+  AFFINITY_THREAD(AFF_COMPUTE, 0);
+  while (1) {
+    TRACE_BEGIN("wait frame");
+    capQ.popWait(f);
+    TRACE_END("wait frame");
+    if (f == NULL) {
+      break;
+    }
+    TRACE_BEGIN("compute");
+    f->sobel = fpool_get(&sobelPool);
+    Mat& src = f->in;
+    Mat& img_sobel = f->sobel->mat;
+    if (src.channels() == 1) {
+      if (pool) {
+        sobelMT(pool, src, img_sobel);
+      } else {
+        sobelCalc(src, img_sobel);
+      }
+    } else if (opts.fused) {
+      if (pool) {
+        sobelFusedMT(pool, src, img_sobel);
+      } else {
+        sobelFused(src, img_sobel);
+      }
+    } else {
+      frame_buf_t *gray = fpool_get(&grayPool);
+      if (pool) {
+        grayScaleMT(pool, src, gray->mat);
+        sobelMT(pool, gray->mat, img_sobel);
+      } else {
+        grayScale(src, gray->mat);
+        sobelCalc(gray->mat, img_sobel);
+      }
+      fbuf_unref(gray);
+    }
+    f->in.release();
+    if (f->src) {
+      fbuf_unref(f->src);
+      f->src = NULL;
+    }
+    f->t_computed = pc_now_ns();
+    TRACE_END("compute");
+    TRACE_BEGIN("wait display");
+    dispQ.pushWait(f);
+    TRACE_END("wait display");
+  }
+  dispQ.pushWait(NULL);
+  return NULL;
+}
+
+/*******************************************
+ * Model: runSobelPipe
+ * Input: worker pool for the compute stage, or NULL for one compute thread
+ * Output: None
+ * Desc: Three-stage pipeline: a capture thread decodes frame N+1 while a
+ *  compute thread filters frame N and this thread displays frame N-1
+ *  (HighGUI has to stay on the main thread). Stages hand frames over
+ *  through bounded SPSC rings. Reports throughput and per-frame
+ *  end-to-end latency (start of capture to end of display). With -H the
+ *  display stage only retires frames.
+ ********************************************/
+void runSobelPipe(pool_t *pool)
+{
+  string top = "Sobel Top";
+  pthread_t capture, compute;
+  uint64_t cap_total = 0, comp_total = 0, disp_total = 0;
+  uint64_t allocs_start = 0;
+  int n = 0;
+
+  frame_source_t *source = openFrameSource();
+  int rows = source->height, cols = source->width;
+  if (!source->persistent) {
+    fpool_init(&srcPool, PIPE_SLOTS + 1, rows, cols, source->type, opts.hugepages);
+  }
+  fpool_init(&grayPool, 1, rows, cols, CV_8UC1, opts.hugepages);
+  fpool_init(&sobelPool, PIPE_SLOTS + 1, rows, cols, CV_8UC1, opts.hugepages);
+  output_t *output = openOutput(rows, cols);
+  hist_init(&latency[LAT_CAPTURE], "capture");
+  hist_init(&latency[LAT_COMPUTE], "compute");
+  hist_init(&latency[LAT_DISPLAY], "display");
+  hist_init(&latency[LAT_E2E], "e2e");
+  uint64_t t_start = pc_now_ns();
+
+  for (int k = 0; k < PIPE_SLOTS; k++) {
+    freeQ.pushWait(&frames[k]);
+  }
+
+  int ret;
+  if ((ret = pthread_create(&capture, NULL, captureStage, source)) ||
+      (ret = pthread_create(&compute, NULL, computeStage, pool))) {
+    errx(1, "Thread creation failed: %d", ret);
+  }
+
+  while (1) {
+    pipe_frame *f;
+    TRACE_BEGIN("wait frame");
+    dispQ.popWait(f);
+    TRACE_END("wait frame");
+    if (f == NULL) {
+      break;
+    }
+
+    TRACE_BEGIN("display");
+    if (output) {
+      output_push(output, f->sobel->mat);
+    }
+    if (!opts.headless) {
+      namedWindow(top, CV_WINDOW_AUTOSIZE);
+      imshow(top, f->sobel->mat);
+      // Press q to exit; the stages drain what is already in flight
+      char c = cvWaitKey(1);
+      if (c == 'q') {
+        stop.store(1);
+      }
+    }
+    uint64_t t_shown = pc_now_ns();
+    TRACE_END("display");
+
+    cap_total += f->t_captured - f->t_capture;
+    comp_total += f->t_computed - f->t_captured;
+    disp_total += t_shown - f->t_computed;
+    if (n >= WARMUP_FRAMES) {
+      hist_add(&latency[LAT_CAPTURE], f->t_captured - f->t_capture);
+      hist_add(&latency[LAT_COMPUTE], f->t_computed - f->t_captured);
+      hist_add(&latency[LAT_DISPLAY], t_shown - f->t_computed);
+      hist_add(&latency[LAT_E2E], t_shown - f->t_capture);
+    }
+    n++;
+    if (n == WARMUP_FRAMES) {
+      allocs_start = alloc_count();
+    }
+
+    fbuf_unref(f->sobel);
+    f->sobel = NULL;
+    freeQ.pushWait(f);
+  }
+  uint64_t t_end = pc_now_ns();
+  uint64_t allocs = alloc_count() - allocs_start;
+
+  pthread_join(capture, NULL);
+  pthread_join(compute, NULL);
+
+  int nframes = n > 0 ? n : 1;
+  hist_t *e2e = &latency[LAT_E2E];
+  results_file.open("pipe_perf.csv", ios::out);
+  results_file << "Mean time per stage (ms)" << endl;
+  results_file << "Capture, " << cap_total/1e6/nframes << endl;
+  results_file << "Compute (Gray + Sobel), " << comp_total/1e6/nframes << endl;
+  results_file << "Queue + Display, " << disp_total/1e6/nframes << endl;
+  results_file << "\nSummary" << endl;
+  results_file << "Throughput (frames per second), " << n/((t_end - t_start)/1e9) << endl;
+  results_file << "End-to-end latency mean (ms), " << (e2e->count ? e2e->sum/1e6/e2e->count : 0) << endl;
+  results_file << "End-to-end latency min (ms), " << (e2e->count ? e2e->min/1e6 : 0) << endl;
+  results_file << "End-to-end latency p50 (ms), " << hist_percentile(e2e, 50)/1e6 << endl;
+  results_file << "End-to-end latency p99 (ms), " << hist_percentile(e2e, 99)/1e6 << endl;
+  results_file << "End-to-end latency max (ms), " << e2e->max/1e6 << endl;
+  results_file << "Latency histograms, pipe_latency.csv pipe_latency.json" << endl;
+  results_file << "Total frames, " << n << endl;
+  results_file << "Frame source, " << source->name << " " << cols << "x" << rows << endl;
+  results_file << "Kernel backend, " << kernels->name << endl;
+  results_file << "Operator, " << conv_ops[convOp].name << (convMag == CONV_L2 ? " L2" : " L1") << endl;
+  results_file << "Kernel mode, " << (source->type == CV_8UC1 ? "gray input" : opts.fused ? "fused" : "two-pass") << endl;
+  results_file << "Compute threads, " << (pool ? pool->nthreads : 1) << endl;
+  results_file << "Huge pages, " << (sobelPool.hugepages ? "yes" : "no") << endl;
+  results_file << "Heap allocations after warm-up, " << (n > WARMUP_FRAMES ? allocs : 0) << endl;
+  affinity_report(results_file);
+  if (output) {
+    closeOutput(output, results_file);
+  }
+
+  closeFrameSource(source);
+  results_file.close();
+  hist_report("pipe", latency, LAT_STAGES);
+  fpool_destroy(&srcPool);
+  fpool_destroy(&grayPool);
+  fpool_destroy(&sobelPool);
+}
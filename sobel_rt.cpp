@@ -0,0 +1,440 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include <iostream>
+#include <fstream>
+#include <pthread.h>
+#include <time.h>
+#include <limits.h>
+#include <errno.h>
+#include <err.h>
+#include <atomic>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "sobel_alg.h"
+#include "sobel_kernels.h"
+#include "pc.h"
+#include "spsc.h"
+#include "frame_pool.h"
+#include "alloc_count.h"
+#include "frame_source.h"
+#include "histogram.h"
+#include "trace.h"
+#include "affinity.h"
+#include "frame_sink.h"
+
+using namespace cv;
+using namespace std;
+
+// One slot being captured into, one waiting in the mailbox, one being
+// filtered
+#define RT_SLOTS 3
+// Degraded frames in a row before one is tried at full quality again, so
+// the cost estimate recovers once the load goes away
+#define RT_PROBE_INTERVAL 30
+
+struct rt_frame {
+  frame_buf_t *src;
+  Mat in;               // src's buffer, or the source's own frame
+  uint64_t t_captured;  // frame available; its deadline counts from here
+};
+
+static rt_frame slots[RT_SLOTS];
+static frame_pool_t srcPool, bufPool;
+
+// The mailbox holds the newest captured frame not yet taken. Capture
+// swaps each new frame in; whatever it gets back was never processed and
+// is dropped as stale. The compute side swaps in NULL to take a frame.
+static std::atomic<rt_frame *> latest;
+// capture -> compute: slots handed back after processing
+static spsc_ring<rt_frame *, 4> freeQ;
+// Futex word compute sleeps on while the mailbox is empty
+static std::atomic<uint32_t> published;
+static std::atomic<int> sleeping, captureDone, stop;
+// Capture side only
+static uint64_t captured, dropped;
+
+static ofstream results_file;
+
+enum { LAT_AGE, LAT_COMPUTE, LAT_DISPLAY, LAT_E2E, LAT_STAGES };
+static hist_t latency[LAT_STAGES];
+
+static void futexWait(std::atomic<uint32_t> *addr, uint32_t val)
+{
+  syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futexWake(std::atomic<uint32_t> *addr)
+{
+  syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static void wakeCompute()
+{
+  published.fetch_add(1, std::memory_order_seq_cst);
+  if (sleeping.load(std::memory_order_seq_cst)) {
+    futexWake(&published);
+  }
+}
+
+static void sleepUntil(uint64_t ns)
+{
+  struct timespec ts;
+  ts.tv_sec = ns / 1000000000ull;
+  ts.tv_nsec = ns % 1000000000ull;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+  }
+}
+
+/*******************************************
+ * Model: captureStage
+ * Input: frame_source_t* to read from
+ * Output: None
+ * Desc: Reads frames as fast as the source delivers them and posts each
+ *  one to the mailbox, so the camera's own queue never backs up. Files,
+ *  caches and generated frames have no clock of their own; they stand in
+ *  for a camera running at one frame per deadline.
+ ********************************************/
+static void *captureStage(void *ptr)
+{
+  frame_source_t *source = (frame_source_t *)ptr;
+  uint64_t period = (uint64_t)opts.deadlineUs * 1000;
+  uint64_t due = pc_now_ns();
+  int paced = !opts.webcam;
+  rt_frame *f;
+  Mat img;
+
+  TRACE_THREAD("capture");
+  AFFINITY_THREAD(AFF_CAPTURE, 0);
+  freeQ.popWait(f);
+  for (int n = 0; n < opts.numFrames && !stop.load(); n++) {
+    if (paced) {
+      sleepUntil(due);
+      due += period;
+    }
+    TRACE_BEGIN("capture");
+    if (!source->read(source, img)) {
+      TRACE_END("capture");
+      break;
+    }
+    if (source->persistent) {
+      f->in = img;
+    } else {
+      f->in = f->src->mat;
+      img.copyTo(f->in);
+    }
+    f->t_captured = pc_now_ns();
+    captured++;
+    TRACE_END("capture");
+
+    rt_frame *stale = latest.exchange(f, std::memory_order_acq_rel);
+    wakeCompute();
+    if (stale) {
+      // Never taken: reuse its slot for the next frame
+      TRACE_BEGIN("drop");
+      dropped++;
+      f = stale;
+      TRACE_END("drop");
+    } else {
+      TRACE_BEGIN("wait free slot");
+      freeQ.popWait(f);
+      TRACE_END("wait free slot");
+    }
+  }
+  captureDone.store(1, std::memory_order_release);
+  wakeCompute();
+  return NULL;
+}
+
+// Takes the newest frame, waiting for one; NULL once capture has ended
+static rt_frame *takeLatest()
+{
+  while (1) {
+    uint32_t seen = published.load(std::memory_order_seq_cst);
+    rt_frame *f = latest.exchange(NULL, std::memory_order_acq_rel);
+    if (f) {
+      return f;
+    }
+    if (captureDone.load(std::memory_order_acquire)) {
+      // Capture may have posted one last frame before finishing
+      return latest.exchange(NULL, std::memory_order_acq_rel);
+    }
+    TRACE_BEGIN("wait frame");
+    sleeping.store(1, std::memory_order_seq_cst);
+    if (published.load(std::memory_order_seq_cst) == seen) {
+      futexWait(&published, seen);
+    }
+    sleeping.store(0, std::memory_order_relaxed);
+    TRACE_END("wait frame");
+  }
+}
+
+// Every other pixel of every other row
+static void decimate2x(Mat& src, Mat& half)
+{
+  size_t es = src.elemSize();
+  for (int i = 0; i < half.rows; i++) {
+    const uint8_t *s = src.ptr(2*i);
+    uint8_t *d = half.ptr(i);
+    for (int j = 0; j < half.cols; j++) {
+      memcpy(d + j*es, s + 2*j*es, es);
+    }
+  }
+}
+
+// Pixel doubling back to full size; odd edges repeat the last pixel
+static void upscale2x(Mat& half, Mat& full)
+{
+  for (int i = 0; i < full.rows; i++) {
+    uint8_t *d = full.ptr(i);
+    if (i & 1) {
+      memcpy(d, full.ptr(i-1), full.cols);
+      continue;
+    }
+    const uint8_t *s = half.ptr(i/2 < half.rows ? i/2 : half.rows-1);
+    int body = 2*half.cols < full.cols ? 2*half.cols : full.cols;
+    int j;
+    for (j = 0; j < body; j++) {
+      d[j] = s[j/2];
+    }
+    for (; j < full.cols; j++) {
+      d[j] = s[half.cols-1];
+    }
+  }
+}
+
+static void filter(pool_t *pool, Mat& src, Mat& gray, Mat& out)
+{
+  if (src.channels() == 1) {
+    if (pool) {
+      sobelMT(pool, src, out);
+    } else {
+      sobelCalc(src, out);
+    }
+  } else if (opts.fused) {
+    if (pool) {
+      sobelFusedMT(pool, src, out);
+    } else {
+      sobelFused(src, out);
+    }
+  } else {
+    if (pool) {
+      grayScaleMT(pool, src, gray);
+      sobelMT(pool, gray, out);
+    } else {
+      grayScale(src, gray);
+      sobelCalc(gray, out);
+    }
+  }
+}
+
+static uint64_t ewma(uint64_t avg, uint64_t v)
+{
+  return avg ? avg - avg/8 + v/8 : v;
+}
+
+/*******************************************
+ * Model: runSobelRT
+ * Input: worker pool, or NULL to filter on this thread alone
+ * Output: None
+ * Desc: Real-time mode (-R <ms>). A capture thread keeps only the newest
+ *  frame in a mailbox; this thread always filters that one, and frames
+ *  replaced before being taken are dropped. Each frame must be shown
+ *  within the deadline of being captured. Before filtering, the time
+ *  left is checked against running estimates of the costs, and the frame
+ *  is degraded as far as needed: first the display is skipped, then the
+ *  frame is filtered at half resolution and scaled back up. Writes
+ *  rt_perf.csv with dropped, late and degraded frame counts.
+ ********************************************/
+void runSobelRT(pool_t *pool)
+{
+  string top = "Sobel Top";
+  pthread_t capture;
+  uint64_t deadline = (uint64_t)opts.deadlineUs * 1000;
+  uint64_t costFull = 0, costHalf = 0, costDisplay = 0;
+  uint64_t processed = 0, late = 0, halved = 0, unshown = 0, allocs_start = 0;
+  int degradedRun = 0;
+
+  frame_source_t *source = openFrameSource();
+  int persistent = source->persistent;
+  int rows = source->height, cols = source->width;
+  int halfRows = rows / 2 >= 3 ? rows / 2 : 0, halfCols = cols / 2;
+  if (!persistent) {
+    fpool_init(&srcPool, RT_SLOTS, rows, cols, source->type, opts.hugepages);
+  }
+  for (int k = 0; k < RT_SLOTS; k++) {
+    slots[k].src = persistent ? NULL : fpool_get(&srcPool);
+    freeQ.pushWait(&slots[k]);
+  }
+  fpool_init(&bufPool, 2, rows, cols, CV_8UC1, opts.hugepages);
+  frame_buf_t *gray_buf = fpool_get(&bufPool);
+  frame_buf_t *sobel_buf = fpool_get(&bufPool);
+  // Half-resolution gray and Sobel frames are headers over the top and
+  // bottom halves of the gray buffer; only the half-size source is extra
+  frame_pool_t halfPool;
+  fpool_init(&halfPool, 1, rows / 2 + 1, cols / 2 + 1, source->type, opts.hugepages);
+  frame_buf_t *half_buf = fpool_get(&halfPool);
+  Mat halfSrc, halfGray, halfSobel;
+  if (halfRows && halfCols >= 3) {
+    halfSrc = half_buf->mat(Range(0, halfRows), Range(0, halfCols));
+    halfGray = gray_buf->mat(Range(0, halfRows), Range(0, halfCols));
+    halfSobel = gray_buf->mat(Range(rows - halfRows, rows), Range(0, halfCols));
+  }
+  Mat& img_gray = gray_buf->mat;
+  Mat& img_sobel = sobel_buf->mat;
+  output_t *output = openOutput(rows, cols);
+  hist_init(&latency[LAT_AGE], "age");
+  hist_init(&latency[LAT_COMPUTE], "compute");
+  hist_init(&latency[LAT_DISPLAY], "display");
+  hist_init(&latency[LAT_E2E], "e2e");
+  latest.store(NULL);
+  published.store(0);
+  sleeping.store(0);
+  captureDone.store(0);
+  stop.store(0);
+  captured = dropped = 0;
+  uint64_t t_start = pc_now_ns();
+
+  int ret;
+  if ((ret = pthread_create(&capture, NULL, captureStage, source))) {
+    errx(1, "Thread creation failed: %d", ret);
+  }
+
+  rt_frame *f;
+  while ((f = takeLatest()) != NULL) {
+    uint64_t t_start_frame = pc_now_ns();
+    uint64_t age = t_start_frame - f->t_captured;
+    int64_t left = (int64_t)deadline - (int64_t)age;
+    int show = !opts.headless;
+    int half = 0;
+
+    // Degrade only as far as the estimates say is needed, but go back to
+    // full quality now and then to measure it again
+    if (costFull && degradedRun < RT_PROBE_INTERVAL &&
+        (int64_t)(costFull + (show ? costDisplay : 0)) > left) {
+      if (show && (int64_t)costFull <= left) {
+        show = 0;
+      } else if (!halfSrc.empty()) {
+        half = 1;
+        uint64_t est = costHalf ? costHalf : costFull / 4;
+        if (show && (int64_t)(est + costDisplay) > left) {
+          show = 0;
+        }
+      } else {
+        show = 0;
+      }
+    }
+    degradedRun = half || (show != !opts.headless) ? degradedRun + 1 : 0;
+
+    TRACE_BEGIN(half ? "compute half" : "compute");
+    if (half) {
+      decimate2x(f->in, halfSrc);
+      filter(pool, halfSrc, halfGray, halfSobel);
+      upscale2x(halfSobel, img_sobel);
+    } else {
+      filter(pool, f->in, img_gray, img_sobel);
+    }
+    TRACE_END(half ? "compute half" : "compute");
+    uint64_t t_computed = pc_now_ns();
+    uint64_t t_captured = f->t_captured;
+    // The slot can go back before display: the output is in img_sobel
+    if (persistent) {
+      f->in.release();
+    }
+    freeQ.pushWait(f);
+
+    if (output) {
+      output_push(output, img_sobel);
+    }
+    if (show) {
+      TRACE_BEGIN("display");
+      namedWindow(top, CV_WINDOW_AUTOSIZE);
+      imshow(top, img_sobel);
+      char c = cvWaitKey(1);
+      if (c == 'q') {
+        stop.store(1);
+      }
+      TRACE_END("display");
+    }
+    uint64_t t_shown = pc_now_ns();
+
+    if (half) {
+      costHalf = ewma(costHalf, t_computed - t_start_frame);
+      halved++;
+    } else {
+      costFull = ewma(costFull, t_computed - t_start_frame);
+    }
+    if (show) {
+      costDisplay = ewma(costDisplay, t_shown - t_computed);
+    } else if (!opts.headless) {
+      unshown++;
+    }
+    if (t_shown - t_captured > deadline) {
+      late++;
+    }
+    if (processed >= WARMUP_FRAMES) {
+      hist_add(&latency[LAT_AGE], age);
+      hist_add(&latency[LAT_COMPUTE], t_computed - t_start_frame);
+      hist_add(&latency[LAT_DISPLAY], t_shown - t_computed);
+      hist_add(&latency[LAT_E2E], t_shown - t_captured);
+    }
+    processed++;
+    if (processed == WARMUP_FRAMES) {
+      allocs_start = alloc_count();
+    }
+  }
+  uint64_t t_end = pc_now_ns();
+  uint64_t allocs = processed > WARMUP_FRAMES ? alloc_count() - allocs_start : 0;
+  pthread_join(capture, NULL);
+
+  hist_t *e2e = &latency[LAT_E2E];
+  results_file.open("rt_perf.csv", ios::out);
+  results_file << "Summary" << endl;
+  results_file << "Deadline (ms), " << opts.deadlineUs/1e3 << endl;
+  results_file << "Frames captured, " << captured << endl;
+  results_file << "Frames processed, " << processed << endl;
+  results_file << "Frames dropped (stale), " << dropped << endl;
+  results_file << "Frames late, " << late << endl;
+  results_file << "Frames at half resolution, " << halved << endl;
+  results_file << "Frames not displayed, " << unshown << endl;
+  results_file << "Throughput (frames per second), " << processed/((t_end - t_start)/1e9) << endl;
+  results_file << "End-to-end latency p50 (ms), " << hist_percentile(e2e, 50)/1e6 << endl;
+  results_file << "End-to-end latency p99 (ms), " << hist_percentile(e2e, 99)/1e6 << endl;
+  results_file << "End-to-end latency max (ms), " << e2e->max/1e6 << endl;
+  results_file << "Latency histograms, rt_latency.csv rt_latency.json" << endl;
+  results_file << "Frame source, " << source->name << " " << cols << "x" << rows
+               << (opts.webcam ? "" : " (paced at one frame per deadline)") << endl;
+  results_file << "Kernel backend, " << kernels->name << endl;
+  results_file << "Operator, " << conv_ops[convOp].name << (convMag == CONV_L2 ? " L2" : " L1") << endl;
+  results_file << "Kernel mode, " << (source->type == CV_8UC1 ? "gray input" : opts.fused ? "fused" : "two-pass") << endl;
+  results_file << "Compute threads, " << (pool ? pool->nthreads : 1) << endl;
+  results_file << "Heap allocations after warm-up, " << allocs << endl;
+  affinity_report(results_file);
+  if (output) {
+    closeOutput(output, results_file);
+  }
+
+  closeFrameSource(source);
+  results_file.close();
+  hist_report("rt", latency, LAT_STAGES);
+  for (int k = 0; k < RT_SLOTS; k++) {
+    if (slots[k].src) {
+      fbuf_unref(slots[k].src);
+    }
+    slots[k].in.release();
+  }
+  halfSrc.release();
+  halfGray.release();
+  halfSobel.release();
+  fbuf_unref(half_buf);
+  fbuf_unref(gray_buf);
+  fbuf_unref(sobel_buf);
+  fpool_destroy(&halfPool);
+  fpool_destroy(&bufPool);
+  if (!persistent) {
+    fpool_destroy(&srcPool);
+  }
+}
@@ -13,6 +13,16 @@
 
 #include "sobel_alg.h"
 #include "pc.h"
+#include "sobel_kernels.h"
+#include "frame_pool.h"
+#include "alloc_count.h"
+#include "frame_source.h"
+#include "histogram.h"
+#include "trace.h"
+#include "affinity.h"
+#include "incremental.h"
+#include "frame_stats.h"
+#include "frame_sink.h"
 
 // Replaces img.step[0] and img.step[1] calls in sobel calc
 
@@ -22,10 +32,14 @@ using namespace cv;
 static ofstream results_file;
 
 // Define image mats to pass between function calls
-static Mat img_gray, img_sobel;
-static float total_fps, total_ipc, total_epf;
-static float gray_total, sobel_total, cap_total, disp_total;
-static float sobel_ic_total, sobel_l1cm_total;
+static Mat img_gray, img_sobel, img_edges;
+static float total_epf;
+static uint64_t gray_total, sobel_total, cap_total, disp_total;
+static uint64_t sobel_ic_total, sobel_l1cm_total;
+
+// Per-stage wall-clock latency of every frame after warm-up
+enum { LAT_CAPTURE, LAT_GRAY, LAT_SOBEL, LAT_DISPLAY, LAT_E2E, LAT_STAGES };
+static hist_t latency[LAT_STAGES];
 
 /*******************************************
  * Model: runSobelST
@@ -44,59 +58,141 @@ void runSobelST()
 
   counters_t perf_counters;
 
-  pc_init(&perf_counters, getpid());
+  pc_init(&perf_counters, getpid(), opts.events);
 
   // Start algorithm
-  CvCapture* video_cap;
+  frame_source_t *source = openFrameSource();
+
 
-  if (opts.webcam) {
-    video_cap = cvCreateCameraCapture(-1);
-  } else {
-    video_cap = cvCreateFileCapture(opts.videoFile);
+  // Grayscale and sobel images live in preallocated buffers that are
+  // reused for every frame. The fused kernel never touches img_gray.
+  frame_pool_t buffers;
+  fpool_init(&buffers, 2, source->height, source->width, CV_8UC1, opts.hugepages);
+  frame_buf_t *gray_buf = fpool_get(&buffers);
+  frame_buf_t *sobel_buf = fpool_get(&buffers);
+  img_gray = gray_buf->mat;
+  img_sobel = sobel_buf->mat;
+  // -E: the packed edge map; img_sobel then only holds its unpacked copy
+  // for the window
+  frame_pool_t edgeBuffers;
+  frame_buf_t *edge_buf = NULL;
+  if (opts.edgeThreshold) {
+    fpool_init(&edgeBuffers, 1, source->height, EDGE_BYTES(source->width), CV_8UC1, opts.hugepages);
+    edge_buf = fpool_get(&edgeBuffers);
+    img_edges = edge_buf->mat;
+  }
+  uint64_t allocs_start = 0;
+  uint64_t kernel_ns = 0;
+  // Gray sources (a gray frame cache) go straight to the Sobel pass
+  int grayIn = source->type == CV_8UC1;
+  output_t *output = openOutput(source->height, source->width);
+  incr_t inc;
+  if (opts.incremental) {
+    incr_init(&inc, source->height, source->width, opts.incrThreshold, opts.numFrames);
   }
-  cvSetCaptureProperty(video_cap, CV_CAP_PROP_FRAME_WIDTH, IMG_WIDTH);
-  cvSetCaptureProperty(video_cap, CV_CAP_PROP_FRAME_HEIGHT, IMG_HEIGHT);
+  // -X: filled by the kernels between stats_begin and stats_end
+  frame_stats stats;
+  if (opts.statsTileW && stats_init(&stats, source->height, source->width, opts.statsTileW,
+                                    opts.statsTileH, opts.statsThreshold, opts.numFrames)) {
+    errx(1, "-X: %dx%d tiles do not fit a %dx%d frame (at most %d tile columns, %u pixels per tile)",
+         opts.statsTileW, opts.statsTileH, source->width, source->height,
+         STATS_MAX_TILES_X, UINT32_MAX / 255);
+  }
+  hist_init(&latency[LAT_CAPTURE], "capture");
+  hist_init(&latency[LAT_GRAY], "gray");
+  hist_init(&latency[LAT_SOBEL], "sobel");
+  hist_init(&latency[LAT_DISPLAY], "display");
+  hist_init(&latency[LAT_E2E], "e2e");
 
   // Keep track of the frames
   int i = 0;
 
   while (1) {
-    // Allocate memory to hold grayscale and sobel images
-    img_gray = Mat(IMG_HEIGHT, IMG_WIDTH, CV_8UC1);
-    img_sobel = Mat(IMG_HEIGHT, IMG_WIDTH, CV_8UC1);
-
+    uint64_t t_capture = pc_now_ns();
+    TRACE_BEGIN("capture");
     pc_start(&perf_counters);
-    src = cvQueryFrame(video_cap);
+    int got = source->read(source, src);
     pc_stop(&perf_counters);
+    TRACE_END("capture");
+    if (!got) {
+      break;
+    }
 
     cap_time = perf_counters.cycles.count;
     sobel_l1cm = perf_counters.l1_misses.count;
     sobel_ic = perf_counters.ic.count;
+    uint64_t t_captured = pc_now_ns();
 
-    pc_start(&perf_counters);
-    grayScale(src, img_gray);
-    pc_stop(&perf_counters);
+    if (opts.fused || grayIn) {
+      gray_time = 0;
+    } else {
+      TRACE_BEGIN("gray");
+      pc_start(&perf_counters);
+      grayScale(src, img_gray);
+      pc_stop(&perf_counters);
+      TRACE_END("gray");
 
-    gray_time = perf_counters.cycles.count;
-    sobel_l1cm += perf_counters.l1_misses.count;
-    sobel_ic += perf_counters.ic.count;
+      gray_time = perf_counters.cycles.count;
+      sobel_l1cm += perf_counters.l1_misses.count;
+      sobel_ic += perf_counters.ic.count;
+    }
+
+    uint64_t t_gray = pc_now_ns();
 
+    // In fused mode the Sobel stage includes the grayscale conversion
+    TRACE_BEGIN("sobel");
     pc_start(&perf_counters);
-    sobelCalc(img_gray, img_sobel);
+    if (opts.statsTileW) {
+      stats_begin(&stats);
+    }
+    if (opts.incremental) {
+      // Only changed tiles and their halos; img_sobel keeps the rest
+      incr_sobel(&inc, grayIn ? src : img_gray, img_sobel);
+    } else if (opts.edgeThreshold) {
+      sobelEdge(grayIn ? src : img_gray, img_edges, opts.edgeThreshold, opts.edgeNms);
+    } else if (grayIn) {
+      sobelCalc(src, img_sobel);
+    } else if (opts.fused) {
+      sobelFused(src, img_sobel);
+    } else {
+      sobelCalc(img_gray, img_sobel);
+    }
+    if (opts.statsTileW) {
+      stats_end(&stats);
+    }
     pc_stop(&perf_counters);
+    TRACE_END("sobel");
 
     sobel_time = perf_counters.cycles.count;
     sobel_l1cm += perf_counters.l1_misses.count;
     sobel_ic += perf_counters.ic.count;
 
-    pc_start(&perf_counters);
-    namedWindow(top, CV_WINDOW_AUTOSIZE);
-    imshow(top, img_sobel);
-    pc_stop(&perf_counters);
+    uint64_t t_sobel = pc_now_ns();
+    kernel_ns += t_sobel - t_captured;
 
-    disp_time = perf_counters.cycles.count;
-    sobel_l1cm += perf_counters.l1_misses.count;
-    sobel_ic += perf_counters.ic.count;
+    if (output) {
+      TRACE_BEGIN("output");
+      output_push(output, opts.edgeThreshold ? img_edges : img_sobel);
+      TRACE_END("output");
+    }
+    if (opts.headless) {
+      disp_time = 0;
+    } else {
+      TRACE_BEGIN("display");
+      pc_start(&perf_counters);
+      namedWindow(top, CV_WINDOW_AUTOSIZE);
+      if (opts.edgeThreshold) {
+        edgeUnpack(img_edges, img_sobel);
+      }
+      imshow(top, img_sobel);
+      pc_stop(&perf_counters);
+      TRACE_END("display");
+
+      disp_time = perf_counters.cycles.count;
+      sobel_l1cm += perf_counters.l1_misses.count;
+      sobel_ic += perf_counters.ic.count;
+    }
+    uint64_t t_shown = pc_now_ns();
 
     cap_total += cap_time;
     gray_total += gray_time;
@@ -104,19 +200,35 @@ void runSobelST()
     sobel_l1cm_total += sobel_l1cm;
     sobel_ic_total += sobel_ic;
     disp_total += disp_time;
-    total_fps += PROC_FREQ/float(cap_time + disp_time + gray_time + sobel_time);
-    total_ipc += float(sobel_ic/float(cap_time + disp_time + gray_time + sobel_time));
+    if (i >= WARMUP_FRAMES) {
+      hist_add(&latency[LAT_CAPTURE], t_captured - t_capture);
+      hist_add(&latency[LAT_GRAY], t_gray - t_captured);
+      hist_add(&latency[LAT_SOBEL], t_sobel - t_gray);
+      hist_add(&latency[LAT_DISPLAY], t_shown - t_sobel);
+      hist_add(&latency[LAT_E2E], t_shown - t_capture);
+    }
     i++;
+    if (i == WARMUP_FRAMES) {
+      allocs_start = alloc_count();
+    }
 
     // Press q to exit
-    char c = cvWaitKey(10);
+    char c = opts.headless ? 0 : cvWaitKey(1);
     if (c == 'q' || i >= opts.numFrames) {
       break;
     }
   }
 
-  total_epf = PROC_EPC*NCORES/(total_fps/i);
-  float total_time = float(gray_total + sobel_total + cap_total + disp_total);
+  uint64_t allocs = i > WARMUP_FRAMES ? alloc_count() - allocs_start : 0;
+  uint64_t total_cycles = gray_total + sobel_total + cap_total + disp_total;
+  double total_time = total_cycles ? (double)total_cycles : 1;
+  // Frames over total time, not a mean of per-frame rates
+  double fps = i*(double)PROC_FREQ/total_time;
+  total_epf = PROC_EPC*NCORES/fps;
+  // Wall clock over grayscale + Sobel only: comparable across machines
+  // even where the cycle counters are unavailable
+  int nframes = i > 0 ? i : 1;
+  double kernel_mpps = kernel_ns ? (double)i*source->width*source->height*1e3/kernel_ns : 0;
 
   results_file.open("st_perf.csv", ios::out);
   results_file << "Percent of time per function" << endl;
@@ -125,16 +237,72 @@ void runSobelST()
   results_file << "Sobel, " << (sobel_total/total_time)*100 << "%" << endl;
   results_file << "Display, " << (disp_total/total_time)*100 << "%" << endl;
   results_file << "\nSummary" << endl;
-  results_file << "Frames per second, " << total_fps/i << endl;
-  results_file << "Cycles per frame, " << total_time/i << endl;
+  results_file << "Frames per second, " << fps << endl;
+  results_file << "Cycles per frame, " << total_cycles/nframes << endl;
   results_file << "Energy per frames (mJ), " << total_epf*1000 << endl;
   results_file << "Total frames, " << i << endl;
+  results_file << "Kernel backend, " << kernels->name << endl;
+  results_file << "Operator, " << conv_ops[convOp].name << (convMag == CONV_L2 ? " L2" : " L1") << endl;
+  results_file << "Kernel mode, " << (grayIn ? "gray input" : opts.fused ? "fused" : "two-pass") << endl;
+  if (opts.edgeThreshold) {
+    results_file << "Edge map, threshold " << opts.edgeThreshold
+                 << (opts.edgeNms ? " with non-maximum suppression" : "") << ", "
+                 << img_edges.rows * (size_t)img_edges.cols << " bytes per frame" << endl;
+  }
+  results_file << "Frame source, " << source->name << " " << source->width << "x" << source->height << endl;
+  results_file << "Kernel time per frame (ms), " << kernel_ns/1e6/nframes << endl;
+  results_file << "Kernel throughput (Mpixels/s), " << kernel_mpps << endl;
+  if (opts.incremental) {
+    results_file << "Tiles skipped (%), " << 100.0*inc.skippedTotal/(inc.tilesTotal ? inc.tilesTotal : 1) << endl;
+    results_file << "Per-frame tile stats, st_incremental.csv" << endl;
+  }
+  if (opts.statsTileW) {
+    results_file << "Frame stats, " << stats.tilesX << "x" << stats.tilesY << " tiles of "
+                 << stats.tileW << "x" << stats.tileH << ", density threshold " << stats.threshold << endl;
+    results_file << "Edge energy per frame, " << (double)stats.totalEnergy/nframes << endl;
+    results_file << "Per-frame edge stats, st_stats.csv st_histogram.csv" << endl;
+  }
+  results_file << "Heap allocations after warm-up, " << allocs << endl;
+  results_file << "End-to-end latency p50 (ms), " << hist_percentile(&latency[LAT_E2E], 50)/1e6 << endl;
+  results_file << "End-to-end latency p99 (ms), " << hist_percentile(&latency[LAT_E2E], 99)/1e6 << endl;
+  results_file << "Latency histograms, st_latency.csv st_latency.json" << endl;
   results_file << "\nHardware Stats (Cap + Gray + Sobel + Display)" << endl;
-  results_file << "Instructions per cycle, " << total_ipc/i << endl;
-  results_file << "L1 misses per frame, " << sobel_l1cm_total/i << endl;
-  results_file << "L1 misses per instruction, " << sobel_l1cm_total/sobel_ic_total << endl;
-  results_file << "Instruction count per frame, " << sobel_ic_total/i << endl;
+  results_file << "Instructions per cycle, " << sobel_ic_total/total_time << endl;
+  results_file << "L1 misses per frame, " << (double)sobel_l1cm_total/nframes << endl;
+  results_file << "L1 misses per instruction, " << (double)sobel_l1cm_total/sobel_ic_total << endl;
+  results_file << "Instruction count per frame, " << (double)sobel_ic_total/nframes << endl;
+  for (int k = 0; k < perf_counters.nextra; k++) {
+    results_file << perf_counters.extra[k].name << " per frame, "
+                 << (double)perf_counters.extra[k].total/nframes << endl;
+  }
+  results_file << "Counters, " << (perf_counters.estimated ? "unavailable (cycles estimated from wall clock)" : "hardware") << endl;
+  affinity_report(results_file);
+
+  if (output) {
+    results_file << "\nOutput" << endl;
+    closeOutput(output, results_file);
+  }
 
-  cvReleaseCapture(&video_cap);
+  closeFrameSource(source);
+  pc_close(&perf_counters);
   results_file.close();
+  hist_report("st", latency, LAT_STAGES);
+  if (opts.incremental) {
+    incr_report(&inc, "st");
+    incr_destroy(&inc);
+  }
+  if (opts.statsTileW) {
+    stats_report(&stats, "st");
+    stats_destroy(&stats);
+  }
+  fbuf_unref(gray_buf);
+  fbuf_unref(sobel_buf);
+  img_gray.release();
+  img_sobel.release();
+  fpool_destroy(&buffers);
+  if (edge_buf) {
+    fbuf_unref(edge_buf);
+    img_edges.release();
+    fpool_destroy(&edgeBuffers);
+  }
 }
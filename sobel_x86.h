@@ -0,0 +1,58 @@
+#ifndef SOBEL_X86_H
+#define SOBEL_X86_H
+
+// Helpers shared by the AVX2 and AVX-512 backends. Everything here is
+// static so each backend gets its own copy compiled for its own ISA flags;
+// an inline function with external linkage could be merged by the linker
+// into the AVX-512 variant and then run on an AVX2-only CPU.
+
+#include <immintrin.h>
+#include <stdint.h>
+
+// pshufb masks that pull one channel out of each of the three 16-byte
+// chunks of 16 packed BGR pixels. OR-ing the three results gives the channel
+// for all 16 pixels in order.
+static const int8_t deinterleave[3][3][16] = {
+  { // B
+    {0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13},
+  },
+  { // G
+    {1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14},
+  },
+  { // R
+    {2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15},
+  },
+};
+
+static inline __m128i channel16(__m128i a, __m128i b, __m128i c, int ch)
+{
+  __m128i va = _mm_shuffle_epi8(a, _mm_loadu_si128((const __m128i *)deinterleave[ch][0]));
+  __m128i vb = _mm_shuffle_epi8(b, _mm_loadu_si128((const __m128i *)deinterleave[ch][1]));
+  __m128i vc = _mm_shuffle_epi8(c, _mm_loadu_si128((const __m128i *)deinterleave[ch][2]));
+  return _mm_or_si128(_mm_or_si128(va, vb), vc);
+}
+
+// Luma of 16 BGR pixels as 16-bit lanes.
+static inline __m256i luma16(const uint8_t *p)
+{
+  __m128i a = _mm_loadu_si128((const __m128i *)p);
+  __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+  __m128i c = _mm_loadu_si128((const __m128i *)(p + 32));
+
+  __m256i bs = _mm256_cvtepu8_epi16(channel16(a, b, c, 0));
+  __m256i gs = _mm256_cvtepu8_epi16(channel16(a, b, c, 1));
+  __m256i rs = _mm256_cvtepu8_epi16(channel16(a, b, c, 2));
+
+  bs = _mm256_srli_epi16(_mm256_mullo_epi16(bs, _mm256_set1_epi16(29)), 8);
+  gs = _mm256_srli_epi16(_mm256_mullo_epi16(gs, _mm256_set1_epi16(150)), 8);
+  rs = _mm256_srli_epi16(_mm256_mullo_epi16(rs, _mm256_set1_epi16(76)), 8);
+  return _mm256_add_epi16(_mm256_add_epi16(bs, gs), rs);
+}
+
+#endif
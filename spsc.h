@@ -0,0 +1,65 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <sched.h>
+#include <atomic>
+
+// Bounded single-producer/single-consumer ring. N must be a power of two.
+// head and tail run freely and are only reduced modulo N on access, so
+// the ring holds a full N entries.
+template <typename T, unsigned N>
+struct spsc_ring {
+  static_assert((N & (N - 1)) == 0, "spsc_ring size must be a power of two");
+
+  T buf[N];
+  std::atomic<unsigned> head __attribute__((aligned(64)));  // consumer
+  std::atomic<unsigned> tail __attribute__((aligned(64)));  // producer
+
+  spsc_ring() : head(0), tail(0) {}
+
+  bool push(const T& v)
+  {
+    unsigned t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == N) {
+      return false;
+    }
+    buf[t % N] = v;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T& v)
+  {
+    unsigned h = head.load(std::memory_order_relaxed);
+    if (tail.load(std::memory_order_acquire) == h) {
+      return false;
+    }
+    v = buf[h % N];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Producer side: the next push would fail
+  bool full() const
+  {
+    return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire) == N;
+  }
+
+  // Blocking variants. Stages only wait on each other for a frame time at
+  // most, so yielding is enough; no futex is needed.
+  void pushWait(const T& v)
+  {
+    while (!push(v)) {
+      sched_yield();
+    }
+  }
+
+  void popWait(T& v)
+  {
+    while (!pop(v)) {
+      sched_yield();
+    }
+  }
+};
+
+#endif
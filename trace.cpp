@@ -0,0 +1,133 @@
+#include "trace.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <atomic>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "pc.h"
+
+// Threads that can record, and events each can hold before dropping
+#define TRACE_MAX_THREADS 128
+#define TRACE_EVENTS (1 << 18)
+
+struct trace_rec {
+  uint64_t ts;
+  const char *name;
+  char phase;
+};
+
+// Written only by its owning thread; `count` is published with release so
+// trace_dump sees complete records
+struct trace_buf {
+  std::atomic<uint32_t> count;
+  uint32_t dropped;
+  int tid;
+  char name[32];
+  trace_rec recs[TRACE_EVENTS];
+};
+
+int trace_on;
+static const char *tracePath;
+static uint64_t traceStart;
+static trace_buf *bufs[TRACE_MAX_THREADS];
+static std::atomic<int> nbufs;
+static __thread trace_buf *self;
+
+// First event on a thread: take a slot and map its buffer. mmap keeps the
+// buffer off the heap and only touched pages get backed.
+static trace_buf *threadBuf()
+{
+  if (self) {
+    return self;
+  }
+  int slot = nbufs.fetch_add(1, std::memory_order_relaxed);
+  if (slot >= TRACE_MAX_THREADS) {
+    errx(1, "trace: more than %d threads", TRACE_MAX_THREADS);
+  }
+  void *p = mmap(NULL, sizeof(trace_buf), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    err(1, "trace: cannot map buffer");
+  }
+  self = (trace_buf *)p;
+  self->tid = (int)syscall(SYS_gettid);
+  snprintf(self->name, sizeof(self->name), "thread %d", slot);
+  __atomic_store_n(&bufs[slot], self, __ATOMIC_RELEASE);
+  return self;
+}
+
+void trace_init(const char *path)
+{
+  tracePath = path;
+  traceStart = pc_now_ns();
+  trace_on = 1;
+}
+
+void trace_thread_name(const char *name)
+{
+  trace_buf *b = threadBuf();
+  snprintf(b->name, sizeof(b->name), "%s", name);
+}
+
+void trace_event(const char *name, char phase)
+{
+  trace_buf *b = threadBuf();
+  uint32_t n = b->count.load(std::memory_order_relaxed);
+  if (n == TRACE_EVENTS) {
+    b->dropped++;
+    return;
+  }
+  b->recs[n].ts = pc_now_ns();
+  b->recs[n].name = name;
+  b->recs[n].phase = phase;
+  b->count.store(n + 1, std::memory_order_release);
+}
+
+/*******************************************
+ * Model: trace_dump
+ * Input: None
+ * Output: None directly. Writes the trace file given to trace_init
+ * Desc: Chrome trace event format: one B/E pair per span with timestamps
+ *  in microseconds from trace_init, plus a thread_name record per thread.
+ ********************************************/
+void trace_dump(void)
+{
+  if (!trace_on) {
+    return;
+  }
+  FILE *f = fopen(tracePath, "w");
+  if (f == NULL) {
+    err(1, "Cannot create %s", tracePath);
+  }
+  int pid = getpid();
+  int n = nbufs.load(std::memory_order_acquire);
+  uint64_t dropped = 0;
+  const char *sep = "\n";
+
+  fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+  for (int k = 0; k < n && k < TRACE_MAX_THREADS; k++) {
+    trace_buf *b = __atomic_load_n(&bufs[k], __ATOMIC_ACQUIRE);
+    if (b == NULL) {
+      continue;
+    }
+    fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+            "\"args\": {\"name\": \"%s\"}}", sep, pid, b->tid, b->name);
+    sep = ",\n";
+    uint32_t count = b->count.load(std::memory_order_acquire);
+    for (uint32_t e = 0; e < count; e++) {
+      trace_rec *r = &b->recs[e];
+      fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d}",
+              r->name, r->phase, (r->ts - traceStart) / 1e3, pid, b->tid);
+    }
+    dropped += b->dropped;
+  }
+  fprintf(f, "\n]}\n");
+  fclose(f);
+  if (dropped) {
+    fprintf(stderr, "trace: buffers full, %llu events dropped\n", (unsigned long long)dropped);
+  }
+}
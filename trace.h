@@ -0,0 +1,33 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Timeline tracing: begin/end spans per thread, dumped at exit as a Chrome
+// trace (load it in chrome://tracing or ui.perfetto.dev). Each thread
+// appends to its own buffer, so recording takes no locks and no atomics
+// beyond one relaxed store. Disabled, a span costs one predictable branch
+// on `trace_on`; building with -DSOBEL_NO_TRACE (make TRACE=0) removes
+// even that.
+//
+// Span names must be string literals: only the pointer is stored.
+
+extern int trace_on;
+
+// Enables tracing into `path`. Call before any thread that traces starts.
+void trace_init(const char *path);
+// Labels the calling thread in the trace (copied)
+void trace_thread_name(const char *name);
+void trace_event(const char *name, char phase);
+// Writes the trace file; call once every traced thread has finished
+void trace_dump(void);
+
+#ifndef SOBEL_NO_TRACE
+#define TRACE_BEGIN(name) do { if (__builtin_expect(trace_on, 0)) trace_event(name, 'B'); } while (0)
+#define TRACE_END(name)   do { if (__builtin_expect(trace_on, 0)) trace_event(name, 'E'); } while (0)
+#define TRACE_THREAD(name) do { if (__builtin_expect(trace_on, 0)) trace_thread_name(name); } while (0)
+#else
+#define TRACE_BEGIN(name) do { } while (0)
+#define TRACE_END(name)   do { } while (0)
+#define TRACE_THREAD(name) do { } while (0)
+#endif
+
+#endif
@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "sobel_alg.h"
+#include "frame_source.h"
+
+using namespace cv;
+
+// Capture device used for -w with -y
+#define YUV_DEVICE "/dev/video0"
+// Buffers queued to the driver. One is held by the reader at a time.
+#define YUV_BUFFERS 4
+
+static const struct {
+  const char *name;
+  uint32_t fourcc;
+} formats[] = {
+  { "yuyv", V4L2_PIX_FMT_YUYV },
+  { "nv12", V4L2_PIX_FMT_NV12 },
+  { "i420", V4L2_PIX_FMT_YUV420 },
+};
+#define NUM_FORMATS (int)(sizeof(formats) / sizeof(formats[0]))
+
+int yuvFormatValid(const char *name)
+{
+  for (int k = 0; k < NUM_FORMATS; k++) {
+    if (strcmp(name, formats[k].name) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static uint32_t fourccOf(const char *name)
+{
+  for (int k = 0; k < NUM_FORMATS; k++) {
+    if (strcmp(name, formats[k].name) == 0) {
+      return formats[k].fourcc;
+    }
+  }
+  errx(1, "Unknown YUV format %s", name);
+}
+
+// Bytes per frame of a tightly packed raw file
+static size_t frameBytes(uint32_t fourcc, int width, int height)
+{
+  if (fourcc == V4L2_PIX_FMT_YUYV) {
+    return (size_t)width * height * 2;
+  }
+  return (size_t)width * height + 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2);
+}
+
+/*******************************************
+ * Model: yuyvLuma
+ * Input: YUYV frame, its stride
+ * Output: None directly. Writes the Y samples into gray
+ * Desc: YUYV interleaves luma with chroma (Y0 U Y1 V), so its Y plane is
+ *  not addressable as a Mat and has to be gathered. Still a third of the
+ *  work of a BGR conversion: one byte read and kept out of every two.
+ ********************************************/
+static void yuyvLuma(const uint8_t *yuyv, size_t stride, Mat& gray)
+{
+  for (int i = 0; i < gray.rows; i++) {
+    const uint8_t *p = yuyv + i * stride;
+    uint8_t *g = gray.ptr(i);
+    for (int j = 0; j < gray.cols; j++) {
+      g[j] = p[2*j];
+    }
+  }
+}
+
+/*******************************************
+ * V4L2 source: mmap streaming straight from the capture driver. For NV12
+ * and I420 the Y plane leads the buffer, so the frame handed out is a Mat
+ * header over the driver's own memory; nothing is copied or converted.
+ ********************************************/
+struct v4l2_state {
+  int fd;
+  uint32_t fourcc;
+  size_t stride;
+  void *mem[YUV_BUFFERS];
+  size_t len[YUV_BUFFERS];
+  int held;              // buffer handed out by the last read, or -1
+  Mat gray;              // gathered Y plane, YUYV only
+};
+
+static void queueBuffer(v4l2_state *st, int index)
+{
+  struct v4l2_buffer buf;
+  memset(&buf, 0, sizeof(buf));
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  buf.index = index;
+  if (ioctl(st->fd, VIDIOC_QBUF, &buf) < 0) {
+    err(1, "VIDIOC_QBUF");
+  }
+}
+
+static int v4l2Read(frame_source_t *src, Mat& frame)
+{
+  v4l2_state *st = (v4l2_state *)src->state;
+  struct v4l2_buffer buf;
+
+  // The previous frame is only valid until this read
+  if (st->held >= 0) {
+    queueBuffer(st, st->held);
+    st->held = -1;
+  }
+  memset(&buf, 0, sizeof(buf));
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  while (ioctl(st->fd, VIDIOC_DQBUF, &buf) < 0) {
+    if (errno != EINTR) {
+      warn("VIDIOC_DQBUF");
+      return 0;
+    }
+  }
+  st->held = buf.index;
+
+  uint8_t *base = (uint8_t *)st->mem[buf.index];
+  if (st->fourcc == V4L2_PIX_FMT_YUYV) {
+    yuyvLuma(base, st->stride, st->gray);
+    frame = st->gray;
+  } else {
+    frame = Mat(src->height, src->width, CV_8UC1, base, st->stride);
+  }
+  return 1;
+}
+
+static void v4l2Close(frame_source_t *src)
+{
+  v4l2_state *st = (v4l2_state *)src->state;
+  enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  ioctl(st->fd, VIDIOC_STREAMOFF, &type);
+  for (int k = 0; k < YUV_BUFFERS; k++) {
+    munmap(st->mem[k], st->len[k]);
+  }
+  close(st->fd);
+  delete st;
+}
+
+static frame_source_t *openV4l2(uint32_t fourcc)
+{
+  v4l2_state *st = new v4l2_state;
+  st->held = -1;
+  st->fourcc = fourcc;
+  st->fd = open(YUV_DEVICE, O_RDWR);
+  if (st->fd < 0) {
+    err(1, "Cannot open %s", YUV_DEVICE);
+  }
+
+  // The driver may round the size; what it reports back is what we get
+  struct v4l2_format fmt;
+  memset(&fmt, 0, sizeof(fmt));
+  fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  fmt.fmt.pix.width = opts.yuvWidth ? opts.yuvWidth : CAPTURE_WIDTH;
+  fmt.fmt.pix.height = opts.yuvHeight ? opts.yuvHeight : CAPTURE_HEIGHT;
+  fmt.fmt.pix.pixelformat = fourcc;
+  fmt.fmt.pix.field = V4L2_FIELD_ANY;
+  if (ioctl(st->fd, VIDIOC_S_FMT, &fmt) < 0) {
+    err(1, "%s: VIDIOC_S_FMT", YUV_DEVICE);
+  }
+  if (fmt.fmt.pix.pixelformat != fourcc) {
+    errx(1, "%s does not capture %s", YUV_DEVICE, opts.yuvFormat);
+  }
+  int width = fmt.fmt.pix.width, height = fmt.fmt.pix.height;
+  st->stride = fmt.fmt.pix.bytesperline;
+  if (st->stride == 0) {
+    st->stride = fourcc == V4L2_PIX_FMT_YUYV ? 2 * (size_t)width : width;
+  }
+
+  struct v4l2_requestbuffers req;
+  memset(&req, 0, sizeof(req));
+  req.count = YUV_BUFFERS;
+  req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  req.memory = V4L2_MEMORY_MMAP;
+  if (ioctl(st->fd, VIDIOC_REQBUFS, &req) < 0) {
+    err(1, "%s: VIDIOC_REQBUFS", YUV_DEVICE);
+  }
+  if (req.count < YUV_BUFFERS) {
+    errx(1, "%s: only %u capture buffers", YUV_DEVICE, req.count);
+  }
+  for (int k = 0; k < YUV_BUFFERS; k++) {
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = k;
+    if (ioctl(st->fd, VIDIOC_QUERYBUF, &buf) < 0) {
+      err(1, "%s: VIDIOC_QUERYBUF", YUV_DEVICE);
+    }
+    st->len[k] = buf.length;
+    st->mem[k] = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      st->fd, buf.m.offset);
+    if (st->mem[k] == MAP_FAILED) {
+      err(1, "%s: cannot map capture buffer", YUV_DEVICE);
+    }
+    queueBuffer(st, k);
+  }
+  enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  if (ioctl(st->fd, VIDIOC_STREAMON, &type) < 0) {
+    err(1, "%s: VIDIOC_STREAMON", YUV_DEVICE);
+  }
+  if (fourcc == V4L2_PIX_FMT_YUYV) {
+    st->gray.create(height, width, CV_8UC1);
+  }
+
+  frame_source_t *src = new frame_source_t;
+  src->name = "v4l2 (Y plane)";
+  src->width = width;
+  src->height = height;
+  src->type = CV_8UC1;
+  src->persistent = 0;
+  src->read = v4l2Read;
+  src->close = v4l2Close;
+  src->state = st;
+  return src;
+}
+
+/*******************************************
+ * Raw YUV file source: back-to-back frames as written by a decoder or
+ * `ffmpeg -f rawvideo`. The file is mapped, and for NV12/I420 each frame
+ * is a Mat header over its Y plane, valid until close.
+ ********************************************/
+struct yuv_file_state {
+  uint8_t *base;
+  size_t bytes;
+  size_t frameBytes;
+  int frames;
+  int next;
+  uint32_t fourcc;
+  Mat gray;              // gathered Y plane, YUYV only
+};
+
+static int yuvFileRead(frame_source_t *src, Mat& frame)
+{
+  yuv_file_state *st = (yuv_file_state *)src->state;
+  if (st->next == st->frames) {
+    return 0;
+  }
+  uint8_t *p = st->base + st->next * st->frameBytes;
+  st->next++;
+  if (st->fourcc == V4L2_PIX_FMT_YUYV) {
+    yuyvLuma(p, 2 * (size_t)src->width, st->gray);
+    frame = st->gray;
+  } else {
+    frame = Mat(src->height, src->width, CV_8UC1, p, src->width);
+  }
+  return 1;
+}
+
+static void yuvFileClose(frame_source_t *src)
+{
+  yuv_file_state *st = (yuv_file_state *)src->state;
+  munmap(st->base, st->bytes);
+  delete st;
+}
+
+static frame_source_t *openYuvFile(const char *path, uint32_t fourcc)
+{
+  if (opts.yuvWidth <= 0 || opts.yuvHeight <= 0) {
+    errx(1, "Raw YUV input needs its frame size: -y %s:WxH", opts.yuvFormat);
+  }
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    err(1, "Cannot open %s", path);
+  }
+  struct stat sb;
+  if (fstat(fd, &sb) < 0) {
+    err(1, "Cannot stat %s", path);
+  }
+
+  yuv_file_state *st = new yuv_file_state;
+  st->fourcc = fourcc;
+  st->frameBytes = frameBytes(fourcc, opts.yuvWidth, opts.yuvHeight);
+  st->frames = (int)(sb.st_size / st->frameBytes);
+  if (st->frames == 0) {
+    errx(1, "%s holds no whole %dx%d %s frame", path, opts.yuvWidth, opts.yuvHeight,
+         opts.yuvFormat);
+  }
+  st->bytes = st->frames * st->frameBytes;
+  void *p = mmap(NULL, st->bytes, PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    err(1, "Cannot map %s", path);
+  }
+  close(fd);
+  madvise(p, st->bytes, MADV_SEQUENTIAL);
+  st->base = (uint8_t *)p;
+  st->next = 0;
+  if (fourcc == V4L2_PIX_FMT_YUYV) {
+    st->gray.create(opts.yuvHeight, opts.yuvWidth, CV_8UC1);
+  }
+
+  frame_source_t *src = new frame_source_t;
+  src->name = "yuv file (Y plane)";
+  src->width = opts.yuvWidth;
+  src->height = opts.yuvHeight;
+  src->type = CV_8UC1;
+  src->persistent = fourcc != V4L2_PIX_FMT_YUYV;
+  src->read = yuvFileRead;
+  src->close = yuvFileClose;
+  src->state = st;
+  return src;
+}
+
+/*******************************************
+ * Model: openYuvSource
+ * Input: None (uses opts)
+ * Output: frame source yielding the Y plane of each frame as CV_8UC1
+ * Desc: -w captures from the V4L2 device in the -y format, -f reads a raw
+ *  YUV file. The processing loops see a gray source and skip grayScale().
+ ********************************************/
+frame_source_t *openYuvSource()
+{
+  uint32_t fourcc = fourccOf(opts.yuvFormat);
+  if (opts.webcam) {
+    return openV4l2(fourcc);
+  }
+  return openYuvFile(opts.videoFile, fourcc);
+}